@@ -0,0 +1,141 @@
+/*
+ *  Face manager 0.1
+ *  Bounded blocking queue used to connect processing stages running on different threads
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_BOUNDED_QUEUE_H
+#define FACE_MANAGER_BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+/*
+ * FIFO queue with a fixed capacity. Producers block when the queue is full which provides
+ * back-pressure so that a fast stage cannot run arbitrarily far ahead of a slow one.
+ * Once close() has been called no more items can be added and consumers drain what is left.
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1) {
+    }
+
+    /*
+     * Add an item, blocking while the queue is full.
+     * Returns false if the queue was closed before the item could be added.
+     */
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!closed_ && items_.size() >= capacity_) {
+            ++full_waits_;
+            not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        }
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(std::move(item));
+        recordDepth();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    /*
+     * Add an item only if there is room for it without waiting. The item is moved into the queue only
+     * if it was added, returns false if the queue was full or closed.
+     */
+    bool tryPush(T &item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_ || items_.size() >= capacity_) {
+            return false;
+        }
+        items_.push_back(std::move(item));
+        recordDepth();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    /*
+     * Remove the item at the head of the queue, blocking while the queue is empty.
+     * Returns false once the queue has been closed and all remaining items have been consumed.
+     */
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    // Signal that no more items will be added and wake any waiting threads
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return items_.size();
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    // Largest number of items seen in the queue
+    size_t maxDepth() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return max_depth_;
+    }
+
+    // Mean number of items in the queue, sampled each time an item is added
+    double meanDepth() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return (0 == push_count_) ? 0 : (double) depth_total_ / push_count_;
+    }
+
+    // Number of times a producer had to wait because the queue was full
+    long fullWaits() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return full_waits_;
+    }
+
+private:
+    void recordDepth() {
+        size_t depth = items_.size();
+        ++push_count_;
+        depth_total_ += depth;
+        if (depth > max_depth_) {
+            max_depth_ = depth;
+        }
+    }
+
+    const size_t capacity_;
+    std::deque<T> items_;
+    bool closed_ = false;
+
+    mutable std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+
+    // statistics so we can see where the pipeline is backing up
+    long push_count_ = 0;
+    long long depth_total_ = 0;
+    size_t max_depth_ = 0;
+    long full_waits_ = 0;
+};
+
+#endif //FACE_MANAGER_BOUNDED_QUEUE_H
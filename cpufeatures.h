@@ -0,0 +1,51 @@
+/*
+ *  Face manager 0.1
+ *  Runtime detection of the SIMD instruction sets supported by the CPU
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_CPU_FEATURES_H
+#define FACE_MANAGER_CPU_FEATURES_H
+
+/*
+ * x86 kernels are compiled with per-function target attributes so that a single binary can choose
+ * between SSE2 and AVX2 at runtime. On ARM we rely on the compiler flags since NEON is either
+ * enabled for the whole build or not at all.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define FACE_MANAGER_X86_SIMD 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FACE_MANAGER_NEON_SIMD 1
+#endif
+
+inline bool cpuHasSse2() {
+#ifdef FACE_MANAGER_X86_SIMD
+    return __builtin_cpu_supports("sse2");
+#else
+    return false;
+#endif
+}
+
+inline bool cpuHasAvx2() {
+#ifdef FACE_MANAGER_X86_SIMD
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+inline bool cpuHasNeon() {
+#ifdef FACE_MANAGER_NEON_SIMD
+    return true;
+#else
+    return false;
+#endif
+}
+
+#endif //FACE_MANAGER_CPU_FEATURES_H
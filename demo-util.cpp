@@ -32,6 +32,18 @@ MotionDetector *motionDetectorFactory(MotionMethod method) {
             return new FrameDifferenceMotionDetector(MOTION_WIDTH, MOTION_DIFF_THRESHOLD, false);
         case MOTION_DIFF_WITH_BLUR:
             return new FrameDifferenceMotionDetector(MOTION_WIDTH, MOTION_DIFF_THRESHOLD, true);
+        case MOTION_DIFF_FUSED:
+            return new FusedFrameDifferenceMotionDetector(MOTION_WIDTH, MOTION_DIFF_THRESHOLD);
+        case MOTION_DIFF_TILED:
+            return new TiledFrameDifferenceMotionDetector(MOTION_WIDTH, MOTION_DIFF_THRESHOLD);
+        case MOTION_CONTOURS_FIXED:
+            return new ContourMotionDetector(MOTION_WIDTH, MOTION_CONTOUR_MIN_AREA, true);
+        case MOTION_MSE_FIXED:
+            return new MeanSquaredErrorMotionDetector(MOTION_WIDTH, MOTION_MSE_THRESHOLD, false, true);
+        case MOTION_MSE_WITH_BLUR_FIXED:
+            return new MeanSquaredErrorMotionDetector(MOTION_WIDTH, MOTION_MSE_THRESHOLD, true, true);
+        case MOTION_BACKGROUND:
+            return new BackgroundModelMotionDetector(MOTION_WIDTH, MOTION_BACKGROUND_THRESHOLD);
         default:
             std::cerr << "invalid motion detector type" << std::endl;
             std::exit(1);
@@ -65,6 +77,18 @@ MotionMethod motionMethodFromString(std::string method_name) {
         return MOTION_DIFF;
     } else if (method_name == "DIFF_WITH_BLUR") {
         return MOTION_DIFF_WITH_BLUR;
+    } else if (method_name == "DIFF_FUSED") {
+        return MOTION_DIFF_FUSED;
+    } else if (method_name == "DIFF_TILED") {
+        return MOTION_DIFF_TILED;
+    } else if (method_name == "CONTOURS_FIXED") {
+        return MOTION_CONTOURS_FIXED;
+    } else if (method_name == "MSE_FIXED") {
+        return MOTION_MSE_FIXED;
+    } else if (method_name == "MSE_WITH_BLUR_FIXED") {
+        return MOTION_MSE_WITH_BLUR_FIXED;
+    } else if (method_name == "BACKGROUND") {
+        return MOTION_BACKGROUND;
     } else {
         std::cerr << "invalid motion detector type: '" << method_name << "'" << std::endl;
         std::exit(1);
@@ -92,6 +116,18 @@ std::string motionMethodToString(MotionMethod method) {
             return "DIFF";
         case MOTION_DIFF_WITH_BLUR:
             return "DIFF_WITH_BLUR";
+        case MOTION_DIFF_FUSED:
+            return "DIFF_FUSED";
+        case MOTION_DIFF_TILED:
+            return "DIFF_TILED";
+        case MOTION_CONTOURS_FIXED:
+            return "CONTOURS_FIXED";
+        case MOTION_MSE_FIXED:
+            return "MSE_FIXED";
+        case MOTION_MSE_WITH_BLUR_FIXED:
+            return "MSE_WITH_BLUR_FIXED";
+        case MOTION_BACKGROUND:
+            return "BACKGROUND";
         default:
             return "";
     }
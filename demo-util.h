@@ -22,7 +22,13 @@ enum MotionMethod {
     MOTION_MSE,      // Use mean squared error
     MOTION_MSE_WITH_BLUR, // Use mean squared error after blurring
     MOTION_DIFF,     // use frame differencing
-    MOTION_DIFF_WITH_BLUR // use frame differencing after blurring
+    MOTION_DIFF_WITH_BLUR, // use frame differencing after blurring
+    MOTION_DIFF_FUSED, // frame differencing in a single pass, same result as MOTION_DIFF
+    MOTION_DIFF_TILED, // frame differencing by tiles, stopping as soon as motion is found
+    MOTION_CONTOURS_FIXED, // MOTION_CONTOURS with an 8 bit running average
+    MOTION_MSE_FIXED, // MOTION_MSE with 8 bit images and running average
+    MOTION_MSE_WITH_BLUR_FIXED, // MOTION_MSE_WITH_BLUR with 8 bit images and running average
+    MOTION_BACKGROUND // per pixel background model compensated for global lighting changes
 };
 
 int const WARM_UP_FRAMES = 5;
@@ -30,6 +36,7 @@ int const MOTION_WIDTH = 500;
 double const MOTION_CONTOUR_MIN_AREA = 500;
 double const MOTION_MSE_THRESHOLD = 2000;
 double const MOTION_DIFF_THRESHOLD = 250;
+double const MOTION_BACKGROUND_THRESHOLD = 500;
 
 // ----------------------------------------------------------------------------------------
 
@@ -0,0 +1,206 @@
+/*
+ *  Face manager 0.1
+ *  Adjusts how often and at what scale faces are detected to keep within a processing time budget
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include "detectioncontroller.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+// Weight of the latest frame in the smoothed frame times
+double const TIMING_SMOOTHING = 0.1;
+
+// Each scale step reduces the frame size by this factor, detection and tracking cost roughly follow the area
+double const SCALE_STEP = 0.8;
+
+// Number of frames to wait after changing the scale before changing it again
+int const SCALE_HOLD_FRAMES = 30;
+
+// Only increase the scale if the predicted frame time leaves this much of the budget spare
+double const SCALE_UP_HEADROOM = 0.8;
+
+// Fraction of the FPS budget used while the scene is quiet, leaving the rest of the CPU free
+double const QUIET_BUDGET_FRACTION = 0.75;
+
+// Scene activity decays by this factor each frame and the scene is active while it is above the threshold
+double const ACTIVITY_DECAY = 0.97;
+double const ACTIVITY_THRESHOLD = 0.5;
+
+static double
+smooth(double average, double value) {
+    return (0 == average) ? value : average + TIMING_SMOOTHING * (value - average);
+}
+
+DetectionController::DetectionController(BudgetType type, double target, int interval, double max_scale)
+        : type_(type), target_(target), interval_(std::max(1, interval)), start_interval_(interval_),
+          scale_(max_scale), max_scale_(max_scale) {
+    max_interval_ = std::max(max_interval_, interval_);
+    min_scale_ = std::min(min_scale_, max_scale_);
+}
+
+void
+DetectionController::reset() {
+    interval_ = std::min(std::max(start_interval_, min_interval_), max_interval_);
+    scale_ = max_scale_;
+    detect_seconds_ = 0;
+    track_seconds_ = 0;
+    tracker_count_ = 0;
+    activity_ = 0;
+    frames_since_scale_change_ = 0;
+}
+
+void
+DetectionController::minInterval(int interval) {
+    min_interval_ = std::max(1, interval);
+    max_interval_ = std::max(max_interval_, min_interval_);
+    interval_ = std::max(interval_, min_interval_);
+}
+
+void
+DetectionController::maxInterval(int interval) {
+    max_interval_ = std::max(min_interval_, interval);
+    interval_ = std::min(interval_, max_interval_);
+}
+
+void
+DetectionController::minScale(double scale) {
+    min_scale_ = std::min(max_scale_, std::max(0.0, scale));
+    scale_ = std::max(scale_, min_scale_);
+}
+
+bool
+DetectionController::sceneActive() const {
+    return (tracker_count_ > 0) || (activity_ >= ACTIVITY_THRESHOLD);
+}
+
+void
+DetectionController::frameProcessed(double seconds, bool full_scan, int tracker_count, int new_faces,
+                                    int lost_trackers) {
+    if (full_scan) {
+        detect_seconds_ = smooth(detect_seconds_, seconds);
+    } else {
+        track_seconds_ = smooth(track_seconds_, seconds);
+    }
+
+    tracker_count_ = tracker_count;
+    activity_ = activity_ * ACTIVITY_DECAY + new_faces + lost_trackers;
+    ++frames_since_scale_change_;
+
+    if (BUDGET_FPS == type_) {
+        controlFps();
+    } else {
+        controlLatency();
+    }
+}
+
+int
+DetectionController::requiredInterval(double detect_seconds, double track_seconds, double budget) const {
+    // mean frame time for an interval of n is (detect_seconds + (n - 1) * track_seconds) / n
+    if (detect_seconds <= budget) {
+        return 1;
+    }
+    if (track_seconds >= budget) {
+        return 0;
+    }
+    return (int) std::ceil((detect_seconds - track_seconds) / (budget - track_seconds));
+}
+
+void
+DetectionController::controlFps() {
+    if (0 == detect_seconds_) {
+        return;
+    }
+
+    double budget = 1.0 / target_;
+    if (!sceneActive()) {
+        budget *= QUIET_BUDGET_FRACTION;
+    }
+
+    int required = requiredInterval(detect_seconds_, track_seconds_, budget);
+    if ((0 == required) || (required > max_interval_)) {
+        interval_ = max_interval_;
+        if (frames_since_scale_change_ >= SCALE_HOLD_FRAMES) {
+            changeScale(scale_ * SCALE_STEP);
+        }
+        return;
+    }
+    interval_ = std::max(min_interval_, required);
+
+    // spend any spare time on a larger scale if it would still fit in the budget
+    if ((scale_ < max_scale_) && (frames_since_scale_change_ >= SCALE_HOLD_FRAMES)) {
+        double larger_scale = std::min(max_scale_, scale_ / SCALE_STEP);
+        double area = (larger_scale * larger_scale) / (scale_ * scale_);
+        int larger_required = requiredInterval(detect_seconds_ * area, track_seconds_ * area,
+                                               budget * SCALE_UP_HEADROOM);
+        if ((0 != larger_required) && (larger_required <= max_interval_) && changeScale(larger_scale)) {
+            interval_ = std::max(min_interval_, larger_required);
+        }
+    }
+}
+
+void
+DetectionController::controlLatency() {
+    interval_ = sceneActive() ? min_interval_ : max_interval_;
+    if (frames_since_scale_change_ < SCALE_HOLD_FRAMES) {
+        return;
+    }
+
+    double slowest = std::max(detect_seconds_, track_seconds_);
+    if (slowest > target_) {
+        changeScale(scale_ * SCALE_STEP);
+    } else if (scale_ < max_scale_) {
+        double larger_scale = std::min(max_scale_, scale_ / SCALE_STEP);
+        double area = (larger_scale * larger_scale) / (scale_ * scale_);
+        if (slowest * area <= target_ * SCALE_UP_HEADROOM) {
+            changeScale(larger_scale);
+        }
+    }
+}
+
+// Returns false if the scale is already at its limit
+bool
+DetectionController::changeScale(double scale) {
+    scale = std::min(max_scale_, std::max(min_scale_, scale));
+    if (scale == scale_) {
+        return false;
+    }
+
+    // assume the cost follows the area of the frame until the new scale has been measured
+    double area = (scale * scale) / (scale_ * scale_);
+    detect_seconds_ *= area;
+    track_seconds_ *= area;
+    scale_ = scale;
+    frames_since_scale_change_ = 0;
+    return true;
+}
+
+BudgetType budgetTypeFromString(std::string type_name) {
+    std::transform(type_name.begin(), type_name.end(), type_name.begin(), ::toupper);
+    if (type_name == "FPS") {
+        return BUDGET_FPS;
+    } else if (type_name == "LATENCY") {
+        return BUDGET_LATENCY;
+    } else {
+        std::cerr << "invalid budget type: '" << type_name << "'" << std::endl;
+        std::exit(1);
+    }
+}
+
+std::string budgetTypeToString(BudgetType type) {
+    switch (type) {
+        case BUDGET_FPS:
+            return "FPS";
+        case BUDGET_LATENCY:
+            return "LATENCY";
+    }
+    return "";
+}
@@ -0,0 +1,139 @@
+/*
+ *  Face manager 0.1
+ *  Adjusts how often and at what scale faces are detected to keep within a processing time budget
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_DETECTION_CONTROLLER_H
+#define FACE_MANAGER_DETECTION_CONTROLLER_H
+
+#include <string>
+
+enum BudgetType {
+    BUDGET_FPS,    // mean frame rate over frames with and without face detection
+    BUDGET_LATENCY // processing time of every frame, including those where faces are detected
+};
+
+/*
+ * Chooses the detector frame interval and processing scale from the measured cost of frames with and without
+ * a full face detection and how busy the scene is.
+ *
+ * For an FPS budget the interval is the shortest one for which the mean frame time meets the budget, and is only
+ * lengthened to save CPU when nothing is happening in the scene. If the budget can't be met with the longest
+ * interval the processing scale is reduced, and increased again once there is enough time to spare.
+ *
+ * For a latency budget the interval makes no difference to the time of any single frame so only the scale is
+ * used to keep within the budget, the interval is short while people are arriving or being lost and long
+ * while the scene is quiet.
+ */
+class DetectionController {
+public:
+    /*
+     * target is frames per second for BUDGET_FPS or seconds per frame for BUDGET_LATENCY.
+     * The interval and scale start at the given values and the scale is never increased above max_scale.
+     */
+    DetectionController(BudgetType type, double target, int interval, double max_scale);
+
+    /*
+     * Record the time taken to process a frame and what happened in it. full_scan is true if the detector
+     * was run on the whole frame, lost_trackers is the number of trackers dropped for low confidence.
+     */
+    void frameProcessed(double seconds, bool full_scan, int tracker_count, int new_faces, int lost_trackers);
+
+    // Forget the frames seen so far and go back to the starting interval and scale, keeping the limits
+    void reset();
+
+    BudgetType budgetType() const {
+        return type_;
+    }
+
+    double target() const {
+        return target_;
+    }
+
+    int interval() const {
+        return interval_;
+    }
+
+    double scale() const {
+        return scale_;
+    }
+
+    /*
+     * get / set the range of detector intervals that may be used
+     */
+    int minInterval() const {
+        return min_interval_;
+    }
+
+    void minInterval(int interval);
+
+    int maxInterval() const {
+        return max_interval_;
+    }
+
+    void maxInterval(int interval);
+
+    /*
+     * get / set the smallest processing scale that may be used
+     */
+    double minScale() const {
+        return min_scale_;
+    }
+
+    void minScale(double scale);
+
+    // true if anyone is being tracked or people have recently appeared or been lost
+    bool sceneActive() const;
+
+    // smoothed processing time of frames with and without a full detection, 0 until measured
+    double detectSeconds() const {
+        return detect_seconds_;
+    }
+
+    double trackSeconds() const {
+        return track_seconds_;
+    }
+
+private:
+    void controlFps();
+
+    void controlLatency();
+
+    // shortest interval for which the mean frame time fits in budget, 0 if no interval is long enough
+    int requiredInterval(double detect_seconds, double track_seconds, double budget) const;
+
+    bool changeScale(double scale);
+
+    BudgetType type_;
+    double target_;
+
+    int interval_;
+    int start_interval_;
+    int min_interval_ = 1;
+    int max_interval_ = 30;
+
+    double scale_;
+    double min_scale_ = 0.25;
+    double max_scale_;
+
+    double detect_seconds_ = 0;
+    double track_seconds_ = 0;
+
+    // trackers running in the last frame and the number of new faces and lost trackers, decaying each frame
+    int tracker_count_ = 0;
+    double activity_ = 0;
+
+    // frames since the scale was last changed, so the timings can settle before changing it again
+    int frames_since_scale_change_ = 0;
+};
+
+BudgetType budgetTypeFromString(std::string type_name);
+
+std::string budgetTypeToString(BudgetType type);
+
+#endif //FACE_MANAGER_DETECTION_CONTROLLER_H
@@ -10,6 +10,7 @@
 
 #include "facedetector.h"
 #include "imagelogger.h"
+#include "tracing.h"
 
 #include <dlib/matrix.h>
 #include <dlib/dnn.h>
@@ -66,15 +67,32 @@ public:
 
     std::vector<dlib::rectangle> detectFaces(const dlib::array2d<dlib::rgb_pixel> &image);
 
+    std::vector<dlib::rectangle> detectFaces(const dlib::cv_image<unsigned char> &image);
+
+    void analyseImages(const std::vector<dlib::array2d<dlib::rgb_pixel>> &images, size_t begin, size_t end,
+                       std::vector<std::vector<FaceAnalysis>> &faces) const;
+
+    /*
+     * The face image extraction functions record the landmark and chip extraction latencies if latencies
+     * is not null.
+     */
     // TODO generalise the returned image type
     std::vector<dlib::matrix<dlib::rgb_pixel>> extractFaceImages(const dlib::cv_image<dlib::bgr_pixel> &image,
-                                                                 const std::vector<dlib::rectangle> &face_bounds) const;
+                                                                 const std::vector<dlib::rectangle> &face_bounds,
+                                                                 StageLatencies *latencies = nullptr) const;
 
     dlib::matrix<dlib::rgb_pixel> extractFaceImage(const dlib::cv_image<dlib::bgr_pixel> &image,
-                                                   const dlib::rectangle &face_bounds) const;
+                                                   const dlib::rectangle &face_bounds,
+                                                   StageLatencies *latencies = nullptr) const;
 
     dlib::matrix<dlib::rgb_pixel> extractFaceImage(const dlib::array2d<dlib::rgb_pixel> &image,
-                                                   const dlib::rectangle &face_bounds) const;
+                                                   const dlib::rectangle &face_bounds,
+                                                   StageLatencies *latencies = nullptr) const;
+
+    // Find the landmarks and use them to extract a normalised face chip
+    template<typename image_type>
+    FaceAnalysis analyseFace(const image_type &image, const dlib::rectangle &face_bounds,
+                             StageLatencies *latencies = nullptr) const;
 
     std::vector<FaceDescriptor> getFaceDescriptors(std::vector<dlib::matrix<dlib::rgb_pixel>> face_images);
 
@@ -114,73 +132,86 @@ FaceDetectorImpl::detectFaces(const dlib::array2d<dlib::rgb_pixel> &image) {
     return face_detector(image);
 }
 
+std::vector<dlib::rectangle>
+FaceDetectorImpl::detectFaces(const dlib::cv_image<unsigned char> &image) {
+    return face_detector(image);
+}
+
+void
+FaceDetectorImpl::analyseImages(const std::vector<dlib::array2d<dlib::rgb_pixel>> &images, size_t begin, size_t end,
+                                std::vector<std::vector<FaceAnalysis>> &faces) const {
+    // the detector is not thread-safe so use a copy, the landmark detector is
+    dlib::frontal_face_detector detector = face_detector;
+    for (size_t i = begin; i < end; ++i) {
+        for (const auto &face_bounds : detector(images[i])) {
+            faces[i].push_back(analyseFace(images[i], face_bounds));
+        }
+    }
+}
 
 std::vector<dlib::matrix<dlib::rgb_pixel>>
 FaceDetectorImpl::extractFaceImages(const dlib::cv_image<dlib::bgr_pixel> &image,
-                                    const std::vector<dlib::rectangle> &face_bounds) const {
+                                    const std::vector<dlib::rectangle> &face_bounds,
+                                    StageLatencies *latencies) const {
     // These are the transformed and extracted faces
     std::vector<dlib::matrix<dlib::rgb_pixel>> faces;
 
     // Loop over all detected face rectangles
     for (const auto &face_bound : face_bounds) {
-        faces.push_back(std::move(extractFaceImage(image, face_bound)));
+        faces.push_back(std::move(extractFaceImage(image, face_bound, latencies)));
     }
     return faces;
 }
 
 
-// TODO fix duplication
-dlib::matrix<dlib::rgb_pixel>
-FaceDetectorImpl::extractFaceImage(const dlib::cv_image<dlib::bgr_pixel> &image,
-                                   const dlib::rectangle &face_bounds) const {
+template<typename image_type>
+FaceAnalysis
+FaceDetectorImpl::analyseFace(const image_type &image, const dlib::rectangle &face_bounds,
+                              StageLatencies *latencies) const {
+    FaceAnalysis face;
+    face.bounds = face_bounds;
+
     // Find the face landmarks
-    dlib::full_object_detection landmarks = landmark_detector(image, face_bounds);
+    int64 start_ticks = cv::getTickCount();
+    face.landmarks = landmark_detector(image, face_bounds);
+    if (latencies) {
+        (*latencies)[LATENCY_LANDMARKS].recordSince(start_ticks);
+        start_ticks = cv::getTickCount();
+    }
 
     // use the landmarks to normalise the face image and extract
-    dlib::matrix<dlib::rgb_pixel> face_chip;
-    dlib::extract_image_chip(image, dlib::get_face_chip_details(landmarks, 150, 0.25), face_chip);
-    logger.debug("face-chip", face_chip);
-    return face_chip;
+    dlib::extract_image_chip(image, dlib::get_face_chip_details(face.landmarks, 150, 0.25), face.chip);
+    if (latencies) {
+        (*latencies)[LATENCY_CHIP_EXTRACTION].recordSince(start_ticks);
+    }
+    LOG_DEBUG("face-chip", face.chip);
+    return face;
 }
 
 dlib::matrix<dlib::rgb_pixel>
-FaceDetectorImpl::extractFaceImage(const dlib::array2d<dlib::rgb_pixel> &image,
-                                   const dlib::rectangle &face_bounds) const {
-    // Find the face landmarks
-    dlib::full_object_detection landmarks = landmark_detector(image, face_bounds);
+FaceDetectorImpl::extractFaceImage(const dlib::cv_image<dlib::bgr_pixel> &image,
+                                   const dlib::rectangle &face_bounds, StageLatencies *latencies) const {
+    return analyseFace(image, face_bounds, latencies).chip;
+}
 
-    // use the landmarks to normalise the face image and extract
-    dlib::matrix<dlib::rgb_pixel> face_chip;
-    dlib::extract_image_chip(image, dlib::get_face_chip_details(landmarks, 150, 0.25), face_chip);
-    logger.debug("face-chip", face_chip);
-    return face_chip;
+dlib::matrix<dlib::rgb_pixel>
+FaceDetectorImpl::extractFaceImage(const dlib::array2d<dlib::rgb_pixel> &image,
+                                   const dlib::rectangle &face_bounds, StageLatencies *latencies) const {
+    return analyseFace(image, face_bounds, latencies).chip;
 }
 
 std::vector<FaceDescriptor>
 FaceDetectorImpl::getFaceDescriptors(std::vector<dlib::matrix<dlib::rgb_pixel>> face_images) {
+    // all the faces are run through the network in a single batch
     return face_metrics_net(face_images);
 }
 
 
-// From dnn_face_recognition_ex.cpp
-std::vector<dlib::matrix<dlib::rgb_pixel>>
-jitter_image(const dlib::matrix<dlib::rgb_pixel> &img) {
-    // All this function does is make 100 copies of img, all slightly jittered by being
-    // zoomed, rotated, and translated a little bit differently. They are also randomly
-    // mirrored left to right.
-    thread_local dlib::rand rnd;
-
-    std::vector<dlib::matrix<dlib::rgb_pixel>> crops;
-    for (int i = 0; i < 100; ++i)
-        crops.push_back(dlib::jitter_image(img, rnd));
-
-    return crops;
-}
-
 FaceDescriptor
 FaceDetectorImpl::getFaceDescriptor(const dlib::matrix<dlib::rgb_pixel> &face_image, bool use_jitter) {
     if (use_jitter) {
-        return dlib::mean(dlib::mat(face_metrics_net(jitter_image(face_image))));
+        thread_local dlib::rand rnd;
+        return dlib::mean(dlib::mat(face_metrics_net(FaceDetector::jitterFace(face_image, rnd))));
     } else {
         std::vector<dlib::matrix<dlib::rgb_pixel>> face_images{face_image};
         auto descriptors = face_metrics_net(face_images);
@@ -199,49 +230,139 @@ FaceDetector::~FaceDetector() {
 
 std::vector<dlib::rectangle>
 FaceDetector::detectFaces(const dlib::cv_image<dlib::bgr_pixel> &image) {
+    TRACE_SPAN("FaceDetector::detectFaces");
     ++counters_.detect_count_;
-    return impl->detectFaces(image);
+    counters_.detect_pixels_ += (long long) image.nr() * image.nc();
+    int64 start_ticks = cv::getTickCount();
+    std::vector<dlib::rectangle> faces = impl->detectFaces(image);
+    latencies_[LATENCY_DETECTION].recordSince(start_ticks);
+    return faces;
 }
 
 std::vector<dlib::rectangle>
 FaceDetector::detectFaces(const dlib::array2d<dlib::rgb_pixel> &image) {
+    TRACE_SPAN("FaceDetector::detectFaces");
     ++counters_.detect_count_;
-    return impl->detectFaces(image);
+    counters_.detect_pixels_ += (long long) image.nr() * image.nc();
+    int64 start_ticks = cv::getTickCount();
+    std::vector<dlib::rectangle> faces = impl->detectFaces(image);
+    latencies_[LATENCY_DETECTION].recordSince(start_ticks);
+    return faces;
+}
+
+std::vector<dlib::rectangle>
+FaceDetector::detectFaces(const dlib::cv_image<unsigned char> &image) {
+    TRACE_SPAN("FaceDetector::detectFaces");
+    ++counters_.detect_count_;
+    counters_.detect_pixels_ += (long long) image.nr() * image.nc();
+    int64 start_ticks = cv::getTickCount();
+    std::vector<dlib::rectangle> faces = impl->detectFaces(image);
+    latencies_[LATENCY_DETECTION].recordSince(start_ticks);
+    return faces;
 }
 
 
 std::vector<dlib::matrix<dlib::rgb_pixel>>
 FaceDetector::extractFaceImages(const dlib::cv_image<dlib::bgr_pixel> &image,
                                 const std::vector<dlib::rectangle> &face_bounds) {
+    TRACE_SPAN("FaceDetector::extractFaceImages");
+    counters_.landmark_count_ += face_bounds.size();
     counters_.extract_face_image_count_ += face_bounds.size();
-    return impl->extractFaceImages(image, face_bounds);
+    return impl->extractFaceImages(image, face_bounds, &latencies_);
 }
 
 
 dlib::matrix<dlib::rgb_pixel>
 FaceDetector::extractFaceImage(const dlib::cv_image<dlib::bgr_pixel> &image,
                                const dlib::rectangle &face_bounds) {
+    TRACE_SPAN("FaceDetector::extractFaceImage");
+    ++counters_.landmark_count_;
     ++counters_.extract_face_image_count_;
-    return impl->extractFaceImage(image, face_bounds);
+    return impl->extractFaceImage(image, face_bounds, &latencies_);
 }
 
 dlib::matrix<dlib::rgb_pixel>
 FaceDetector::extractFaceImage(const dlib::array2d<dlib::rgb_pixel> &image,
                                const dlib::rectangle &face_bounds) {
+    TRACE_SPAN("FaceDetector::extractFaceImage");
+    ++counters_.landmark_count_;
+    ++counters_.extract_face_image_count_;
+    return impl->extractFaceImage(image, face_bounds, &latencies_);
+}
+
+
+std::vector<FaceAnalysis>
+FaceDetector::analyseFaces(const dlib::cv_image<dlib::bgr_pixel> &image,
+                           const std::vector<dlib::rectangle> &face_bounds) {
+    counters_.landmark_count_ += face_bounds.size();
+    counters_.extract_face_image_count_ += face_bounds.size();
+    std::vector<FaceAnalysis> faces;
+    for (const auto &face_bound : face_bounds) {
+        TRACE_SPAN("FaceDetector::analyseFace");
+        faces.push_back(impl->analyseFace(image, face_bound, &latencies_));
+    }
+    return faces;
+}
+
+FaceAnalysis
+FaceDetector::analyseFace(const dlib::array2d<dlib::rgb_pixel> &image, const dlib::rectangle &face_bounds) {
+    TRACE_SPAN("FaceDetector::analyseFace");
+    ++counters_.landmark_count_;
     ++counters_.extract_face_image_count_;
-    return impl->extractFaceImage(image, face_bounds);
+    return impl->analyseFace(image, face_bounds, &latencies_);
 }
 
+void
+FaceDetector::analyseImages(const std::vector<dlib::array2d<dlib::rgb_pixel>> &images, size_t begin, size_t end,
+                            std::vector<std::vector<FaceAnalysis>> &faces) const {
+    impl->analyseImages(images, begin, end, faces);
+}
+
+// From dnn_face_recognition_ex.cpp
+std::vector<dlib::matrix<dlib::rgb_pixel>>
+FaceDetector::jitterFace(const dlib::matrix<dlib::rgb_pixel> &face_image, dlib::rand &rnd) {
+    // All this function does is make 100 copies of img, all slightly jittered by being
+    // zoomed, rotated, and translated a little bit differently. They are also randomly
+    // mirrored left to right.
+    std::vector<dlib::matrix<dlib::rgb_pixel>> crops;
+    for (int i = 0; i < FACE_JITTER_COUNT; ++i) {
+        crops.push_back(dlib::jitter_image(face_image, rnd));
+    }
+    return crops;
+}
+
+void
+FaceDetector::computeFaceDescriptors(std::vector<FaceAnalysis> &faces) {
+    std::vector<dlib::matrix<dlib::rgb_pixel>> face_images;
+    for (const auto &face : faces) {
+        face_images.push_back(face.chip);
+    }
+    std::vector<FaceDescriptor> descriptors = getFaceDescriptors(std::move(face_images));
+    for (size_t i = 0; i < faces.size(); ++i) {
+        faces[i].descriptor = descriptors[i];
+    }
+}
 
 std::vector<FaceDescriptor>
 FaceDetector::getFaceDescriptors(std::vector<dlib::matrix<dlib::rgb_pixel>> face_images) {
-    counters_.face_descriptor_count_ += face_images.size();
-    return impl->getFaceDescriptors(face_images);
+    if (face_images.empty()) {
+        return std::vector<FaceDescriptor>();
+    }
+    TRACE_SPAN("FaceDetector::getFaceDescriptors");
+    counters_.recordDescriptorBatch((int) face_images.size());
+    int64 start_ticks = cv::getTickCount();
+    std::vector<FaceDescriptor> descriptors = impl->getFaceDescriptors(std::move(face_images));
+    latencies_[LATENCY_DESCRIPTOR].recordSince(start_ticks);
+    return descriptors;
 }
 
 
 FaceDescriptor
 FaceDetector::getFaceDescriptor(const dlib::matrix<dlib::rgb_pixel> face_image, bool use_jitter) {
-    ++counters_.face_descriptor_count_;
-    return impl->getFaceDescriptor(face_image, use_jitter);
+    TRACE_SPAN(use_jitter ? "FaceDetector::getFaceDescriptor (jittered)" : "FaceDetector::getFaceDescriptor");
+    counters_.recordDescriptorBatch(1);
+    int64 start_ticks = cv::getTickCount();
+    FaceDescriptor descriptor = impl->getFaceDescriptor(face_image, use_jitter);
+    latencies_[LATENCY_DESCRIPTOR].recordSince(start_ticks);
+    return descriptor;
 }
\ No newline at end of file
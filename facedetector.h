@@ -12,23 +12,74 @@
 #define FINAL_PROJECT_FACE_DETECTOR_H
 
 
+#include <algorithm>
 #include <dlib/opencv.h>
+#include <dlib/image_processing/full_object_detection.h>
+#include <dlib/rand.h>
+
+#include "latencyhistogram.h"
 
 // A face descriptor allows us to compare faces and determine if they are the same person
 typedef dlib::matrix<float, 0, 1> FaceDescriptor;
 
+/*
+ * The results of analysing a single face. These are passed along so that each step (landmarks, face chip
+ * extraction and computing the descriptor) only needs to be run once for each face.
+ */
+struct FaceAnalysis {
+    // Where the face was found in the image
+    dlib::rectangle bounds;
+
+    // Facial landmarks used to align the face
+    dlib::full_object_detection landmarks;
+
+    // Aligned and normalised face image
+    dlib::matrix<dlib::rgb_pixel> chip;
+
+    // Only set once computeFaceDescriptors() has been called
+    FaceDescriptor descriptor;
+};
+
+// Number of jittered copies of a face averaged to compute a more robust descriptor
+int const FACE_JITTER_COUNT = 100;
+
 class FaceDetectorImpl;
 
 struct FaceCounters {
 public:
     int detect_count_ = 0;
+
+    // total number of pixels searched by the face detector
+    long long detect_pixels_ = 0;
+
+    int landmark_count_ = 0;
     int extract_face_image_count_ = 0;
     int face_descriptor_count_ = 0;
 
+    // number of forward passes of the face descriptor DNN and the largest number of faces in a single pass
+    int face_descriptor_batch_count_ = 0;
+    int face_descriptor_max_batch_size_ = 0;
+
     inline void reset() {
         detect_count_ = 0;
+        detect_pixels_ = 0;
+        landmark_count_ = 0;
         extract_face_image_count_ = 0;
         face_descriptor_count_ = 0;
+        face_descriptor_batch_count_ = 0;
+        face_descriptor_max_batch_size_ = 0;
+    }
+
+    inline void recordDescriptorBatch(int batch_size) {
+        face_descriptor_count_ += batch_size;
+        ++face_descriptor_batch_count_;
+        face_descriptor_max_batch_size_ = std::max(face_descriptor_max_batch_size_, batch_size);
+    }
+
+    // mean number of faces per forward pass of the face descriptor DNN
+    inline double meanDescriptorBatchSize() const {
+        return (0 == face_descriptor_batch_count_) ? 0 :
+               (double) face_descriptor_count_ / face_descriptor_batch_count_;
     }
 };
 
@@ -49,6 +100,9 @@ public:
     std::vector<dlib::rectangle> detectFaces(const dlib::cv_image<dlib::bgr_pixel> &image);
     std::vector<dlib::rectangle> detectFaces(const dlib::array2d<dlib::rgb_pixel> &image);
 
+    // The HOG detector works on grey images so a luma image can be searched without any conversion
+    std::vector<dlib::rectangle> detectFaces(const dlib::cv_image<unsigned char> &image);
+
     // TODO generalise the returned image type
     std::vector<dlib::matrix<dlib::rgb_pixel>> extractFaceImages(const dlib::cv_image<dlib::bgr_pixel> &image,
                                                                  const std::vector<dlib::rectangle> &face_bounds);
@@ -59,6 +113,39 @@ public:
     dlib::matrix<dlib::rgb_pixel> extractFaceImage(const dlib::array2d<dlib::rgb_pixel> &image,
                                                    const dlib::rectangle &face_bounds);
 
+    /*
+     * Find the landmarks and extract the face chip for each face. The descriptors are not computed
+     * so that the caller can decide which faces need them.
+     */
+    std::vector<FaceAnalysis> analyseFaces(const dlib::cv_image<dlib::bgr_pixel> &image,
+                                           const std::vector<dlib::rectangle> &face_bounds);
+    FaceAnalysis analyseFace(const dlib::array2d<dlib::rgb_pixel> &image, const dlib::rectangle &face_bounds);
+
+    /*
+     * Detect and analyse all the faces in images[begin, end). The HOG detector keeps scratch space so
+     * each call uses its own copy, which means several ranges can be analysed concurrently on different
+     * threads. The counters are not updated, call recordConcurrentWork() from the calling thread afterwards.
+     */
+    void analyseImages(const std::vector<dlib::array2d<dlib::rgb_pixel>> &images, size_t begin, size_t end,
+                       std::vector<std::vector<FaceAnalysis>> &faces) const;
+
+    void recordConcurrentWork(int num_images, long long num_pixels, int num_faces) {
+        counters_.detect_count_ += num_images;
+        counters_.detect_pixels_ += num_pixels;
+        counters_.landmark_count_ += num_faces;
+        counters_.extract_face_image_count_ += num_faces;
+    }
+
+    /*
+     * Make FACE_JITTER_COUNT copies of a face chip that are randomly zoomed, rotated, translated and
+     * mirrored. Only uses the supplied random number generator so can be called from any thread.
+     */
+    static std::vector<dlib::matrix<dlib::rgb_pixel>> jitterFace(const dlib::matrix<dlib::rgb_pixel> &face_image,
+                                                                 dlib::rand &rnd);
+
+    // Compute the descriptors for all the analysed faces in a single batch
+    void computeFaceDescriptors(std::vector<FaceAnalysis> &faces);
+
     std::vector<FaceDescriptor> getFaceDescriptors(std::vector<dlib::matrix<dlib::rgb_pixel>> face_images);
 
     inline FaceDescriptor getFaceDescriptor(dlib::matrix<dlib::rgb_pixel> face_image) {
@@ -71,14 +158,25 @@ public:
      */
     FaceDescriptor getFaceDescriptor(dlib::matrix<dlib::rgb_pixel> face_image, bool use_jitter);
 
+    // also clears the latency histograms
     void resetCounters() {
         counters_.reset();
+        latencies_.reset();
     }
 
     FaceCounters getCounters() const {
         return counters_;
     }
 
+    /*
+     * Latency of each call to detect faces or compute descriptors, and of finding the landmarks and extracting
+     * the chip of each face. Only the detection, landmark, chip extraction and descriptor stages are used.
+     * Like the counters these don't include analyseImages().
+     */
+    const StageLatencies &getLatencies() const {
+        return latencies_;
+    }
+
 private:
     // Avoid having to reference the back-end implementation in the header file. Otherwise we end up
     // putting the definition of the neural net in the header file which adds a lot of noise
@@ -86,6 +184,7 @@ private:
 
     // counters so we can easily check later how much work we are doing
     FaceCounters counters_;
+    StageLatencies latencies_;
 };
 
 
@@ -0,0 +1,378 @@
+/*
+ *  Face manager 0.1
+ *  Contiguous store of face descriptors that can be searched quickly
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include "facegallery.h"
+#include "cpufeatures.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#ifdef FACE_MANAGER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef FACE_MANAGER_NEON_SIMD
+#include <arm_neon.h>
+#endif
+
+// Alignment of the descriptor storage, enough for AVX and a cache line
+size_t const GALLERY_ALIGNMENT = 64;
+size_t const GALLERY_MIN_SLOTS = 64;
+
+size_t const NO_SLOT = std::numeric_limits<size_t>::max();
+
+/*
+ * Kernels that scan a block of descriptors and return the slot with the smallest squared distance
+ * from the query, skipping unused slots. One version for each instruction set.
+ */
+typedef float (*DistanceKernel)(const float *a, const float *b);
+
+typedef size_t (*NearestKernel)(const float *query, const float *data, const int *ids, size_t count,
+                                float *best_distance);
+
+static inline float
+squaredDistanceScalar(const float *a, const float *b) {
+    float sum = 0;
+    for (int i = 0; i < FACE_DESCRIPTOR_SIZE; ++i) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+static size_t
+nearestScalar(const float *query, const float *data, const int *ids, size_t count, float *best_distance) {
+    size_t best_slot = NO_SLOT;
+    float best = std::numeric_limits<float>::max();
+    for (size_t slot = 0; slot < count; ++slot) {
+        if (NO_LOCAL_ID == ids[slot]) {
+            continue;
+        }
+        float distance = squaredDistanceScalar(query, data + slot * FACE_DESCRIPTOR_SIZE);
+        if (distance < best) {
+            best = distance;
+            best_slot = slot;
+        }
+    }
+    *best_distance = best;
+    return best_slot;
+}
+
+#ifdef FACE_MANAGER_X86_SIMD
+
+__attribute__((target("sse2")))
+static inline float
+squaredDistanceSse2(const float *a, const float *b) {
+    // four independent accumulators to hide the latency of the adds
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    __m128 sum2 = _mm_setzero_ps();
+    __m128 sum3 = _mm_setzero_ps();
+    for (int i = 0; i < FACE_DESCRIPTOR_SIZE; i += 16) {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+        __m128 d2 = _mm_sub_ps(_mm_loadu_ps(a + i + 8), _mm_loadu_ps(b + i + 8));
+        __m128 d3 = _mm_sub_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12));
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(d0, d0));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(d1, d1));
+        sum2 = _mm_add_ps(sum2, _mm_mul_ps(d2, d2));
+        sum3 = _mm_add_ps(sum3, _mm_mul_ps(d3, d3));
+    }
+    __m128 sum = _mm_add_ps(_mm_add_ps(sum0, sum1), _mm_add_ps(sum2, sum3));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+    return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("sse2")))
+static size_t
+nearestSse2(const float *query, const float *data, const int *ids, size_t count, float *best_distance) {
+    size_t best_slot = NO_SLOT;
+    float best = std::numeric_limits<float>::max();
+    for (size_t slot = 0; slot < count; ++slot) {
+        if (NO_LOCAL_ID == ids[slot]) {
+            continue;
+        }
+        float distance = squaredDistanceSse2(query, data + slot * FACE_DESCRIPTOR_SIZE);
+        if (distance < best) {
+            best = distance;
+            best_slot = slot;
+        }
+    }
+    *best_distance = best;
+    return best_slot;
+}
+
+__attribute__((target("avx2,fma")))
+static inline float
+squaredDistanceAvx2(const float *a, const float *b) {
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+    __m256 sum3 = _mm256_setzero_ps();
+    for (int i = 0; i < FACE_DESCRIPTOR_SIZE; i += 32) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+        sum0 = _mm256_fmadd_ps(d0, d0, sum0);
+        sum1 = _mm256_fmadd_ps(d1, d1, sum1);
+        sum2 = _mm256_fmadd_ps(d2, d2, sum2);
+        sum3 = _mm256_fmadd_ps(d3, d3, sum3);
+    }
+    __m256 sum8 = _mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3));
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+    return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static size_t
+nearestAvx2(const float *query, const float *data, const int *ids, size_t count, float *best_distance) {
+    size_t best_slot = NO_SLOT;
+    float best = std::numeric_limits<float>::max();
+    for (size_t slot = 0; slot < count; ++slot) {
+        if (NO_LOCAL_ID == ids[slot]) {
+            continue;
+        }
+        float distance = squaredDistanceAvx2(query, data + slot * FACE_DESCRIPTOR_SIZE);
+        if (distance < best) {
+            best = distance;
+            best_slot = slot;
+        }
+    }
+    *best_distance = best;
+    return best_slot;
+}
+
+#endif // FACE_MANAGER_X86_SIMD
+
+#ifdef FACE_MANAGER_NEON_SIMD
+
+static inline float
+squaredDistanceNeon(const float *a, const float *b) {
+    float32x4_t sum0 = vdupq_n_f32(0);
+    float32x4_t sum1 = vdupq_n_f32(0);
+    for (int i = 0; i < FACE_DESCRIPTOR_SIZE; i += 8) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        sum0 = vmlaq_f32(sum0, d0, d0);
+        sum1 = vmlaq_f32(sum1, d1, d1);
+    }
+    float32x4_t sum = vaddq_f32(sum0, sum1);
+    float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    pair = vpadd_f32(pair, pair);
+    return vget_lane_f32(pair, 0);
+}
+
+static size_t
+nearestNeon(const float *query, const float *data, const int *ids, size_t count, float *best_distance) {
+    size_t best_slot = NO_SLOT;
+    float best = std::numeric_limits<float>::max();
+    for (size_t slot = 0; slot < count; ++slot) {
+        if (NO_LOCAL_ID == ids[slot]) {
+            continue;
+        }
+        float distance = squaredDistanceNeon(query, data + slot * FACE_DESCRIPTOR_SIZE);
+        if (distance < best) {
+            best = distance;
+            best_slot = slot;
+        }
+    }
+    *best_distance = best;
+    return best_slot;
+}
+
+#endif // FACE_MANAGER_NEON_SIMD
+
+struct GalleryKernels {
+    const char *name;
+    DistanceKernel distance;
+    NearestKernel nearest;
+};
+
+// Choose the kernels once, the first time they are needed
+static const GalleryKernels &
+galleryKernels() {
+    static const GalleryKernels kernels = []() {
+#ifdef FACE_MANAGER_X86_SIMD
+        if (cpuHasAvx2()) {
+            return GalleryKernels{"AVX2", squaredDistanceAvx2, nearestAvx2};
+        }
+        if (cpuHasSse2()) {
+            return GalleryKernels{"SSE2", squaredDistanceSse2, nearestSse2};
+        }
+#endif
+#ifdef FACE_MANAGER_NEON_SIMD
+        return GalleryKernels{"NEON", squaredDistanceNeon, nearestNeon};
+#endif
+        return GalleryKernels{"scalar", squaredDistanceScalar, nearestScalar};
+    }();
+    return kernels;
+}
+
+
+FaceGallery::FaceGallery() {
+}
+
+FaceGallery::~FaceGallery() {
+    if (!external_storage_) {
+        free(data_);
+    }
+}
+
+bool
+FaceGallery::add(int local_id, const FaceDescriptor &descriptor) {
+    if (FACE_DESCRIPTOR_SIZE != descriptor.size()) {
+        return false;
+    }
+
+    // adopted descriptors are copied before the first change so that their storage is never written
+    if (external_storage_) {
+        reallocate(std::max(GALLERY_MIN_SLOTS, capacity_));
+    }
+
+    size_t slot;
+    if (!findSlot(local_id, slot)) {
+        if (!free_slots_.empty()) {
+            slot = free_slots_.back();
+            free_slots_.pop_back();
+        } else {
+            slot = slot_ids_.size();
+            reserve(slot + 1);
+            slot_ids_.push_back(NO_LOCAL_ID);
+        }
+        slot_ids_[slot] = local_id;
+        slot_of_[local_id] = slot;
+    }
+
+    std::memcpy(data_ + slot * FACE_DESCRIPTOR_SIZE, &descriptor(0), FACE_DESCRIPTOR_SIZE * sizeof(float));
+    return true;
+}
+
+bool
+FaceGallery::remove(int local_id) {
+    size_t slot;
+    if (!findSlot(local_id, slot)) {
+        return false;
+    }
+    slot_ids_[slot] = NO_LOCAL_ID;
+    free_slots_.push_back(slot);
+    slot_of_.erase(local_id);
+    return true;
+}
+
+bool
+FaceGallery::adopt(float *data, const int32_t *local_ids, size_t count, std::shared_ptr<const void> storage) {
+    if (!slot_ids_.empty() || (0 != reinterpret_cast<uintptr_t>(data) % GALLERY_ALIGNMENT)) {
+        return false;
+    }
+
+    for (size_t slot = 0; slot < count; ++slot) {
+        if ((NO_LOCAL_ID == local_ids[slot]) || !slot_of_.emplace(local_ids[slot], slot).second) {
+            slot_of_.clear();
+            return false;
+        }
+    }
+    slot_ids_.assign(local_ids, local_ids + count);
+
+    if (!external_storage_) {
+        free(data_);
+    }
+    data_ = data;
+    capacity_ = count;
+    external_storage_ = storage;
+    return true;
+}
+
+void
+FaceGallery::clear() {
+    slot_ids_.clear();
+    free_slots_.clear();
+    slot_of_.clear();
+}
+
+bool
+FaceGallery::findSlot(int local_id, size_t &slot) const {
+    auto it = slot_of_.find(local_id);
+    if (it == slot_of_.end()) {
+        return false;
+    }
+    slot = it->second;
+    return true;
+}
+
+GalleryMatch
+FaceGallery::findNearest(const FaceDescriptor &descriptor, float max_distance) const {
+    GalleryMatch match;
+    if (empty() || FACE_DESCRIPTOR_SIZE != descriptor.size()) {
+        return match;
+    }
+
+    float best_distance;
+    size_t best_slot = galleryKernels().nearest(&descriptor(0), data_, slot_ids_.data(), slot_ids_.size(),
+                                                &best_distance);
+
+    // compare squared distances to avoid a square root for every descriptor
+    if ((NO_SLOT != best_slot) && (best_distance < max_distance * max_distance)) {
+        match.local_id = slot_ids_[best_slot];
+        match.distance = std::sqrt(best_distance);
+    }
+    return match;
+}
+
+size_t
+FaceGallery::memoryUsage() const {
+    return capacity_ * FACE_DESCRIPTOR_SIZE * sizeof(float) +
+           slot_ids_.capacity() * sizeof(int) +
+           free_slots_.capacity() * sizeof(size_t) +
+           slot_of_.size() * (sizeof(int) + sizeof(size_t) + 2 * sizeof(void *));
+}
+
+float
+FaceGallery::squaredDistance(const float *a, const float *b) {
+    return galleryKernels().distance(a, b);
+}
+
+const char *
+FaceGallery::kernelName() {
+    return galleryKernels().name;
+}
+
+void
+FaceGallery::reserve(size_t num_slots) {
+    if (num_slots <= capacity_) {
+        return;
+    }
+    reallocate(std::max(std::max(GALLERY_MIN_SLOTS, capacity_ * 2), num_slots));
+}
+
+// Move the descriptors into a new block of memory owned by the gallery
+void
+FaceGallery::reallocate(size_t new_capacity) {
+    void *new_data = nullptr;
+    if (0 != posix_memalign(&new_data, GALLERY_ALIGNMENT, new_capacity * FACE_DESCRIPTOR_SIZE * sizeof(float))) {
+        throw std::bad_alloc();
+    }
+    if (data_) {
+        std::memcpy(new_data, data_, slot_ids_.size() * FACE_DESCRIPTOR_SIZE * sizeof(float));
+        if (!external_storage_) {
+            free(data_);
+        }
+    }
+    external_storage_.reset();
+    data_ = static_cast<float *>(new_data);
+    capacity_ = new_capacity;
+}
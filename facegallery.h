@@ -0,0 +1,134 @@
+/*
+ *  Face manager 0.1
+ *  Contiguous store of face descriptors that can be searched quickly
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_FACE_GALLERY_H
+#define FACE_MANAGER_FACE_GALLERY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "facedetector.h"
+
+// Number of values in a face descriptor produced by the face recognition DNN
+int const FACE_DESCRIPTOR_SIZE = 128;
+
+// Used to indicate a gallery slot that is not in use or a search that found nothing
+int const NO_LOCAL_ID = -1;
+
+struct GalleryMatch {
+    int local_id = NO_LOCAL_ID;
+
+    // euclidean distance between the query and the matched descriptor
+    float distance = 0;
+
+    bool found() const {
+        return NO_LOCAL_ID != local_id;
+    }
+};
+
+/*
+ * Stores the face descriptors of all the people known to the manager in a single aligned block of memory
+ * so that they can be compared with a face using SIMD instructions without chasing pointers.
+ *
+ * Descriptors are stored in slots. A slot keeps its position until the descriptor is removed, after which it
+ * may be reused, so slot numbers can be used by other index structures built on top of the gallery.
+ */
+class FaceGallery {
+public:
+    FaceGallery();
+
+    ~FaceGallery();
+
+    FaceGallery(const FaceGallery &) = delete;
+
+    FaceGallery &operator=(const FaceGallery &) = delete;
+
+    /*
+     * Add or replace the descriptor for a person.
+     * Returns false if the descriptor is not the expected size.
+     */
+    bool add(int local_id, const FaceDescriptor &descriptor);
+
+    // Returns false if the person was not in the gallery
+    bool remove(int local_id);
+
+    /*
+     * Use descriptors stored elsewhere, such as a memory mapped file, instead of copying them. The data must be
+     * aligned to 64 bytes, storage keeps it alive for as long as the gallery uses it. The gallery never writes to
+     * it, the descriptors are copied into memory owned by the gallery the first time a person is added or replaced.
+     * Returns false if the gallery is not empty or a local ID appears more than once.
+     */
+    bool adopt(float *data, const int32_t *local_ids, size_t count, std::shared_ptr<const void> storage);
+
+    void clear();
+
+    size_t size() const {
+        return slot_of_.size();
+    }
+
+    bool empty() const {
+        return slot_of_.empty();
+    }
+
+    /*
+     * Find the closest descriptor to the supplied one. Unlike a simple scan which stops at the first
+     * descriptor under the threshold, this always returns the best match.
+     * Only matches closer than max_distance are returned.
+     */
+    GalleryMatch findNearest(const FaceDescriptor &descriptor, float max_distance) const;
+
+    // Number of slots including any which are not currently in use
+    size_t slotCount() const {
+        return slot_ids_.size();
+    }
+
+    // Returns NO_LOCAL_ID if the slot is not in use
+    int slotId(size_t slot) const {
+        return slot_ids_[slot];
+    }
+
+    const float *slotDescriptor(size_t slot) const {
+        return data_ + slot * FACE_DESCRIPTOR_SIZE;
+    }
+
+    // Returns false if the person is not in the gallery
+    bool findSlot(int local_id, size_t &slot) const;
+
+    // Approximate number of bytes used by the gallery
+    size_t memoryUsage() const;
+
+    // Squared euclidean distance between two descriptors using the best kernel for this CPU
+    static float squaredDistance(const float *a, const float *b);
+
+    // Name of the SIMD kernel selected for this CPU
+    static const char *kernelName();
+
+private:
+    void reserve(size_t num_slots);
+
+    void reallocate(size_t new_capacity);
+
+    // descriptors, FACE_DESCRIPTOR_SIZE floats per slot
+    float *data_ = nullptr;
+    size_t capacity_ = 0;
+
+    // set if data_ belongs to someone else and must not be freed
+    std::shared_ptr<const void> external_storage_;
+
+    // local ID for each slot, NO_LOCAL_ID if the slot is free
+    std::vector<int> slot_ids_;
+    std::vector<size_t> free_slots_;
+    std::unordered_map<int, size_t> slot_of_;
+};
+
+#endif //FACE_MANAGER_FACE_GALLERY_H
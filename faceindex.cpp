@@ -0,0 +1,343 @@
+/*
+ *  Face manager 0.1
+ *  Approximate nearest neighbour index for large face galleries
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include "faceindex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+
+// Fixed seed so that the same sequence of inserts always builds the same graph
+unsigned int const INDEX_LEVEL_SEED = 42;
+
+ApproximateFaceIndex::ApproximateFaceIndex(const FaceGallery &gallery, const ApproximateIndexParameters &params)
+        : gallery_(gallery), params_(params), level_generator_(INDEX_LEVEL_SEED) {
+    params_.max_neighbours = std::max(2, params_.max_neighbours);
+    params_.construction_ef = std::max(params_.max_neighbours, params_.construction_ef);
+    params_.search_ef = std::max(1, params_.search_ef);
+    level_multiplier_ = 1.0 / std::log((double) params_.max_neighbours);
+}
+
+void
+ApproximateFaceIndex::clear() {
+    nodes_.clear();
+    visited_.clear();
+    linked_count_ = 0;
+    entry_slot_ = 0;
+    max_level_ = -1;
+}
+
+void
+ApproximateFaceIndex::rebuild() {
+    clear();
+    for (size_t slot = 0; slot < gallery_.slotCount(); ++slot) {
+        if (NO_LOCAL_ID != gallery_.slotId(slot)) {
+            insert(slot);
+        }
+    }
+}
+
+void
+ApproximateFaceIndex::insert(size_t slot) {
+    uint32_t new_slot = (uint32_t) slot;
+    if (slot >= nodes_.size()) {
+        nodes_.resize(slot + 1);
+    }
+
+    // A reused slot has a new descriptor so take it out of the graph first, keeping its level
+    int level;
+    if (nodes_[slot].linked) {
+        level = (int) nodes_[slot].neighbours.size() - 1;
+        unlink(new_slot);
+    } else {
+        level = randomLevel();
+        ++linked_count_;
+    }
+    Node &node = nodes_[slot];
+    node.linked = true;
+    node.neighbours.assign(level + 1, std::vector<uint32_t>());
+
+    if (max_level_ < 0) {
+        entry_slot_ = new_slot;
+        max_level_ = level;
+        return;
+    }
+
+    const float *query = gallery_.slotDescriptor(slot);
+    uint32_t entry = entry_slot_;
+    if (level < max_level_) {
+        entry = greedySearch(query, entry, max_level_, level + 1);
+    }
+
+    for (int l = std::min(level, max_level_); l >= 0; --l) {
+        std::vector<Candidate> candidates = searchLevel(query, entry, params_.construction_ef, l);
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                        [new_slot](const Candidate &c) { return c.second == new_slot; }),
+                         candidates.end());
+        if (candidates.empty()) {
+            continue;
+        }
+        entry = candidates.front().second;
+
+        std::vector<uint32_t> neighbours = selectNeighbours(candidates, params_.max_neighbours);
+        nodes_[slot].neighbours[l] = neighbours;
+        for (uint32_t neighbour : neighbours) {
+            link(neighbour, new_slot, l);
+        }
+    }
+
+    if (level > max_level_) {
+        entry_slot_ = new_slot;
+        max_level_ = level;
+    }
+}
+
+GalleryMatch
+ApproximateFaceIndex::findNearest(const FaceDescriptor &descriptor, float max_distance) const {
+    GalleryMatch match;
+    if ((max_level_ < 0) || (FACE_DESCRIPTOR_SIZE != descriptor.size())) {
+        return match;
+    }
+
+    const float *query = &descriptor(0);
+    uint32_t entry = greedySearch(query, entry_slot_, max_level_, 1);
+    std::vector<Candidate> candidates = searchLevel(query, entry, params_.search_ef, 0);
+
+    // candidates are sorted nearest first, skip any that have been removed from the gallery
+    for (const Candidate &candidate : candidates) {
+        int local_id = gallery_.slotId(candidate.second);
+        if (NO_LOCAL_ID != local_id) {
+            if (candidate.first < max_distance * max_distance) {
+                match.local_id = local_id;
+                match.distance = std::sqrt(candidate.first);
+            }
+            break;
+        }
+    }
+    return match;
+}
+
+size_t
+ApproximateFaceIndex::memoryUsage() const {
+    size_t bytes = nodes_.capacity() * sizeof(Node) + visited_.capacity() * sizeof(uint32_t);
+    for (const Node &node : nodes_) {
+        bytes += node.neighbours.capacity() * sizeof(std::vector<uint32_t>);
+        for (const auto &level : node.neighbours) {
+            bytes += level.capacity() * sizeof(uint32_t);
+        }
+    }
+    return bytes;
+}
+
+float
+ApproximateFaceIndex::distance(const float *query, uint32_t slot) const {
+    return FaceGallery::squaredDistance(query, gallery_.slotDescriptor(slot));
+}
+
+// Levels follow a geometric distribution so each level has roughly 1/max_neighbours of the nodes of the one below
+int
+ApproximateFaceIndex::randomLevel() {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    double r = 1.0 - uniform(level_generator_);
+    return (int) std::floor(-std::log(r) * level_multiplier_);
+}
+
+// Walk the upper levels always moving to the closest neighbour until no neighbour is closer
+uint32_t
+ApproximateFaceIndex::greedySearch(const float *query, uint32_t entry, int from_level, int to_level) const {
+    uint32_t current = entry;
+    float current_distance = distance(query, current);
+    for (int level = from_level; level >= to_level; --level) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            const Node &node = nodes_[current];
+            if (level >= (int) node.neighbours.size()) {
+                break;
+            }
+            for (uint32_t neighbour : node.neighbours[level]) {
+                float d = distance(query, neighbour);
+                if (d < current_distance) {
+                    current_distance = d;
+                    current = neighbour;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return current;
+}
+
+// Best first search of a single level keeping the ef closest slots found, returned nearest first
+std::vector<ApproximateFaceIndex::Candidate>
+ApproximateFaceIndex::searchLevel(const float *query, uint32_t entry, int ef, int level) const {
+    if (visited_.size() < nodes_.size()) {
+        visited_.resize(nodes_.size(), 0);
+    }
+    if (0 == ++visit_epoch_) {
+        std::fill(visited_.begin(), visited_.end(), 0);
+        visit_epoch_ = 1;
+    }
+
+    // candidates still to be expanded, closest first
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> to_visit;
+    // best results so far, furthest first so it is cheap to drop the worst
+    std::priority_queue<Candidate> results;
+
+    Candidate start(distance(query, entry), entry);
+    to_visit.push(start);
+    results.push(start);
+    visited_[entry] = visit_epoch_;
+
+    while (!to_visit.empty()) {
+        Candidate current = to_visit.top();
+        if ((current.first > results.top().first) && ((int) results.size() >= ef)) {
+            break;
+        }
+        to_visit.pop();
+
+        const Node &node = nodes_[current.second];
+        if (level >= (int) node.neighbours.size()) {
+            continue;
+        }
+        for (uint32_t neighbour : node.neighbours[level]) {
+            if (visit_epoch_ == visited_[neighbour]) {
+                continue;
+            }
+            visited_[neighbour] = visit_epoch_;
+
+            float d = distance(query, neighbour);
+            if (((int) results.size() < ef) || (d < results.top().first)) {
+                to_visit.push(Candidate(d, neighbour));
+                results.push(Candidate(d, neighbour));
+                if ((int) results.size() > ef) {
+                    results.pop();
+                }
+            }
+        }
+    }
+
+    std::vector<Candidate> sorted(results.size());
+    for (size_t i = sorted.size(); i > 0; --i) {
+        sorted[i - 1] = results.top();
+        results.pop();
+    }
+    return sorted;
+}
+
+/*
+ * Prefer neighbours in different directions: a candidate is only kept if it is closer to the new slot
+ * than to any neighbour already selected. Any remaining space is filled with the closest of the rejected
+ * candidates to keep the graph well connected.
+ */
+std::vector<uint32_t>
+ApproximateFaceIndex::selectNeighbours(std::vector<Candidate> candidates, size_t max_count) const {
+    std::sort(candidates.begin(), candidates.end());
+    std::vector<uint32_t> selected;
+    std::vector<uint32_t> rejected;
+    for (const Candidate &candidate : candidates) {
+        if (selected.size() >= max_count) {
+            break;
+        }
+        const float *descriptor = gallery_.slotDescriptor(candidate.second);
+        bool keep = true;
+        for (uint32_t other : selected) {
+            if (distance(descriptor, other) < candidate.first) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep) {
+            selected.push_back(candidate.second);
+        } else {
+            rejected.push_back(candidate.second);
+        }
+    }
+    for (size_t i = 0; (i < rejected.size()) && (selected.size() < max_count); ++i) {
+        selected.push_back(rejected[i]);
+    }
+    return selected;
+}
+
+// Add a link from slot to neighbour, pruning the links of slot if it now has too many
+void
+ApproximateFaceIndex::link(uint32_t slot, uint32_t neighbour, int level) {
+    Node &node = nodes_[slot];
+    if (level >= (int) node.neighbours.size()) {
+        return;
+    }
+    std::vector<uint32_t> &links = node.neighbours[level];
+    if (std::find(links.begin(), links.end(), neighbour) != links.end()) {
+        return;
+    }
+    links.push_back(neighbour);
+
+    if (links.size() > maxNeighbours(level)) {
+        const float *descriptor = gallery_.slotDescriptor(slot);
+        std::vector<Candidate> candidates;
+        for (uint32_t other : links) {
+            candidates.push_back(Candidate(distance(descriptor, other), other));
+        }
+        links = selectNeighbours(candidates, maxNeighbours(level));
+    }
+}
+
+/*
+ * Remove all links to and from a slot before it is inserted again. Nodes that linked to it are linked to its
+ * neighbours instead so that they stay connected, and if it was the entry point the highest of the other nodes
+ * takes over. This looks at every node so is only suitable for occasional slot reuse.
+ */
+void
+ApproximateFaceIndex::unlink(uint32_t slot) {
+    std::vector<std::vector<uint32_t>> old_neighbours;
+    old_neighbours.swap(nodes_[slot].neighbours);
+
+    bool was_entry = (entry_slot_ == slot);
+    if (was_entry) {
+        max_level_ = -1;
+    }
+
+    for (uint32_t other = 0; other < (uint32_t) nodes_.size(); ++other) {
+        Node &node = nodes_[other];
+        if (!node.linked || (other == slot)) {
+            continue;
+        }
+        if (was_entry && ((int) node.neighbours.size() - 1 > max_level_)) {
+            entry_slot_ = other;
+            max_level_ = (int) node.neighbours.size() - 1;
+        }
+
+        size_t levels = std::min(node.neighbours.size(), old_neighbours.size());
+        for (size_t level = 0; level < levels; ++level) {
+            std::vector<uint32_t> &links = node.neighbours[level];
+            auto found = std::find(links.begin(), links.end(), slot);
+            if (found == links.end()) {
+                continue;
+            }
+            links.erase(found);
+            for (uint32_t neighbour : old_neighbours[level]) {
+                if ((neighbour != other) && (std::find(links.begin(), links.end(), neighbour) == links.end())) {
+                    links.push_back(neighbour);
+                }
+            }
+
+            // prune once rather than for every link added
+            if (links.size() > maxNeighbours((int) level)) {
+                const float *descriptor = gallery_.slotDescriptor(other);
+                std::vector<Candidate> candidates;
+                for (uint32_t neighbour : links) {
+                    candidates.push_back(Candidate(distance(descriptor, neighbour), neighbour));
+                }
+                links = selectNeighbours(candidates, maxNeighbours((int) level));
+            }
+        }
+    }
+}
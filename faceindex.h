@@ -0,0 +1,119 @@
+/*
+ *  Face manager 0.1
+ *  Approximate nearest neighbour index for large face galleries
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_FACE_INDEX_H
+#define FACE_MANAGER_FACE_INDEX_H
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "facegallery.h"
+
+struct ApproximateIndexParameters {
+    // Number of neighbours each descriptor is linked to, level 0 has twice this number
+    int max_neighbours = 16;
+
+    // Number of candidates considered when inserting, higher values build a better graph more slowly
+    int construction_ef = 100;
+
+    // Number of candidates considered when searching, trades recall against latency
+    int search_ef = 40;
+};
+
+/*
+ * Hierarchical navigable small world graph (Malkov & Yashunin, https://arxiv.org/abs/1603.09320)
+ * built over the slots of a FaceGallery. The descriptors themselves are not copied, the index refers
+ * to them by slot number so the gallery must outlive the index.
+ *
+ * Descriptors can be added incrementally. Removed slots remain in the graph so that it stays connected
+ * but are never returned from a search. When the gallery reuses a slot it must be inserted again, the slot
+ * keeps its level but is unlinked from the graph and linked in again at the position of its new descriptor.
+ *
+ * Searching is not thread-safe as the index keeps a scratch buffer to avoid allocating on each search.
+ */
+class ApproximateFaceIndex {
+public:
+    explicit ApproximateFaceIndex(const FaceGallery &gallery,
+                                  const ApproximateIndexParameters &params = ApproximateIndexParameters());
+
+    // Add the descriptor in a gallery slot, or re-link it if the slot has been reused
+    void insert(size_t slot);
+
+    // Rebuild the whole index from the current contents of the gallery
+    void rebuild();
+
+    void clear();
+
+    // Find the closest descriptor in the gallery, only matches closer than max_distance are returned
+    GalleryMatch findNearest(const FaceDescriptor &descriptor, float max_distance) const;
+
+    int searchEf() const {
+        return params_.search_ef;
+    }
+
+    void searchEf(int ef) {
+        params_.search_ef = std::max(1, ef);
+    }
+
+    // Number of slots linked into the graph, including any that have since been removed from the gallery
+    size_t size() const {
+        return linked_count_;
+    }
+
+    size_t memoryUsage() const;
+
+private:
+    struct Node {
+        bool linked = false;
+
+        // neighbours on each level, from level 0 upwards
+        std::vector<std::vector<uint32_t>> neighbours;
+    };
+
+    // a slot and its squared distance from the query
+    typedef std::pair<float, uint32_t> Candidate;
+
+    float distance(const float *query, uint32_t slot) const;
+
+    int randomLevel();
+
+    uint32_t greedySearch(const float *query, uint32_t entry, int from_level, int to_level) const;
+
+    std::vector<Candidate> searchLevel(const float *query, uint32_t entry, int ef, int level) const;
+
+    std::vector<uint32_t> selectNeighbours(std::vector<Candidate> candidates, size_t max_count) const;
+
+    void link(uint32_t slot, uint32_t neighbour, int level);
+
+    void unlink(uint32_t slot);
+
+    size_t maxNeighbours(int level) const {
+        return (0 == level) ? 2 * params_.max_neighbours : params_.max_neighbours;
+    }
+
+    const FaceGallery &gallery_;
+    ApproximateIndexParameters params_;
+
+    std::vector<Node> nodes_;
+    size_t linked_count_ = 0;
+    uint32_t entry_slot_ = 0;
+    int max_level_ = -1;
+
+    double level_multiplier_;
+    std::mt19937 level_generator_;
+
+    // scratch space for searches, a slot has been visited if its entry equals the current epoch
+    mutable std::vector<uint32_t> visited_;
+    mutable uint32_t visit_epoch_ = 0;
+};
+
+#endif //FACE_MANAGER_FACE_INDEX_H
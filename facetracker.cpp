@@ -0,0 +1,126 @@
+/*
+ *  Face manager 0.1
+ *  Common interface to the object trackers used to follow faces between detections
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include "facetracker.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <opencv2/tracking.hpp>
+#include <dlib/image_processing.h>
+#include <dlib/opencv.h>
+
+// Fraction of the tracked box that must stay inside the frame for an OpenCV tracker to be trusted
+double const TRACKER_MIN_VISIBLE_FRACTION = 0.5;
+
+class CorrelationFaceTracker : public FaceTracker {
+public:
+    // the tracker works on grey images so frames may be BGR or luma
+    void start(const cv::Mat &frame, const dlib::rectangle &bounds) override {
+        if (1 == frame.channels()) {
+            tracker_.start_track(dlib::cv_image<unsigned char>(frame), bounds);
+        } else {
+            tracker_.start_track(dlib::cv_image<dlib::bgr_pixel>(frame), bounds);
+        }
+    }
+
+    // the peak to sidelobe ratio is used as is
+    double update(const cv::Mat &frame) override {
+        if (1 == frame.channels()) {
+            return tracker_.update(dlib::cv_image<unsigned char>(frame));
+        }
+        return tracker_.update(dlib::cv_image<dlib::bgr_pixel>(frame));
+    }
+
+    dlib::rectangle position() const override {
+        return tracker_.get_position();
+    }
+
+private:
+    dlib::correlation_tracker tracker_;
+};
+
+/*
+ * The OpenCV trackers only report whether they think they are still tracking the object so treat
+ * success as high confidence. MedianFlow in particular can report success after the box has drifted
+ * off the edge of the frame so that is treated as lost.
+ */
+class OpenCVFaceTracker : public FaceTracker {
+public:
+    OpenCVFaceTracker(cv::Ptr<cv::Tracker> tracker) : tracker_(tracker) {
+    }
+
+    void start(const cv::Mat &frame, const dlib::rectangle &bounds) override {
+        bounds_ = dlibRectangleToOpenCV(bounds);
+        tracker_->init(frame, bounds_);
+    }
+
+    double update(const cv::Mat &frame) override {
+        if (!tracker_->update(frame, bounds_) || (bounds_.area() <= 0)) {
+            return TRACKER_LOST_CONFIDENCE;
+        }
+        cv::Rect2d visible = bounds_ & cv::Rect2d(0, 0, frame.cols, frame.rows);
+        if (visible.area() < TRACKER_MIN_VISIBLE_FRACTION * bounds_.area()) {
+            return TRACKER_LOST_CONFIDENCE;
+        }
+        return TRACKER_FOUND_CONFIDENCE;
+    }
+
+    dlib::rectangle position() const override {
+        return openCVRectToDlib(cv::Rect(bounds_));
+    }
+
+private:
+    cv::Ptr<cv::Tracker> tracker_;
+    cv::Rect2d bounds_;
+};
+
+std::unique_ptr<FaceTracker> faceTrackerFactory(TrackerType type) {
+    switch (type) {
+        case TRACKER_KCF:
+            return std::unique_ptr<FaceTracker>(new OpenCVFaceTracker(cv::TrackerKCF::create()));
+
+        case TRACKER_MEDIANFLOW:
+            return std::unique_ptr<FaceTracker>(new OpenCVFaceTracker(cv::TrackerMedianFlow::create()));
+
+        case TRACKER_CORRELATION:
+        default:
+            return std::unique_ptr<FaceTracker>(new CorrelationFaceTracker());
+    }
+}
+
+TrackerType trackerTypeFromString(std::string type_name) {
+    std::transform(type_name.begin(), type_name.end(), type_name.begin(), ::toupper);
+    if (type_name == "CORRELATION") {
+        return TRACKER_CORRELATION;
+    } else if (type_name == "KCF") {
+        return TRACKER_KCF;
+    } else if (type_name == "MEDIANFLOW") {
+        return TRACKER_MEDIANFLOW;
+    } else {
+        std::cerr << "invalid tracker type: '" << type_name << "'" << std::endl;
+        std::exit(1);
+    }
+}
+
+std::string trackerTypeToString(TrackerType type) {
+    switch (type) {
+        case TRACKER_CORRELATION:
+            return "CORRELATION";
+        case TRACKER_KCF:
+            return "KCF";
+        case TRACKER_MEDIANFLOW:
+            return "MEDIANFLOW";
+        default:
+            return "";
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ *  Face manager 0.1
+ *  Common interface to the object trackers used to follow faces between detections
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_FACE_TRACKER_H
+#define FACE_MANAGER_FACE_TRACKER_H
+
+#include <memory>
+#include <string>
+#include <opencv2/core.hpp>
+#include <dlib/geometry.h>
+
+enum TrackerType {
+    TRACKER_CORRELATION, // dlib correlation tracker
+    TRACKER_KCF,         // OpenCV kernelized correlation filters
+    TRACKER_MEDIANFLOW   // OpenCV median flow
+};
+
+/*
+ * Confidence is on the scale of the peak to sidelobe ratio returned by the dlib correlation tracker
+ * where values of around 7 or more mean the face is still being tracked. Trackers which only report
+ * success or failure return one of these values.
+ */
+double const TRACKER_FOUND_CONFIDENCE = 20;
+double const TRACKER_LOST_CONFIDENCE = 0;
+
+/*
+ * Follows a single face from frame to frame. Different trackers may be updated concurrently but a
+ * single tracker must only be used from one thread at a time. Frames may be BGR or 8 bit grey but must
+ * be the same type for the life of the tracker.
+ */
+class FaceTracker {
+public:
+    virtual ~FaceTracker() {
+    }
+
+    virtual void start(const cv::Mat &frame, const dlib::rectangle &bounds) = 0;
+
+    // Find the face in a new frame and return the confidence that it is still being tracked
+    virtual double update(const cv::Mat &frame) = 0;
+
+    virtual dlib::rectangle position() const = 0;
+};
+
+std::unique_ptr<FaceTracker> faceTrackerFactory(TrackerType type);
+
+TrackerType trackerTypeFromString(std::string type_name);
+
+std::string trackerTypeToString(TrackerType type);
+
+#endif //FACE_MANAGER_FACE_TRACKER_H
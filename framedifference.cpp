@@ -0,0 +1,369 @@
+/*
+ *  Face manager 0.1
+ *  Single pass frame difference kernel used for motion detection
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include "framedifference.h"
+#include "cpufeatures.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifdef FACE_MANAGER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef FACE_MANAGER_NEON_SIMD
+#include <arm_neon.h>
+#endif
+
+int const GREY_ROUND = 1 << (GREY_SHIFT - 1);
+
+/*
+ * Kernels that process one row, one version for each instruction set.
+ *
+ * The threshold kernel writes 255 to mask for each pixel where (|prev - next| & |next - current|) > threshold.
+ * The erode kernel ANDs each mask pixel with the one to its left and the two above, mask[-1] and above[-1]
+ * must be 255 so that the first pixel only depends on the pixels inside the frame as it does for cv::erode.
+ * It returns the number of pixels still set and writes them to eroded if it is not null.
+ */
+typedef void (*GreyRowKernel)(const uint8_t *bgr, uint8_t *grey, int width);
+
+typedef void (*ThresholdRowKernel)(const uint8_t *prev, const uint8_t *current, const uint8_t *next,
+                                   uint8_t threshold, uint8_t *mask, int width);
+
+typedef long (*ErodeRowKernel)(const uint8_t *mask, const uint8_t *above, uint8_t *eroded, int width);
+
+static inline uint8_t
+greyPixel(const uint8_t *bgr) {
+    return (uint8_t) ((bgr[0] * GREY_BLUE + bgr[1] * GREY_GREEN + bgr[2] * GREY_RED + GREY_ROUND) >> GREY_SHIFT);
+}
+
+static void
+greyRowScalar(const uint8_t *bgr, uint8_t *grey, int width) {
+    for (int x = 0; x < width; ++x) {
+        grey[x] = greyPixel(bgr + 3 * x);
+    }
+}
+
+static inline uint8_t
+absDiff(uint8_t a, uint8_t b) {
+    return (a > b) ? a - b : b - a;
+}
+
+static void
+thresholdRowScalar(const uint8_t *prev, const uint8_t *current, const uint8_t *next, uint8_t threshold,
+                   uint8_t *mask, int width) {
+    for (int x = 0; x < width; ++x) {
+        uint8_t motion = absDiff(prev[x], next[x]) & absDiff(next[x], current[x]);
+        mask[x] = (motion > threshold) ? 255 : 0;
+    }
+}
+
+static long
+erodeRowScalar(const uint8_t *mask, const uint8_t *above, uint8_t *eroded, int width) {
+    long count = 0;
+    for (int x = 0; x < width; ++x) {
+        uint8_t value = mask[x] & mask[x - 1] & above[x] & above[x - 1];
+        count += value & 1;
+        if (eroded) {
+            eroded[x] = value;
+        }
+    }
+    return count;
+}
+
+#ifdef FACE_MANAGER_X86_SIMD
+
+// Add the two 64 bit counts, stored rather than moved to a register so that it works on 32 bit x86 too
+__attribute__((target("sse2")))
+static inline long
+sumLanes(__m128i counts) {
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, counts);
+    return (long) (lanes[0] + lanes[1]);
+}
+
+__attribute__((target("sse2")))
+static void
+thresholdRowSse2(const uint8_t *prev, const uint8_t *current, const uint8_t *next, uint8_t threshold,
+                 uint8_t *mask, int width) {
+    // motion > threshold is the same as max(motion, threshold + 1) == motion
+    const __m128i limit = _mm_set1_epi8((char) (threshold + 1));
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i p = _mm_loadu_si128((const __m128i *) (prev + x));
+        __m128i c = _mm_loadu_si128((const __m128i *) (current + x));
+        __m128i n = _mm_loadu_si128((const __m128i *) (next + x));
+        __m128i diff1 = _mm_or_si128(_mm_subs_epu8(p, n), _mm_subs_epu8(n, p));
+        __m128i diff2 = _mm_or_si128(_mm_subs_epu8(n, c), _mm_subs_epu8(c, n));
+        __m128i motion = _mm_and_si128(diff1, diff2);
+        _mm_storeu_si128((__m128i *) (mask + x), _mm_cmpeq_epi8(_mm_max_epu8(motion, limit), motion));
+    }
+    thresholdRowScalar(prev + x, current + x, next + x, threshold, mask + x, width - x);
+}
+
+__attribute__((target("sse2")))
+static long
+erodeRowSse2(const uint8_t *mask, const uint8_t *above, uint8_t *eroded, int width) {
+    const __m128i ones = _mm_set1_epi8(1);
+    __m128i counts = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i value = _mm_and_si128(
+                _mm_and_si128(_mm_loadu_si128((const __m128i *) (mask + x)),
+                              _mm_loadu_si128((const __m128i *) (mask + x - 1))),
+                _mm_and_si128(_mm_loadu_si128((const __m128i *) (above + x)),
+                              _mm_loadu_si128((const __m128i *) (above + x - 1))));
+        counts = _mm_add_epi64(counts, _mm_sad_epu8(_mm_and_si128(value, ones), _mm_setzero_si128()));
+        if (eroded) {
+            _mm_storeu_si128((__m128i *) (eroded + x), value);
+        }
+    }
+    return sumLanes(counts) + erodeRowScalar(mask + x, above + x, eroded ? eroded + x : nullptr, width - x);
+}
+
+/*
+ * SSSE3 byte shuffles (always available with AVX2) split 16 BGR pixels into separate channels, then pairs of
+ * channels are multiplied and added as 16 bit values to give the same 32 bit sums as the scalar code.
+ */
+__attribute__((target("avx2")))
+static inline __m128i
+greyFromChannels(__m128i b, __m128i g, __m128i r) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bg_coefficients = _mm_set1_epi32((GREY_GREEN << 16) | GREY_BLUE);
+    const __m128i r_coefficients = _mm_set1_epi32((GREY_ROUND << 16) | GREY_RED);
+    const __m128i one = _mm_set1_epi16(1);
+
+    __m128i b16[2] = {_mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero)};
+    __m128i g16[2] = {_mm_unpacklo_epi8(g, zero), _mm_unpackhi_epi8(g, zero)};
+    __m128i r16[2] = {_mm_unpacklo_epi8(r, zero), _mm_unpackhi_epi8(r, zero)};
+    __m128i grey16[2];
+    for (int half = 0; half < 2; ++half) {
+        __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(b16[half], g16[half]), bg_coefficients),
+                                   _mm_madd_epi16(_mm_unpacklo_epi16(r16[half], one), r_coefficients));
+        __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(b16[half], g16[half]), bg_coefficients),
+                                   _mm_madd_epi16(_mm_unpackhi_epi16(r16[half], one), r_coefficients));
+        grey16[half] = _mm_packs_epi32(_mm_srli_epi32(lo, GREY_SHIFT), _mm_srli_epi32(hi, GREY_SHIFT));
+    }
+    return _mm_packus_epi16(grey16[0], grey16[1]);
+}
+
+__attribute__((target("avx2")))
+static void
+greyRowAvx2(const uint8_t *bgr, uint8_t *grey, int width) {
+    // positions of each channel in three consecutive 16 byte blocks, -1 gives 0
+    const __m128i b0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i r0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t *pixels = bgr + 3 * x;
+        __m128i v0 = _mm_loadu_si128((const __m128i *) pixels);
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (pixels + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *) (pixels + 32));
+        __m128i b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, b0), _mm_shuffle_epi8(v1, b1)),
+                                 _mm_shuffle_epi8(v2, b2));
+        __m128i g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, g0), _mm_shuffle_epi8(v1, g1)),
+                                 _mm_shuffle_epi8(v2, g2));
+        __m128i r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, r0), _mm_shuffle_epi8(v1, r1)),
+                                 _mm_shuffle_epi8(v2, r2));
+        _mm_storeu_si128((__m128i *) (grey + x), greyFromChannels(b, g, r));
+    }
+    greyRowScalar(bgr + 3 * x, grey + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void
+thresholdRowAvx2(const uint8_t *prev, const uint8_t *current, const uint8_t *next, uint8_t threshold,
+                 uint8_t *mask, int width) {
+    const __m256i limit = _mm256_set1_epi8((char) (threshold + 1));
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i p = _mm256_loadu_si256((const __m256i *) (prev + x));
+        __m256i c = _mm256_loadu_si256((const __m256i *) (current + x));
+        __m256i n = _mm256_loadu_si256((const __m256i *) (next + x));
+        __m256i diff1 = _mm256_or_si256(_mm256_subs_epu8(p, n), _mm256_subs_epu8(n, p));
+        __m256i diff2 = _mm256_or_si256(_mm256_subs_epu8(n, c), _mm256_subs_epu8(c, n));
+        __m256i motion = _mm256_and_si256(diff1, diff2);
+        _mm256_storeu_si256((__m256i *) (mask + x), _mm256_cmpeq_epi8(_mm256_max_epu8(motion, limit), motion));
+    }
+    thresholdRowScalar(prev + x, current + x, next + x, threshold, mask + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static long
+erodeRowAvx2(const uint8_t *mask, const uint8_t *above, uint8_t *eroded, int width) {
+    const __m256i ones = _mm256_set1_epi8(1);
+    __m256i counts = _mm256_setzero_si256();
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i value = _mm256_and_si256(
+                _mm256_and_si256(_mm256_loadu_si256((const __m256i *) (mask + x)),
+                                 _mm256_loadu_si256((const __m256i *) (mask + x - 1))),
+                _mm256_and_si256(_mm256_loadu_si256((const __m256i *) (above + x)),
+                                 _mm256_loadu_si256((const __m256i *) (above + x - 1))));
+        counts = _mm256_add_epi64(counts, _mm256_sad_epu8(_mm256_and_si256(value, ones), _mm256_setzero_si256()));
+        if (eroded) {
+            _mm256_storeu_si256((__m256i *) (eroded + x), value);
+        }
+    }
+    return sumLanes(_mm_add_epi64(_mm256_castsi256_si128(counts), _mm256_extracti128_si256(counts, 1))) +
+           erodeRowScalar(mask + x, above + x, eroded ? eroded + x : nullptr, width - x);
+}
+
+#endif // FACE_MANAGER_X86_SIMD
+
+#ifdef FACE_MANAGER_NEON_SIMD
+
+static void
+greyRowNeon(const uint8_t *bgr, uint8_t *grey, int width) {
+    const uint16x4_t blue = vdup_n_u16(GREY_BLUE);
+    const uint16x4_t green = vdup_n_u16(GREY_GREEN);
+    const uint16x4_t red = vdup_n_u16(GREY_RED);
+    const uint32x4_t round = vdupq_n_u32(GREY_ROUND);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        uint8x8x3_t pixels = vld3_u8(bgr + 3 * x);
+        uint16x8_t b = vmovl_u8(pixels.val[0]);
+        uint16x8_t g = vmovl_u8(pixels.val[1]);
+        uint16x8_t r = vmovl_u8(pixels.val[2]);
+        uint32x4_t lo = vmlal_u16(vmlal_u16(vmlal_u16(round, vget_low_u16(b), blue), vget_low_u16(g), green),
+                                  vget_low_u16(r), red);
+        uint32x4_t hi = vmlal_u16(vmlal_u16(vmlal_u16(round, vget_high_u16(b), blue), vget_high_u16(g), green),
+                                  vget_high_u16(r), red);
+        uint16x8_t grey16 = vcombine_u16(vshrn_n_u32(lo, GREY_SHIFT), vshrn_n_u32(hi, GREY_SHIFT));
+        vst1_u8(grey + x, vmovn_u16(grey16));
+    }
+    greyRowScalar(bgr + 3 * x, grey + x, width - x);
+}
+
+static void
+thresholdRowNeon(const uint8_t *prev, const uint8_t *current, const uint8_t *next, uint8_t threshold,
+                 uint8_t *mask, int width) {
+    const uint8x16_t limit = vdupq_n_u8(threshold);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t p = vld1q_u8(prev + x);
+        uint8x16_t c = vld1q_u8(current + x);
+        uint8x16_t n = vld1q_u8(next + x);
+        uint8x16_t motion = vandq_u8(vabdq_u8(p, n), vabdq_u8(n, c));
+        vst1q_u8(mask + x, vcgtq_u8(motion, limit));
+    }
+    thresholdRowScalar(prev + x, current + x, next + x, threshold, mask + x, width - x);
+}
+
+static long
+erodeRowNeon(const uint8_t *mask, const uint8_t *above, uint8_t *eroded, int width) {
+    const uint8x16_t ones = vdupq_n_u8(1);
+    uint32x4_t counts = vdupq_n_u32(0);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t value = vandq_u8(vandq_u8(vld1q_u8(mask + x), vld1q_u8(mask + x - 1)),
+                                    vandq_u8(vld1q_u8(above + x), vld1q_u8(above + x - 1)));
+        counts = vpadalq_u16(counts, vpaddlq_u8(vandq_u8(value, ones)));
+        if (eroded) {
+            vst1q_u8(eroded + x, value);
+        }
+    }
+    uint64x2_t sum = vpaddlq_u32(counts);
+    long count = (long) (vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+    return count + erodeRowScalar(mask + x, above + x, eroded ? eroded + x : nullptr, width - x);
+}
+
+#endif // FACE_MANAGER_NEON_SIMD
+
+struct FrameDifferenceKernels {
+    const char *name;
+    GreyRowKernel grey;
+    ThresholdRowKernel threshold;
+    ErodeRowKernel erode;
+};
+
+// Choose the kernels once, the first time they are needed. SSE2 has no byte shuffle so uses the scalar greyscale.
+static const FrameDifferenceKernels &
+frameDifferenceKernels() {
+    static const FrameDifferenceKernels kernels = []() {
+#ifdef FACE_MANAGER_X86_SIMD
+        if (cpuHasAvx2()) {
+            return FrameDifferenceKernels{"AVX2", greyRowAvx2, thresholdRowAvx2, erodeRowAvx2};
+        }
+        if (cpuHasSse2()) {
+            return FrameDifferenceKernels{"SSE2", greyRowScalar, thresholdRowSse2, erodeRowSse2};
+        }
+#endif
+#ifdef FACE_MANAGER_NEON_SIMD
+        return FrameDifferenceKernels{"NEON", greyRowNeon, thresholdRowNeon, erodeRowNeon};
+#endif
+        return FrameDifferenceKernels{"scalar", greyRowScalar, thresholdRowScalar, erodeRowScalar};
+    }();
+    return kernels;
+}
+
+void
+fusedGreyscale(const uint8_t *bgr, size_t bgr_step, uint8_t *grey, size_t grey_step, int width, int height) {
+    GreyRowKernel grey_row = frameDifferenceKernels().grey;
+    for (int y = 0; y < height; ++y) {
+        grey_row(bgr + y * bgr_step, grey + y * grey_step, width);
+    }
+}
+
+const char *
+FusedFrameDifference::kernelName() {
+    return frameDifferenceKernels().name;
+}
+
+void
+FusedFrameDifference::resize(int width) {
+    width_ = width;
+
+    // each row has a 255 in front of it to stand in for the pixel to the left of the frame
+    rows_.assign(2 * (width + 1), 255);
+}
+
+long
+FusedFrameDifference::apply(const uint8_t *frame, size_t frame_step, int channels, const uint8_t *prev,
+                            const uint8_t *current, uint8_t *next, size_t grey_step, uint8_t *eroded,
+                            size_t eroded_step, int width, int height, uint8_t threshold) {
+    if (width > width_) {
+        resize(width);
+    }
+    const FrameDifferenceKernels &kernels = frameDifferenceKernels();
+
+    // laid out for the allocated width so narrower tiles don't overwrite the sentinel in front of the second row
+    size_t row_size = width_ + 1;
+    uint8_t *mask = &rows_[1];
+    uint8_t *above = &rows_[row_size + 1];
+
+    // the row above the first row is all 255 so it does not affect the erosion
+    std::fill(above, above + width, 255);
+
+    long count = 0;
+    for (int y = 0; y < height; ++y) {
+        size_t offset = y * grey_step;
+        if (1 == channels) {
+            std::memcpy(next + offset, frame + y * frame_step, width);
+        } else {
+            kernels.grey(frame + y * frame_step, next + offset, width);
+        }
+        kernels.threshold(prev + offset, current + offset, next + offset, threshold, mask, width);
+        count += kernels.erode(mask, above, eroded ? eroded + y * eroded_step : nullptr, width);
+
+        // this row's mask is the row above the next one
+        std::swap(mask, above);
+    }
+    return count;
+}
@@ -0,0 +1,66 @@
+/*
+ *  Face manager 0.1
+ *  Single pass frame difference kernel used for motion detection
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_FRAME_DIFFERENCE_H
+#define FACE_MANAGER_FRAME_DIFFERENCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Fixed point greyscale coefficients used by cv::cvtColor(COLOR_BGR2GRAY) for 8 bit images,
+ * grey = (B * 1868 + G * 9617 + R * 4899 + 8192) >> 14
+ */
+int const GREY_SHIFT = 14;
+int const GREY_BLUE = 1868;
+int const GREY_GREEN = 9617;
+int const GREY_RED = 4899;
+
+// Convert BGR pixels to grey with the same result as cv::cvtColor
+void fusedGreyscale(const uint8_t *bgr, size_t bgr_step, uint8_t *grey, size_t grey_step, int width, int height);
+
+/*
+ * Does the work of FrameDifferenceMotionDetector without blurring in one pass over the frame. Each row of the new
+ * frame is converted to grey, differenced against the same row of the two previous grey frames, the differences
+ * ANDed and thresholded, and the result eroded with a 2x2 rectangle using the thresholded row above. The row
+ * buffers stay in cache so the frame is only read once and the grey image written once, rather than the
+ * separate passes made by cvtColor, absdiff, bitwise_and, threshold, erode and sum.
+ *
+ * The grey image and the changed pixel count are the same as the separate OpenCV operations give.
+ */
+class FusedFrameDifference {
+public:
+    // Size the row buffers for frames up to the given width so that apply() does not need to allocate them
+    void resize(int width);
+
+    /*
+     * frame is the new frame, 3 channel BGR or already grey if channels is 1, prev and current the grey versions
+     * of the two previous frames and next receives the grey version of the new frame. Pixels change if the AND
+     * of their differences from the previous frames is greater than threshold. eroded receives the eroded mask
+     * (0 or 255) and may be null if it is not needed. Returns the number of changed pixels after erosion. The
+     * pointers may be to a rectangle within larger images, in which case the edges of the rectangle are treated
+     * as the edges of the frame.
+     */
+    long apply(const uint8_t *frame, size_t frame_step, int channels, const uint8_t *prev, const uint8_t *current,
+               uint8_t *next, size_t grey_step, uint8_t *eroded, size_t eroded_step, int width, int height,
+               uint8_t threshold);
+
+    // Name of the instruction set used by the kernel
+    static const char *kernelName();
+
+private:
+    int width_ = 0;
+
+    // thresholded masks for the current and previous rows
+    std::vector<uint8_t> rows_;
+};
+
+#endif //FACE_MANAGER_FRAME_DIFFERENCE_H
@@ -0,0 +1,83 @@
+/*
+ *  Face manager 0.1
+ *  Build a gallery file from a list of people and face images so the manager can start without analysing them
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "imagelogger.h"
+#include "facedetector.h"
+#include "manager.h"
+
+void usage() {
+    std::cout << "Computes face descriptors for a list of people and writes them to a gallery file" << std::endl;
+    std::cout << "Usage: <output filename> [--chips] [--dir image-directory] [[name face-image-filename]+]"
+              << std::endl;
+    std::cout << "--chips also stores the face image of each person in the gallery file" << std::endl;
+    std::cout << "--dir adds every image in a directory using the file name as the person's name" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    logger.setFrame(0);
+    logger.enable(true);
+
+    std::string output_filename = argv[1];
+    int first_person = 2;
+    bool include_chips = false;
+    if ((argc > first_person) && (0 == strcmp("--chips", argv[first_person]))) {
+        include_chips = true;
+        ++first_person;
+    }
+    std::string directory;
+    if ((argc > first_person + 1) && (0 == strcmp("--dir", argv[first_person]))) {
+        directory = argv[first_person + 1];
+        first_person += 2;
+    }
+    if (0 != (argc - first_person) % 2) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    FaceDetector faceDetector("models");
+    Manager manager(faceDetector);
+    manager.workerThreads(std::thread::hardware_concurrency());
+
+    EnrolmentStats enrolment;
+    if (!directory.empty()) {
+        std::cout << "Directory: " << directory << std::endl;
+        enrolment = manager.addPeople(directory);
+    }
+
+    std::vector<std::pair<std::string, std::string>> people;
+    for (int f = first_person; f < argc; f += 2) {
+        std::string name = argv[f];
+        std::string face_filename = argv[f + 1];
+        std::cout << "Name: " << name << ", face: " << face_filename << std::endl;
+        people.push_back(std::make_pair(name, face_filename));
+    }
+    EnrolmentStats listed = manager.addPeople(people);
+    enrolment.image_count_ += listed.image_count_;
+    enrolment.failed_count_ += listed.failed_count_;
+    enrolment.new_person_count_ += listed.new_person_count_;
+    enrolment.seconds_ += listed.seconds_;
+
+    if (!manager.saveGallery(output_filename, include_chips)) {
+        std::cout << "Could not write " << output_filename << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Wrote " << manager.knownCount() << " people to " << output_filename
+              << ", " << enrolment.failed_count_ << " could not be added, "
+              << enrolment.imagesPerSecond() << " images per second" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,266 @@
+/*
+ *  Face manager 0.1
+ *  Binary file of known people that can be memory mapped so that no faces need to be analysed at startup
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include "galleryfile.h"
+#include "facegallery.h"
+#include "imagelogger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <dlib/image_transforms.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+char const GALLERY_FILE_MAGIC[8] = {'F', 'M', 'G', 'A', 'L', 'L', 'R', 'Y'};
+uint32_t const GALLERY_FILE_VERSION = 1;
+
+// Descriptors are aligned the same as in FaceGallery so that they can be searched in place
+uint64_t const GALLERY_FILE_ALIGNMENT = 64;
+
+static uint64_t
+alignOffset(uint64_t offset) {
+    return (offset + GALLERY_FILE_ALIGNMENT - 1) & ~(GALLERY_FILE_ALIGNMENT - 1);
+}
+
+static bool
+sectionFits(uint64_t offset, uint64_t size, uint64_t file_size) {
+    return (offset <= file_size) && (size <= file_size - offset);
+}
+
+// Write padding so that the next section starts at offset
+static void
+padTo(std::ofstream &out, uint64_t offset) {
+    static const char zeros[GALLERY_FILE_ALIGNMENT] = {0};
+    uint64_t position = (uint64_t) out.tellp();
+    if (offset > position) {
+        out.write(zeros, offset - position);
+    }
+}
+
+GalleryFile::~GalleryFile() {
+    if (mapping_) {
+        munmap(mapping_, mapping_size_);
+    }
+}
+
+std::shared_ptr<GalleryFile>
+GalleryFile::open(const std::string &filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        logger.error("Unable to open gallery file " + filename);
+        return nullptr;
+    }
+
+    struct stat file_stat;
+    if ((0 != fstat(fd, &file_stat)) || (file_stat.st_size < (off_t) sizeof(GalleryFileHeader))) {
+        logger.error("Gallery file " + filename + " is too small");
+        close(fd);
+        return nullptr;
+    }
+
+    // Private mapping so the descriptors can be modified by this process without changing the file
+    size_t size = (size_t) file_stat.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == mapping) {
+        logger.error("Unable to map gallery file " + filename);
+        return nullptr;
+    }
+
+    std::shared_ptr<GalleryFile> file(new GalleryFile());
+    file->mapping_ = mapping;
+    file->mapping_size_ = size;
+    if (!file->validate(filename)) {
+        return nullptr;
+    }
+    return file;
+}
+
+// Check the header and that all the sections are inside the file before using any of them
+bool
+GalleryFile::validate(const std::string &filename) {
+    header_ = static_cast<const GalleryFileHeader *>(mapping_);
+    const uint8_t *base = static_cast<const uint8_t *>(mapping_);
+    uint64_t file_size = mapping_size_;
+
+    if (0 != std::memcmp(header_->magic, GALLERY_FILE_MAGIC, sizeof(GALLERY_FILE_MAGIC))) {
+        logger.error(filename + " is not a gallery file");
+        return false;
+    }
+    if (GALLERY_FILE_VERSION != header_->version) {
+        logger.error("Gallery file " + filename + " has unsupported version " + std::to_string(header_->version));
+        return false;
+    }
+    if ((FACE_DESCRIPTOR_SIZE != header_->descriptor_size) || (file_size != header_->file_size)) {
+        logger.error("Gallery file " + filename + " is corrupt or was written for a different face descriptor");
+        return false;
+    }
+
+    uint64_t count = header_->count;
+    uint64_t chip_bytes = (uint64_t) GALLERY_FILE_CHIP_SIZE * GALLERY_FILE_CHIP_SIZE * 3;
+    bool valid = (count < file_size) &&
+                 (0 == header_->descriptor_offset % GALLERY_FILE_ALIGNMENT) &&
+                 sectionFits(header_->descriptor_offset, count * FACE_DESCRIPTOR_SIZE * sizeof(float), file_size) &&
+                 (0 == header_->local_id_offset % sizeof(int32_t)) &&
+                 sectionFits(header_->local_id_offset, count * sizeof(int32_t), file_size) &&
+                 (0 == header_->name_offset % sizeof(uint64_t)) &&
+                 sectionFits(header_->name_offset, (count + 1) * sizeof(uint64_t), file_size) &&
+                 sectionFits(header_->names_offset, header_->names_size, file_size) &&
+                 ((0 == header_->chip_offset) ||
+                  ((GALLERY_FILE_CHIP_SIZE == header_->chip_size) &&
+                   sectionFits(header_->chip_offset, count * chip_bytes, file_size)));
+    if (!valid) {
+        logger.error("Gallery file " + filename + " is corrupt");
+        return false;
+    }
+
+    descriptors_ = reinterpret_cast<float *>(static_cast<uint8_t *>(mapping_) + header_->descriptor_offset);
+    local_ids_ = reinterpret_cast<const int32_t *>(base + header_->local_id_offset);
+    name_offsets_ = reinterpret_cast<const uint64_t *>(base + header_->name_offset);
+    names_ = reinterpret_cast<const char *>(base + header_->names_offset);
+    chips_ = (0 != header_->chip_offset) ? base + header_->chip_offset : nullptr;
+
+    for (uint64_t i = 0; i < count; ++i) {
+        if ((name_offsets_[i] > name_offsets_[i + 1]) || (name_offsets_[i + 1] > header_->names_size)) {
+            logger.error("Gallery file " + filename + " has a corrupt external ID for entry " + std::to_string(i));
+            return false;
+        }
+    }
+    return true;
+}
+
+const float *
+GalleryFile::descriptor(size_t i) const {
+    return descriptors_ + i * FACE_DESCRIPTOR_SIZE;
+}
+
+std::string
+GalleryFile::externalId(size_t i) const {
+    return std::string(names_ + name_offsets_[i], name_offsets_[i + 1] - name_offsets_[i]);
+}
+
+bool
+GalleryFile::chip(size_t i, dlib::array2d<dlib::rgb_pixel> &image) const {
+    if (!chips_) {
+        return false;
+    }
+    const uint8_t *pixels = chips_ + i * GALLERY_FILE_CHIP_SIZE * GALLERY_FILE_CHIP_SIZE * 3;
+    image.set_size(GALLERY_FILE_CHIP_SIZE, GALLERY_FILE_CHIP_SIZE);
+    for (long r = 0; r < image.nr(); ++r) {
+        for (long c = 0; c < image.nc(); ++c) {
+            image[r][c] = dlib::rgb_pixel(pixels[0], pixels[1], pixels[2]);
+            pixels += 3;
+        }
+    }
+    return true;
+}
+
+bool
+GalleryFile::write(const std::string &filename, const std::vector<GalleryFileEntry> &entries, bool include_chips) {
+    uint64_t count = entries.size();
+    uint64_t names_size = 0;
+    for (const auto &entry : entries) {
+        names_size += entry.external_id.size();
+    }
+
+    GalleryFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, GALLERY_FILE_MAGIC, sizeof(GALLERY_FILE_MAGIC));
+    header.version = GALLERY_FILE_VERSION;
+    header.descriptor_size = FACE_DESCRIPTOR_SIZE;
+    header.count = count;
+    header.descriptor_offset = alignOffset(sizeof(header));
+    header.local_id_offset = alignOffset(header.descriptor_offset + count * FACE_DESCRIPTOR_SIZE * sizeof(float));
+    header.name_offset = alignOffset(header.local_id_offset + count * sizeof(int32_t));
+    header.names_offset = header.name_offset + (count + 1) * sizeof(uint64_t);
+    header.names_size = names_size;
+    uint64_t end = header.names_offset + names_size;
+    if (include_chips) {
+        header.chip_offset = alignOffset(end);
+        header.chip_size = GALLERY_FILE_CHIP_SIZE;
+        end = header.chip_offset + count * GALLERY_FILE_CHIP_SIZE * GALLERY_FILE_CHIP_SIZE * 3;
+    }
+    header.file_size = end;
+
+    std::string tmp_filename = filename + ".tmp";
+    std::ofstream out(tmp_filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        logger.error("Unable to create gallery file " + tmp_filename);
+        return false;
+    }
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    padTo(out, header.descriptor_offset);
+    for (const auto &entry : entries) {
+        out.write(reinterpret_cast<const char *>(entry.descriptor), FACE_DESCRIPTOR_SIZE * sizeof(float));
+    }
+
+    padTo(out, header.local_id_offset);
+    for (const auto &entry : entries) {
+        int32_t local_id = entry.local_id;
+        out.write(reinterpret_cast<const char *>(&local_id), sizeof(local_id));
+    }
+
+    padTo(out, header.name_offset);
+    uint64_t name_offset = 0;
+    for (const auto &entry : entries) {
+        out.write(reinterpret_cast<const char *>(&name_offset), sizeof(name_offset));
+        name_offset += entry.external_id.size();
+    }
+    out.write(reinterpret_cast<const char *>(&name_offset), sizeof(name_offset));
+    for (const auto &entry : entries) {
+        out.write(entry.external_id.data(), entry.external_id.size());
+    }
+
+    if (include_chips) {
+        padTo(out, header.chip_offset);
+        std::vector<uint8_t> pixels(GALLERY_FILE_CHIP_SIZE * GALLERY_FILE_CHIP_SIZE * 3);
+        dlib::array2d<dlib::rgb_pixel> resized(GALLERY_FILE_CHIP_SIZE, GALLERY_FILE_CHIP_SIZE);
+        for (const auto &entry : entries) {
+            // people without a face image get a black one so every entry is the same size
+            std::fill(pixels.begin(), pixels.end(), 0);
+            if (entry.chip && (entry.chip->size() > 0)) {
+                const dlib::array2d<dlib::rgb_pixel> *chip = entry.chip;
+                if ((GALLERY_FILE_CHIP_SIZE != chip->nr()) || (GALLERY_FILE_CHIP_SIZE != chip->nc())) {
+                    dlib::resize_image(*chip, resized);
+                    chip = &resized;
+                }
+                uint8_t *p = pixels.data();
+                for (long r = 0; r < chip->nr(); ++r) {
+                    for (long c = 0; c < chip->nc(); ++c) {
+                        const dlib::rgb_pixel &pixel = (*chip)[r][c];
+                        *p++ = pixel.red;
+                        *p++ = pixel.green;
+                        *p++ = pixel.blue;
+                    }
+                }
+            }
+            out.write(reinterpret_cast<const char *>(pixels.data()), pixels.size());
+        }
+    }
+
+    out.close();
+    if (!out) {
+        logger.error("Error writing gallery file " + tmp_filename);
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+    if (0 != std::rename(tmp_filename.c_str(), filename.c_str())) {
+        logger.error("Unable to rename " + tmp_filename + " to " + filename);
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+    return true;
+}
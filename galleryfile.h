@@ -0,0 +1,132 @@
+/*
+ *  Face manager 0.1
+ *  Binary file of known people that can be memory mapped so that no faces need to be analysed at startup
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_GALLERY_FILE_H
+#define FACE_MANAGER_GALLERY_FILE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <dlib/array2d.h>
+#include <dlib/pixel.h>
+
+// Size of the face images stored in a gallery file, the same as the chips used to compute descriptors
+int const GALLERY_FILE_CHIP_SIZE = 150;
+
+/*
+ * Layout of a gallery file. All offsets are from the start of the file and values are stored in the
+ * native byte order so a file can only be read on a machine with the same endianness as the one that wrote it.
+ *
+ *     header
+ *     descriptors   count x FACE_DESCRIPTOR_SIZE floats, 64 byte aligned so they can be searched in place
+ *     local IDs     count x int32
+ *     name offsets  (count + 1) x uint64, external ID i is the bytes between offsets i and i + 1 of the names
+ *     names         external IDs, not null terminated
+ *     chips         optional, count x GALLERY_FILE_CHIP_SIZE x GALLERY_FILE_CHIP_SIZE RGB pixels
+ */
+struct GalleryFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t descriptor_size;
+    uint64_t count;
+    uint64_t descriptor_offset;
+    uint64_t local_id_offset;
+    uint64_t name_offset;
+    uint64_t names_offset;
+    uint64_t names_size;
+    // 0 if the file does not contain face images
+    uint64_t chip_offset;
+    uint32_t chip_size;
+    uint32_t reserved;
+    uint64_t file_size;
+};
+
+// Details of one person to be written to a gallery file
+struct GalleryFileEntry {
+    int local_id;
+    std::string external_id;
+
+    // FACE_DESCRIPTOR_SIZE values
+    const float *descriptor;
+
+    // may be null if no face image is available, resized if not GALLERY_FILE_CHIP_SIZE square
+    const dlib::array2d<dlib::rgb_pixel> *chip;
+};
+
+/*
+ * A gallery file mapped into memory. The mapping is private and writable so the descriptors can be used
+ * directly as the storage of a FaceGallery, any changes stay in this process and are not written back.
+ */
+class GalleryFile {
+public:
+    ~GalleryFile();
+
+    GalleryFile(const GalleryFile &) = delete;
+
+    GalleryFile &operator=(const GalleryFile &) = delete;
+
+    // Returns nullptr if the file can't be read or is not a valid gallery file
+    static std::shared_ptr<GalleryFile> open(const std::string &filename);
+
+    /*
+     * Write a gallery file, face images are only included if include_chips is true.
+     * The file is written under a temporary name and then renamed so that processes which have the
+     * old file mapped are not affected. Returns false on error.
+     */
+    static bool write(const std::string &filename, const std::vector<GalleryFileEntry> &entries,
+                      bool include_chips);
+
+    size_t size() const {
+        return header_->count;
+    }
+
+    // descriptors for all entries, FACE_DESCRIPTOR_SIZE values each
+    float *descriptors() const {
+        return descriptors_;
+    }
+
+    const float *descriptor(size_t i) const;
+
+    const int32_t *localIds() const {
+        return local_ids_;
+    }
+
+    int localId(size_t i) const {
+        return local_ids_[i];
+    }
+
+    std::string externalId(size_t i) const;
+
+    bool hasChips() const {
+        return nullptr != chips_;
+    }
+
+    // Returns false if the file does not contain face images
+    bool chip(size_t i, dlib::array2d<dlib::rgb_pixel> &image) const;
+
+private:
+    GalleryFile() {
+    }
+
+    bool validate(const std::string &filename);
+
+    void *mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+
+    const GalleryFileHeader *header_ = nullptr;
+    float *descriptors_ = nullptr;
+    const int32_t *local_ids_ = nullptr;
+    const uint64_t *name_offsets_ = nullptr;
+    const char *names_ = nullptr;
+    const uint8_t *chips_ = nullptr;
+};
+
+#endif //FACE_MANAGER_GALLERY_FILE_H
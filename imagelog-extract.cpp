@@ -0,0 +1,102 @@
+/*
+ *  Face manager 0.1
+ *  List the images in an image log file or write them out as PNGs
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <sys/stat.h>
+
+#include "imagelogfile.h"
+#include "mkpath.h"
+
+void usage() {
+    std::cout << "Lists the images in an image log file or writes them to PNG files" << std::endl;
+    std::cout << "Usage: <image log file> [--list | output-directory] [--frames first last] [step]*" << std::endl;
+    std::cout << "--list prints the frame, sequence number, step and size of each image instead of writing them"
+              << std::endl;
+    std::cout << "--frames only uses images from frames first to last inclusive" << std::endl;
+    std::cout << "Images are only used if their step contains one of the steps given, or all images if none are"
+              << std::endl;
+}
+
+bool stepSelected(const std::string &step, const std::vector<std::string> &steps) {
+    if (steps.empty()) {
+        return true;
+    }
+    for (const auto &selected : steps) {
+        if (std::string::npos != step.find(selected)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    std::string log_filename = argv[1];
+    bool list_only = (0 == strcmp("--list", argv[2]));
+    std::string directory = list_only ? "" : argv[2];
+    int next_arg = 3;
+    int first_frame = 0;
+    int last_frame = INT_MAX;
+    if ((argc > next_arg + 2) && (0 == strcmp("--frames", argv[next_arg]))) {
+        first_frame = atoi(argv[next_arg + 1]);
+        last_frame = atoi(argv[next_arg + 2]);
+        next_arg += 3;
+    }
+    std::vector<std::string> steps(argv + next_arg, argv + argc);
+
+    ImageLogReader reader;
+    if (!reader.open(log_filename)) {
+        std::cerr << reader.error() << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!reader.error().empty()) {
+        std::cerr << reader.error() << ", the images before it are still used" << std::endl;
+    }
+    if (!list_only) {
+        mkpath(directory.c_str(), 0777);
+    }
+
+    int count = 0;
+    int failed = 0;
+    cv::Mat image;
+    for (const auto &record : reader.records()) {
+        if ((record.frame < first_frame) || (record.frame > last_frame) || !stepSelected(record.step, steps)) {
+            continue;
+        }
+        ++count;
+        if (list_only) {
+            std::cout << record.frame << ", " << record.seq << ", " << record.step
+                      << ", " << record.cols << "x" << record.rows << "x" << CV_MAT_CN(record.type)
+                      << ", " << record.data_size << " bytes"
+                      << ((IMAGE_LOG_PACKBITS == record.compression) ? " (RLE)" : "") << std::endl;
+            continue;
+        }
+
+        std::string filename = directory + "/" + imageLogFilename(record.frame, record.seq, record.step);
+        if (!reader.read(record, image)) {
+            std::cerr << reader.error() << std::endl;
+            ++failed;
+        } else if (!cv::imwrite(filename, image)) {
+            std::cerr << "Could not write " << filename << std::endl;
+            ++failed;
+        }
+    }
+
+    std::cout << reader.records().size() << " images in " << log_filename << ", "
+              << count << (list_only ? " selected" : " selected and written") << ", "
+              << failed << " failed" << std::endl;
+    return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
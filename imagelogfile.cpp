@@ -0,0 +1,271 @@
+/*
+ *  Face manager 0.1
+ *  Append-only file of logged debug images so a long run doesn't create one PNG per image
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include "imagelogfile.h"
+#include "imagelogger.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+char const IMAGE_LOG_FILE_MAGIC[8] = {'F', 'M', 'I', 'M', 'G', 'L', 'O', 'G'};
+char const IMAGE_LOG_RECORD_MAGIC[4] = {'F', 'M', 'I', 'R'};
+uint32_t const IMAGE_LOG_FILE_VERSION = 1;
+
+/*
+ * PackBits run length encoding: a control byte n followed by n + 1 literal bytes if n is 0 to 127, or by one byte
+ * to be repeated 1 - n times if n is -127 to -1. Runs shorter than 3 are left in the literals.
+ */
+static void
+packBits(const uint8_t *src, size_t size, std::vector<uint8_t> &packed) {
+    packed.clear();
+    size_t i = 0;
+    while (i < size) {
+        size_t run = 1;
+        while ((i + run < size) && (run < 128) && (src[i + run] == src[i])) {
+            ++run;
+        }
+        if (run >= 3) {
+            packed.push_back((uint8_t) (257 - run));
+            packed.push_back(src[i]);
+            i += run;
+        } else {
+            size_t start = i;
+            while ((i < size) && (i - start < 128) &&
+                   !((i + 2 < size) && (src[i] == src[i + 1]) && (src[i] == src[i + 2]))) {
+                ++i;
+            }
+            packed.push_back((uint8_t) (i - start - 1));
+            packed.insert(packed.end(), src + start, src + i);
+        }
+    }
+}
+
+// Returns false unless the packed data fills dst exactly
+static bool
+unpackBits(const uint8_t *src, size_t size, uint8_t *dst, size_t dst_size) {
+    size_t i = 0;
+    size_t o = 0;
+    while (i < size) {
+        int n = (int8_t) src[i++];
+        if (n >= 0) {
+            size_t count = (size_t) n + 1;
+            if ((count > size - i) || (count > dst_size - o)) {
+                return false;
+            }
+            std::memcpy(dst + o, src + i, count);
+            i += count;
+            o += count;
+        } else if (-128 != n) {
+            size_t count = (size_t) (1 - n);
+            if ((i >= size) || (count > dst_size - o)) {
+                return false;
+            }
+            std::memset(dst + o, src[i++], count);
+            o += count;
+        }
+    }
+    return o == dst_size;
+}
+
+std::string
+imageLogFilename(int frame, int seq, const std::string &step) {
+    char numbers[25];
+    sprintf(numbers, "%05d-%03d", frame, seq);
+    return std::string(numbers) + "-" + step + ".png";
+}
+
+
+bool
+ImageLogWriter::open(const std::string &filename, bool compress, bool append) {
+    close();
+    filename_ = filename;
+    compress_ = compress;
+
+    /*
+     * When appending, an existing file is checked and anything after the last complete record, left if the
+     * process stopped while writing, is removed so that the new records can be found.
+     */
+    struct stat file_stat;
+    bool exists = append && (0 == stat(filename.c_str(), &file_stat)) && (file_stat.st_size > 0);
+    if (exists) {
+        ImageLogReader reader;
+        if (!reader.open(filename)) {
+            logger.error(reader.error());
+            return false;
+        }
+        uint64_t valid_size = sizeof(ImageLogFileHeader);
+        if (!reader.records().empty()) {
+            const ImageLogRecord &last = reader.records().back();
+            valid_size = last.data_offset + last.data_size;
+        }
+        if ((valid_size < (uint64_t) file_stat.st_size) && (0 != truncate(filename.c_str(), (off_t) valid_size))) {
+            logger.error("Unable to remove incomplete image from " + filename);
+            return false;
+        }
+    }
+
+    out_.open(filename, std::ios::binary | (exists ? std::ios::app : std::ios::trunc));
+    if (!out_) {
+        logger.error("Unable to open image log file " + filename);
+        return false;
+    }
+    if (!exists) {
+        ImageLogFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, IMAGE_LOG_FILE_MAGIC, sizeof(IMAGE_LOG_FILE_MAGIC));
+        header.version = IMAGE_LOG_FILE_VERSION;
+        out_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    }
+    return true;
+}
+
+bool
+ImageLogWriter::append(int frame, int seq, const std::string &step, const cv::Mat &image) {
+    if (!out_.is_open() || image.empty()) {
+        return false;
+    }
+
+    cv::Mat pixels = image.isContinuous() ? image : image.clone();
+    size_t raw_size = pixels.total() * pixels.elemSize();
+
+    ImageLogRecordHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, IMAGE_LOG_RECORD_MAGIC, sizeof(IMAGE_LOG_RECORD_MAGIC));
+    header.frame = frame;
+    header.seq = seq;
+    header.rows = pixels.rows;
+    header.cols = pixels.cols;
+    header.type = pixels.type();
+    header.step_size = (uint32_t) step.size();
+    header.compression = IMAGE_LOG_UNCOMPRESSED;
+    header.data_size = raw_size;
+
+    const char *data = reinterpret_cast<const char *>(pixels.data);
+    if (compress_) {
+        packBits(pixels.data, raw_size, packed_);
+        if (packed_.size() < raw_size) {
+            header.compression = IMAGE_LOG_PACKBITS;
+            header.data_size = packed_.size();
+            data = reinterpret_cast<const char *>(packed_.data());
+        }
+    }
+
+    out_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out_.write(step.data(), step.size());
+    out_.write(data, header.data_size);
+    if (!out_) {
+        logger.error("Error writing image log file " + filename_);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void
+ImageLogWriter::close() {
+    if (out_.is_open()) {
+        out_.close();
+    }
+    out_.clear();
+}
+
+
+bool
+ImageLogReader::open(const std::string &filename) {
+    filename_ = filename;
+    records_.clear();
+    error_.clear();
+    in_.close();
+    in_.clear();
+    in_.open(filename, std::ios::binary);
+    if (!in_) {
+        error_ = "Unable to open image log file " + filename;
+        return false;
+    }
+
+    in_.seekg(0, std::ios::end);
+    uint64_t file_size = (uint64_t) in_.tellg();
+    in_.seekg(0, std::ios::beg);
+
+    ImageLogFileHeader header;
+    if (!in_.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        (0 != std::memcmp(header.magic, IMAGE_LOG_FILE_MAGIC, sizeof(IMAGE_LOG_FILE_MAGIC)))) {
+        error_ = filename + " is not an image log file";
+        return false;
+    }
+    if (IMAGE_LOG_FILE_VERSION != header.version) {
+        error_ = "Image log file " + filename + " has unsupported version " + std::to_string(header.version);
+        return false;
+    }
+
+    uint64_t offset = sizeof(header);
+    ImageLogRecordHeader record_header;
+    while (offset + sizeof(record_header) <= file_size) {
+        in_.seekg(offset);
+        if (!in_.read(reinterpret_cast<char *>(&record_header), sizeof(record_header))) {
+            break;
+        }
+        if ((0 != std::memcmp(record_header.magic, IMAGE_LOG_RECORD_MAGIC, sizeof(IMAGE_LOG_RECORD_MAGIC))) ||
+            (record_header.compression > IMAGE_LOG_PACKBITS) ||
+            (record_header.rows <= 0) || (record_header.cols <= 0)) {
+            error_ = "Image log file " + filename + " is corrupt after " + std::to_string(records_.size()) +
+                     " images";
+            break;
+        }
+
+        uint64_t data_offset = offset + sizeof(record_header) + record_header.step_size;
+        if ((data_offset > file_size) || (record_header.data_size > file_size - data_offset)) {
+            // the last image was not completely written
+            break;
+        }
+
+        ImageLogRecord record;
+        record.frame = record_header.frame;
+        record.seq = record_header.seq;
+        record.step.resize(record_header.step_size);
+        in_.read(&record.step[0], record_header.step_size);
+        record.rows = record_header.rows;
+        record.cols = record_header.cols;
+        record.type = record_header.type;
+        record.compression = (ImageLogCompression) record_header.compression;
+        record.data_offset = data_offset;
+        record.data_size = record_header.data_size;
+        records_.push_back(record);
+
+        offset = data_offset + record_header.data_size;
+    }
+    in_.clear();
+    return true;
+}
+
+bool
+ImageLogReader::read(const ImageLogRecord &record, cv::Mat &image) {
+    image.create(record.rows, record.cols, record.type);
+    size_t raw_size = image.total() * image.elemSize();
+
+    in_.seekg(record.data_offset);
+    bool ok;
+    if (IMAGE_LOG_PACKBITS == record.compression) {
+        packed_.resize(record.data_size);
+        ok = in_.read(reinterpret_cast<char *>(packed_.data()), record.data_size) &&
+             unpackBits(packed_.data(), packed_.size(), image.data, raw_size);
+    } else {
+        ok = (raw_size == record.data_size) && in_.read(reinterpret_cast<char *>(image.data), raw_size);
+    }
+    if (!ok) {
+        error_ = "Unable to read image " + imageLogFilename(record.frame, record.seq, record.step) + " from " +
+                 filename_;
+        in_.clear();
+    }
+    return ok;
+}
@@ -0,0 +1,130 @@
+/*
+ *  Face manager 0.1
+ *  Append-only file of logged debug images so a long run doesn't create one PNG per image
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_IMAGE_LOG_FILE_H
+#define FACE_MANAGER_IMAGE_LOG_FILE_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// How the pixels of a record are stored
+enum ImageLogCompression {
+    IMAGE_LOG_UNCOMPRESSED = 0,
+    IMAGE_LOG_PACKBITS = 1 // run length encoded, good for the masks and thresholded images the detectors log
+};
+
+/*
+ * Layout of an image log file. Values are stored in the native byte order, as in gallery files.
+ *
+ *     header
+ *     records   each a record header, the step name (not null terminated) and then the pixels
+ *
+ * Records are only ever appended so there is no index in the file, readers build one by skipping from record
+ * header to record header. A record cut short because the process stopped while writing it is ignored.
+ */
+struct ImageLogFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct ImageLogRecordHeader {
+    char magic[4];
+    int32_t frame;
+    int32_t seq;
+    int32_t rows;
+    int32_t cols;
+    // OpenCV type of the image, such as CV_8UC3
+    int32_t type;
+    uint32_t step_size;
+    uint32_t compression;
+    uint64_t data_size;
+};
+
+// An image in an image log file
+struct ImageLogRecord {
+    int frame;
+    int seq;
+    std::string step;
+    int rows;
+    int cols;
+    int type;
+    ImageLogCompression compression;
+    uint64_t data_offset;
+    uint64_t data_size;
+};
+
+// Name of the PNG that ImageLogger writes, or that is extracted, for an image
+std::string imageLogFilename(int frame, int seq, const std::string &step);
+
+/*
+ * Appends images to an image log file. Not thread safe, ImageLogger only uses it from its writer thread.
+ */
+class ImageLogWriter {
+public:
+    /*
+     * Opens the file, creating it if necessary. With append images are added to an existing file, otherwise it
+     * is replaced. With compress the pixels of each image are run length encoded if that makes them smaller.
+     * Returns false on error.
+     */
+    bool open(const std::string &filename, bool compress, bool append);
+
+    // Returns false if the image could not be written
+    bool append(int frame, int seq, const std::string &step, const cv::Mat &image);
+
+    void close();
+
+    bool isOpen() const {
+        return out_.is_open();
+    }
+
+private:
+    std::ofstream out_;
+    std::string filename_;
+    bool compress_ = false;
+
+    // reused between images
+    std::vector<uint8_t> packed_;
+};
+
+/*
+ * Reads the images in an image log file. Errors are not logged, as the reader is used by command line tools,
+ * error() describes the last one.
+ */
+class ImageLogReader {
+public:
+    // Reads the record headers of the whole file, returns false if it is not an image log file
+    bool open(const std::string &filename);
+
+    const std::vector<ImageLogRecord> &records() const {
+        return records_;
+    }
+
+    // Returns false if the pixels can't be read or decompressed
+    bool read(const ImageLogRecord &record, cv::Mat &image);
+
+    // Why the last open() or read() failed, or why open() stopped before the end of the file, empty if it didn't
+    const std::string &error() const {
+        return error_;
+    }
+
+private:
+    std::ifstream in_;
+    std::string filename_;
+    std::vector<ImageLogRecord> records_;
+    std::vector<uint8_t> packed_;
+    std::string error_;
+};
+
+#endif //FACE_MANAGER_IMAGE_LOG_FILE_H
@@ -9,12 +9,14 @@
 
 
 #include "imagelogger.h"
+#include "imagelogfile.h"
 #include "mkpath.h"
 #include <dlib/image_processing.h>
-#include <dlib/image_io.h>
+#include <algorithm>
 #include <iostream>
 
 const std::string DEFAULT_LOG_NAME = "log.txt";
+const std::string DEFAULT_IMAGE_LOG_NAME = "images.fmlog";
 
 // The single instance of the logger
 ImageLogger logger("debug");
@@ -25,36 +27,148 @@ ImageLogger::ImageLogger(std::string dir) {
 }
 
 ImageLogger::~ImageLogger() {
+    flush();
     if (logFile) {
         logFile.close();
     }
 }
 
 void
-ImageLogger::log(int msgLevel, std::string step, const cv::Mat &image) {
-    if (enabled && (msgLevel >= logLevel)) {
+ImageLogger::log(int msgLevel, const std::string &step, const cv::Mat &image) {
+    if ((msgLevel >= L_MIN_COMPILED) && enabled && (msgLevel >= logLevel)) {
+        // callers reuse their working images so the pixels must be copied before returning
+        queueImage(step, image.clone());
+    }
+}
+
+void
+ImageLogger::log(int msgLevel, const std::string &step, const dlib::matrix<dlib::rgb_pixel> &dlib_image) {
+    if ((msgLevel >= L_MIN_COMPILED) && enabled && (msgLevel >= logLevel) && (dlib_image.size() > 0)) {
+        // converting to BGR makes the copy and lets the writer use cv::imwrite for every image
+        cv::Mat rgb(dlib_image.nr(), dlib_image.nc(), CV_8UC3, (void *) &dlib_image(0, 0));
+        cv::Mat bgr;
+        cv::cvtColor(rgb, bgr, cv::COLOR_RGB2BGR);
+        queueImage(step, bgr);
+    }
+}
+
+void
+ImageLogger::queueImage(const std::string &step, cv::Mat image) {
+    LoggedImage item;
+    BoundedQueue<LoggedImage> *queue;
+    {
+        std::lock_guard<std::mutex> lock(logMutex);
         if (!logFile.is_open()) {
             firstLog();
         }
-        cv::imwrite(filename(step), image);
+        if (!writerThread.joinable()) {
+            imageQueue.reset(new BoundedQueue<LoggedImage>(queueCapacity_));
+            writerThread = std::thread(&ImageLogger::writeImages, this, imageFormat_);
+        }
+        item.frame = frameCount;
+        item.seq = seq;
+        item.step = step;
         ++seq;
+        ++imageCounters_.queued_;
+        queue = imageQueue.get();
+    }
+    item.image = image;
+
+    // wait for the writer without holding logMutex so other threads can still log text
+    switch (queuePolicy_) {
+        case LOG_QUEUE_DROP:
+            if (!queue->tryPush(item)) {
+                std::lock_guard<std::mutex> lock(logMutex);
+                ++imageCounters_.dropped_;
+            }
+            break;
+        case LOG_QUEUE_DOWNSAMPLE:
+            if (!queue->tryPush(item)) {
+                cv::Mat small;
+                cv::resize(item.image, small, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
+                item.image = small;
+                {
+                    std::lock_guard<std::mutex> lock(logMutex);
+                    ++imageCounters_.downsampled_;
+                }
+                queue->push(std::move(item));
+            }
+            break;
+        case LOG_QUEUE_BLOCK:
+        default:
+            queue->push(std::move(item));
+            break;
     }
 }
 
 void
-ImageLogger::log(int msgLevel, std::string step, const dlib::matrix<dlib::rgb_pixel> &dlib_image) {
-    if (enabled && (msgLevel >= logLevel)) {
-        if (!logFile.is_open()) {
-            firstLog();
+ImageLogger::writeImages(ImageLogFormat format) {
+    ImageLogWriter image_log;
+    if (IMAGE_LOG_PNG != format) {
+        // a file left by an earlier run is replaced, as its frame numbers would clash with this run's
+        image_log.open(imageLogPath(), IMAGE_LOG_RLE == format, imageLogStarted);
+        imageLogStarted = true;
+    }
+
+    LoggedImage item;
+    while (imageQueue->pop(item)) {
+        bool written;
+        if (IMAGE_LOG_PNG == format) {
+            try {
+                written = cv::imwrite(imagePrefix + imageLogFilename(item.frame, item.seq, item.step), item.image);
+            } catch (cv::Exception &e) {
+                written = false;
+            }
+        } else {
+            written = image_log.append(item.frame, item.seq, item.step, item.image);
         }
-        dlib::save_png(dlib_image, filename(step));
-        ++seq;
+
+        std::lock_guard<std::mutex> lock(logMutex);
+        if (written) {
+            ++imageCounters_.written_;
+        } else {
+            ++imageCounters_.failed_;
+        }
+    }
+}
+
+void
+ImageLogger::flush() {
+    if (!writerThread.joinable()) {
+        return;
+    }
+    imageQueue->close();
+    writerThread.join();
+
+    std::lock_guard<std::mutex> lock(logMutex);
+    imageCounters_.full_waits_ += imageQueue->fullWaits();
+    imageQueue.reset();
+}
+
+ImageLogCounters
+ImageLogger::imageCounters() const {
+    std::lock_guard<std::mutex> lock(logMutex);
+    ImageLogCounters counters = imageCounters_;
+    if (imageQueue) {
+        counters.full_waits_ += imageQueue->fullWaits();
+    }
+    return counters;
+}
+
+void
+ImageLogger::resetImageCounters() {
+    std::lock_guard<std::mutex> lock(logMutex);
+    imageCounters_.reset();
+    if (imageQueue) {
+        // the queue's count can't be reset so take it off what is reported later
+        imageCounters_.full_waits_ = -imageQueue->fullWaits();
     }
 }
 
 void
-ImageLogger::log(int msgLevel, std::string msg) {
-    if (enabled && (msgLevel >= logLevel)) {
+ImageLogger::log(int msgLevel, const std::string &msg) {
+    if ((msgLevel >= L_MIN_COMPILED) && enabled && (msgLevel >= logLevel)) {
+        std::lock_guard<std::mutex> lock(logMutex);
         if (!logFile.is_open()) {
             firstLog();
         }
@@ -74,8 +188,8 @@ ImageLogger::firstLog() {
 }
 
 std::string
-ImageLogger::filename(std::string step) {
-    return imagePrefix + frameString() + "-" + step + ".png";
+ImageLogger::imageLogPath() const {
+    return imagePrefix + DEFAULT_IMAGE_LOG_NAME;
 }
 
 std::string
@@ -101,3 +215,60 @@ ImageLogger::levelString(int msgLevel) const {
     }
 }
 
+LogQueuePolicy
+logQueuePolicyFromString(std::string policy_name) {
+    std::transform(policy_name.begin(), policy_name.end(), policy_name.begin(), ::toupper);
+    if (policy_name == "BLOCK") {
+        return LOG_QUEUE_BLOCK;
+    } else if (policy_name == "DROP") {
+        return LOG_QUEUE_DROP;
+    } else if (policy_name == "DOWNSAMPLE") {
+        return LOG_QUEUE_DOWNSAMPLE;
+    } else {
+        std::cerr << "invalid image log queue policy: '" << policy_name << "'" << std::endl;
+        std::exit(1);
+    }
+}
+
+std::string
+logQueuePolicyToString(LogQueuePolicy policy) {
+    switch (policy) {
+        case LOG_QUEUE_BLOCK:
+            return "BLOCK";
+        case LOG_QUEUE_DROP:
+            return "DROP";
+        case LOG_QUEUE_DOWNSAMPLE:
+            return "DOWNSAMPLE";
+        default:
+            return "";
+    }
+}
+
+ImageLogFormat
+imageLogFormatFromString(std::string format_name) {
+    std::transform(format_name.begin(), format_name.end(), format_name.begin(), ::toupper);
+    if (format_name == "PNG") {
+        return IMAGE_LOG_PNG;
+    } else if (format_name == "RAW") {
+        return IMAGE_LOG_RAW;
+    } else if (format_name == "RLE") {
+        return IMAGE_LOG_RLE;
+    } else {
+        std::cerr << "invalid image log format: '" << format_name << "'" << std::endl;
+        std::exit(1);
+    }
+}
+
+std::string
+imageLogFormatToString(ImageLogFormat format) {
+    switch (format) {
+        case IMAGE_LOG_PNG:
+            return "PNG";
+        case IMAGE_LOG_RAW:
+            return "RAW";
+        case IMAGE_LOG_RLE:
+            return "RLE";
+        default:
+            return "";
+    }
+}
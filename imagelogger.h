@@ -12,15 +12,94 @@
 #ifndef IMAGELOGGER_H_
 #define IMAGELOGGER_H_
 
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <opencv2/opencv.hpp>
 #include <dlib/opencv.h>
 
+#include "boundedqueue.h"
+
 int const L_TRACE = 0;
 int const L_DEBUG = 1;
 int const L_INFO = 2;
 int const L_ERROR = 3;
 
+/*
+ * Messages below this level are compiled out: the xxxEnabled() checks are constant false and the LOG_ macros
+ * below generate no code. Release builds (NDEBUG) keep INFO and above by default, define LOG_MIN_LEVEL as 4 to
+ * remove all logging.
+ */
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL 2
+#else
+#define LOG_MIN_LEVEL 0
+#endif
+#endif
+
+int const L_MIN_COMPILED = LOG_MIN_LEVEL;
+
+/*
+ * Log a message, image or rectangle only if the level is enabled, for example
+ *
+ *     LOG_DEBUG("New tracker for " + std::to_string(local_id), rect);
+ *
+ * The arguments are not evaluated otherwise, so no strings are built for messages that won't be written.
+ */
+#define LOG_TRACE(...) do { if (logger.traceEnabled()) { logger.trace(__VA_ARGS__); } } while (0)
+#define LOG_DEBUG(...) do { if (logger.debugEnabled()) { logger.debug(__VA_ARGS__); } } while (0)
+#define LOG_INFO(...) do { if (logger.infoEnabled()) { logger.info(__VA_ARGS__); } } while (0)
+#define LOG_ERROR(...) do { if (logger.errorEnabled()) { logger.error(__VA_ARGS__); } } while (0)
+
+// What to do with an image logged while the queue of images waiting to be written is full
+enum LogQueuePolicy {
+    LOG_QUEUE_BLOCK,     // wait for the writer so no images are lost
+    LOG_QUEUE_DROP,      // don't write the image
+    LOG_QUEUE_DOWNSAMPLE // halve the width and height of the image then wait, so the writer catches up sooner
+};
+
+size_t const DEFAULT_LOG_QUEUE_CAPACITY = 64;
+
+// How logged images are stored
+enum ImageLogFormat {
+    IMAGE_LOG_PNG, // one PNG file per image
+    IMAGE_LOG_RAW, // appended uncompressed to a single image log file, see imagelogfile.h
+    IMAGE_LOG_RLE  // as IMAGE_LOG_RAW with run length encoding of the pixels where it saves space
+};
+
+// counters so we can see whether image logging is keeping up
+struct ImageLogCounters {
+public:
+    long queued_ = 0;
+    long written_ = 0;
+    long dropped_ = 0;
+    long downsampled_ = 0;
+
+    // number of times a thread logging an image had to wait for the writer
+    long full_waits_ = 0;
+
+    // images that could not be written
+    long failed_ = 0;
+
+    inline void reset() {
+        queued_ = 0;
+        written_ = 0;
+        dropped_ = 0;
+        downsampled_ = 0;
+        full_waits_ = 0;
+        failed_ = 0;
+    }
+};
+
+/*
+ * Writes text messages and images to a debug directory. Text is written immediately. Images are copied onto a
+ * bounded queue and encoded and written by a writer thread so logging costs the calling thread little more than
+ * the copy, what happens when the queue is full is set by queuePolicy().
+ * Images are written as PNGs or, so that a long run doesn't make hundreds of thousands of files, appended to a
+ * single image log file that imagelog-extract can turn back into PNGs.
+ */
 class ImageLogger {
 public:
     ImageLogger(std::string dir);
@@ -35,105 +114,157 @@ public:
         logLevel = newLevel;
     }
 
+    /*
+     * get / set what happens when an image is logged while the queue is full, and the capacity of the queue.
+     * The capacity takes effect the next time the writer is started, after flush().
+     */
+    LogQueuePolicy queuePolicy() const {
+        return queuePolicy_;
+    }
+
+    void queuePolicy(LogQueuePolicy policy) {
+        queuePolicy_ = policy;
+    }
+
+    // get / set how images are stored, takes effect the next time the writer is started
+    ImageLogFormat imageFormat() const {
+        return imageFormat_;
+    }
+
+    void imageFormat(ImageLogFormat format) {
+        imageFormat_ = format;
+    }
+
+    // image log file written by the IMAGE_LOG_RAW and IMAGE_LOG_RLE formats
+    std::string imageLogPath() const;
+
+    size_t queueCapacity() const {
+        return queueCapacity_;
+    }
+
+    void queueCapacity(size_t capacity) {
+        queueCapacity_ = capacity;
+    }
+
+    // Wait until all the queued images have been written. Must not be called while other threads are logging.
+    void flush();
+
+    ImageLogCounters imageCounters() const;
+
+    void resetImageCounters();
+
     void nextFrame() {
+        std::lock_guard<std::mutex> lock(logMutex);
         ++frameCount;
         seq = 0;
     }
 
     void setFrame(int f) {
+        std::lock_guard<std::mutex> lock(logMutex);
         frameCount = f;
         seq = 0;
     }
 
     inline bool traceEnabled() const {
-        return enabled && L_TRACE >= logLevel;
+        return (L_TRACE >= L_MIN_COMPILED) && enabled && L_TRACE >= logLevel;
     }
 
     inline bool debugEnabled() const {
-        return enabled && L_DEBUG >= logLevel;
+        return (L_DEBUG >= L_MIN_COMPILED) && enabled && L_DEBUG >= logLevel;
     }
 
     inline bool infoEnabled() const {
-        return enabled && L_INFO >= logLevel;
+        return (L_INFO >= L_MIN_COMPILED) && enabled && L_INFO >= logLevel;
     }
 
     inline bool errorEnabled() const {
-        return enabled && L_ERROR >= logLevel;
+        return (L_ERROR >= L_MIN_COMPILED) && enabled && L_ERROR >= logLevel;
     }
 
     template <typename image_type>
-    inline void trace(std::string step, const image_type& image) {
+    inline void trace(const std::string &step, const image_type& image) {
         log(L_TRACE, step, image);
     }
 
     template <typename image_type>
-    inline void debug(std::string step, const image_type& image) {
+    inline void debug(const std::string &step, const image_type& image) {
         log(L_DEBUG, step, image);
     }
 
     template <typename image_type>
-    inline void info(std::string step, const image_type& image) {
+    inline void info(const std::string &step, const image_type& image) {
         log(L_INFO, step, image);
     }
 
     template <typename image_type>
-    inline void error(std::string step, const image_type& image) {
+    inline void error(const std::string &step, const image_type& image) {
         log(L_ERROR, step, image);
     }
 
-    void log(int msgLevel, std::string step, const cv::Mat& image);
+    void log(int msgLevel, const std::string &step, const cv::Mat& image);
 
-    void log(int msgLevel, std::string step, const dlib::matrix<dlib::rgb_pixel>& dlib_image);
+    void log(int msgLevel, const std::string &step, const dlib::matrix<dlib::rgb_pixel>& dlib_image);
 
-    inline void trace(std::string msg) {
+    inline void trace(const std::string &msg) {
         log(L_TRACE, msg);
     }
 
-    inline void debug(std::string msg) {
+    inline void debug(const std::string &msg) {
         log(L_DEBUG, msg);
     }
 
-    inline void info(std::string msg) {
+    inline void info(const std::string &msg) {
         log(L_INFO, msg);
     }
 
-    inline void error(std::string msg) {
+    inline void error(const std::string &msg) {
         log(L_ERROR, msg);
     }
 
-    void log(int msgLevel, std::string msg);
+    void log(int msgLevel, const std::string &msg);
 
     // Convenience functions for common structures to log
-    inline void trace(std::string msg, dlib::rectangle& rect) {
+    inline void trace(const std::string &msg, const dlib::rectangle& rect) {
         log(L_TRACE, msg, rect);
     }
 
-    inline void debug(std::string msg, dlib::rectangle& rect) {
+    inline void debug(const std::string &msg, const dlib::rectangle& rect) {
         log(L_DEBUG, msg, rect);
     }
 
-    inline void info(std::string msg, dlib::rectangle& rect) {
+    inline void info(const std::string &msg, const dlib::rectangle& rect) {
         log(L_INFO, msg, rect);
     }
 
-    inline void error(std::string msg, dlib::rectangle& rect) {
+    inline void error(const std::string &msg, const dlib::rectangle& rect) {
         log(L_ERROR, msg, rect);
     }
 
-    inline std::string to_string(dlib::rectangle& rect) {
+    inline std::string to_string(const dlib::rectangle& rect) {
         return std::to_string(rect.left()) + ", " +
                std::to_string(rect.top()) + ", " +
                std::to_string(rect.right()) + ", " +
                std::to_string(rect.bottom());
     }
 
-    inline void log(int msgLevel, std::string msg, dlib::rectangle& rect) {
+    inline void log(int msgLevel, const std::string &msg, const dlib::rectangle& rect) {
         log(msgLevel, msg + " rect: " + to_string(rect));
     }
 
 private:
+    struct LoggedImage {
+        int frame;
+        int seq;
+        std::string step;
+        cv::Mat image;
+    };
+
+    // image must be a copy that the caller no longer uses
+    void queueImage(const std::string &step, cv::Mat image);
+
+    void writeImages(ImageLogFormat format);
+
     void firstLog();
-    std::string filename(std::string step);
     std::string frameString();
     std::string levelString(int msgLevel) const;
 
@@ -144,8 +275,30 @@ private:
     std::string dirName;
     std::string imagePrefix;
     std::ofstream logFile;
+
+    // the logger may be used from several pipeline stages at once
+    mutable std::mutex logMutex;
+
+    // images waiting to be written by the writer thread, both are started when the first image is logged
+    ImageLogFormat imageFormat_ = IMAGE_LOG_PNG;
+    LogQueuePolicy queuePolicy_ = LOG_QUEUE_BLOCK;
+    size_t queueCapacity_ = DEFAULT_LOG_QUEUE_CAPACITY;
+    std::unique_ptr<BoundedQueue<LoggedImage>> imageQueue;
+    std::thread writerThread;
+    ImageLogCounters imageCounters_;
+
+    // only used by the writer thread, so writers started after a flush() add to the image log file
+    bool imageLogStarted = false;
 };
 
+LogQueuePolicy logQueuePolicyFromString(std::string policy_name);
+
+std::string logQueuePolicyToString(LogQueuePolicy policy);
+
+ImageLogFormat imageLogFormatFromString(std::string format_name);
+
+std::string imageLogFormatToString(ImageLogFormat format);
+
 // define the single instance all modules will use
 extern ImageLogger logger;
 
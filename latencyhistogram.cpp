@@ -0,0 +1,97 @@
+/*
+ *  Face manager 0.1
+ *  Latency histograms with constant relative precision so the slow frames can be seen as well as the typical ones
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include "latencyhistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+void
+LatencyHistogram::merge(const LatencyHistogram &other) {
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    total_micros_ += other.total_micros_;
+    max_micros_ = std::max(max_micros_, other.max_micros_);
+}
+
+void
+LatencyHistogram::reset() {
+    std::fill(counts_, counts_ + BUCKET_COUNT, 0);
+    count_ = 0;
+    total_micros_ = 0;
+    max_micros_ = 0;
+}
+
+uint64_t
+LatencyHistogram::bucketUpperBound(int index) {
+    if (index < (int) (2 * SUB_BUCKET_COUNT)) {
+        return (uint64_t) index;
+    }
+    int shift = index / (int) SUB_BUCKET_COUNT - 1;
+    uint64_t sub_bucket = index % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+double
+LatencyHistogram::percentile(double percent) const {
+    if (0 == count_) {
+        return 0;
+    }
+    uint64_t target = (uint64_t) std::ceil(std::min(100.0, std::max(0.0, percent)) / 100.0 * count_);
+    target = std::max<uint64_t>(target, 1);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        seen += counts_[i];
+        if (seen >= target) {
+            // the top of the bucket may be above anything actually recorded
+            return std::min(bucketUpperBound(i), max_micros_) / 1e6;
+        }
+    }
+    return max();
+}
+
+
+void
+StageLatencies::merge(const StageLatencies &other) {
+    for (int i = 0; i < LATENCY_STAGE_COUNT; ++i) {
+        stages_[i].merge(other.stages_[i]);
+    }
+}
+
+void
+StageLatencies::reset() {
+    for (int i = 0; i < LATENCY_STAGE_COUNT; ++i) {
+        stages_[i].reset();
+    }
+}
+
+std::string
+latencyStageToString(LatencyStage stage) {
+    switch (stage) {
+        case LATENCY_MOTION:
+            return "motion";
+        case LATENCY_TRACKER_UPDATE:
+            return "tracker update";
+        case LATENCY_DETECTION:
+            return "detection";
+        case LATENCY_LANDMARKS:
+            return "landmarks";
+        case LATENCY_CHIP_EXTRACTION:
+            return "chip extraction";
+        case LATENCY_DESCRIPTOR:
+            return "descriptor";
+        case LATENCY_GALLERY_SEARCH:
+            return "gallery search";
+        default:
+            return "";
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ *  Face manager 0.1
+ *  Latency histograms with constant relative precision so the slow frames can be seen as well as the typical ones
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_LATENCY_HISTOGRAM_H
+#define FACE_MANAGER_LATENCY_HISTOGRAM_H
+
+#include <cstdint>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+// The stages of processing a frame whose latency is recorded
+enum LatencyStage {
+    LATENCY_MOTION,
+    LATENCY_TRACKER_UPDATE,
+    LATENCY_DETECTION,
+    LATENCY_LANDMARKS,
+    LATENCY_CHIP_EXTRACTION,
+    LATENCY_DESCRIPTOR,
+    LATENCY_GALLERY_SEARCH,
+    LATENCY_STAGE_COUNT
+};
+
+/*
+ * Histogram of latencies in microseconds in the style of HdrHistogram. Values below 64us have their own bucket,
+ * above that each power of two range is split into 32 buckets so values are recorded to within about 3%, up to
+ * 2^36us (19 hours). Recording is a few integer operations and there are no allocations, so it can be done for
+ * every call of even the cheaper operations. Not thread safe.
+ */
+class LatencyHistogram {
+public:
+    // Record the time since start_ticks, as returned by cv::getTickCount()
+    inline void recordSince(int64 start_ticks) {
+        record(((double) cv::getTickCount() - start_ticks) / cv::getTickFrequency());
+    }
+
+    inline void record(double seconds) {
+        uint64_t micros = (seconds > 0) ? (uint64_t) (seconds * 1e6 + 0.5) : 0;
+        if (micros > MAX_MICROS) {
+            micros = MAX_MICROS;
+        }
+        ++counts_[bucketIndex(micros)];
+        ++count_;
+        total_micros_ += micros;
+        if (micros > max_micros_) {
+            max_micros_ = micros;
+        }
+    }
+
+    void merge(const LatencyHistogram &other);
+
+    void reset();
+
+    uint64_t count() const {
+        return count_;
+    }
+
+    /*
+     * The latency in seconds that percent of the values are less than or equal to, to within the precision
+     * of the buckets. Returns 0 if nothing has been recorded.
+     */
+    double percentile(double percent) const;
+
+    // exact largest value recorded in seconds
+    double max() const {
+        return max_micros_ / 1e6;
+    }
+
+    double mean() const {
+        return (0 == count_) ? 0 : total_micros_ / 1e6 / count_;
+    }
+
+private:
+    static const int SUB_BUCKET_BITS = 5;
+    static const uint64_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static const int MAX_MAGNITUDE = 36;
+    static const uint64_t MAX_MICROS = (1ULL << MAX_MAGNITUDE) - 1;
+    static const int BUCKET_COUNT = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+    static inline int bucketIndex(uint64_t micros) {
+        if (micros < 2 * SUB_BUCKET_COUNT) {
+            return (int) micros;
+        }
+        // shift so the value keeps its top SUB_BUCKET_BITS + 1 bits
+        int shift = (63 - __builtin_clzll(micros)) - SUB_BUCKET_BITS;
+        return (int) (shift * SUB_BUCKET_COUNT + (micros >> shift));
+    }
+
+    // largest value that falls in a bucket
+    static uint64_t bucketUpperBound(int index);
+
+    uint64_t counts_[BUCKET_COUNT] = {0};
+    uint64_t count_ = 0;
+    uint64_t total_micros_ = 0;
+    uint64_t max_micros_ = 0;
+};
+
+// One histogram for each stage
+struct StageLatencies {
+public:
+    LatencyHistogram stages_[LATENCY_STAGE_COUNT];
+
+    inline LatencyHistogram &operator[](LatencyStage stage) {
+        return stages_[stage];
+    }
+
+    inline const LatencyHistogram &operator[](LatencyStage stage) const {
+        return stages_[stage];
+    }
+
+    void merge(const StageLatencies &other);
+
+    void reset();
+};
+
+std::string latencyStageToString(LatencyStage stage);
+
+#endif //FACE_MANAGER_LATENCY_HISTOGRAM_H
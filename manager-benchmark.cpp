@@ -12,9 +12,15 @@
 #include "facedetector.h"
 #include "manager.h"
 #include "demo-util.h"
+#include "pipeline.h"
+#include "latencyhistogram.h"
+#include "tracing.h"
 
 #include <stdlib.h>
+#include <algorithm>
 #include <cstring>
+#include <sstream>
+#include <thread>
 #include <opencv2/opencv.hpp>
 
 #include <dlib/dnn.h>
@@ -45,16 +51,79 @@ processingTypeToString(ProcessingType processingType) {
     }
 }
 
+// Target and type of the manager's detection budget, empty if it has none
+std::string
+budgetToString(const Manager *manager) {
+    const DetectionController *controller = manager ? manager->detectionController() : nullptr;
+    if (nullptr == controller) {
+        return "";
+    }
+    std::ostringstream budget;
+    budget << controller->target() << " " << budgetTypeToString(controller->budgetType());
+    return budget.str();
+}
+
+// Percentiles of each stage's latency reported in the CSV
+double const LATENCY_PERCENTILES[] = {50, 90, 99};
+
+std::string latencyHeadings() {
+    std::ostringstream headings;
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; ++stage) {
+        std::string name = latencyStageToString((LatencyStage) stage);
+        for (double percentile : LATENCY_PERCENTILES) {
+            headings << ", " << name << " p" << percentile << " (ms)";
+        }
+        headings << ", " << name << " max (ms)";
+    }
+    return headings.str();
+}
+
+std::string latencyColumns(const StageLatencies &latencies) {
+    std::ostringstream columns;
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; ++stage) {
+        const LatencyHistogram &histogram = latencies[(LatencyStage) stage];
+        for (double percentile : LATENCY_PERCENTILES) {
+            columns << ", " << histogram.percentile(percentile) * 1000;
+        }
+        columns << ", " << histogram.max() * 1000;
+    }
+    return columns.str();
+}
+
+// Read frames as luma without RGB conversion, set from the command line for every trial
+bool read_luma = false;
+
+const char *TRACE_FILENAME = "manager-benchmark-trace.json";
+
+// Limits used to check that the manager forgets unknown people
+int const EVICTION_MAX_UNKNOWN_PEOPLE = 1;
+int const EVICTION_EXPIRY_FRAMES = 10;
+
 void usage() {
-    std::cout << "Usage: <filename> <iterations> [method]" << std::endl;
-    std::cout << "Valid methods: NONE, CONTOURS, MSE, MSE_WITH_BLUR, DIFF, DIFF_WITH_BLUR" << std::endl;
+    std::cout << "Usage: <filename> <iterations> [method] [PIPELINE] [LUMA] [BLOCK|DROP|DOWNSAMPLE] [PNG|RAW|RLE]"
+              << " [TRACE]"
+              << std::endl;
+    std::cout << "Valid methods: NONE, CONTOURS, MSE, MSE_WITH_BLUR, DIFF, DIFF_WITH_BLUR, DIFF_FUSED, DIFF_TILED,"
+              << " CONTOURS_FIXED, MSE_FIXED, MSE_WITH_BLUR_FIXED, BACKGROUND" << std::endl;
+    std::cout << "PIPELINE runs decode, motion detection and the manager on separate threads" << std::endl;
+    std::cout << "LUMA reads frames without RGB conversion if the video backend supports it" << std::endl;
+    std::cout << "BLOCK, DROP or DOWNSAMPLE sets what happens to logged images when the writer falls behind"
+              << std::endl;
+    std::cout << "PNG, RAW or RLE sets whether logged images are written as PNGs or to a single image log file"
+              << std::endl;
+    std::cout << "TRACE writes a timeline of a single method run to " << TRACE_FILENAME
+              << " for chrome://tracing" << std::endl;
 }
 
 int
 runTrial(MotionMethod method, int numIterations, char *videoFilename, bool enable_logging, bool enable_output,
-         ProcessingType processingType, FaceDetector &faceDetector, Manager *manager) {
+         ProcessingType processingType, FaceDetector &faceDetector, Manager *manager, bool use_pipeline = false,
+         int *motion_frames = nullptr) {
+    // The naive approach does not use the manager so there is no pipeline for it
+    use_pipeline = use_pipeline && (ProcessingType::NAIVE != processingType);
     if (enable_output) {
-        std::cout << "Start: " << motionMethodToString(method) << ", logging enabled " << enable_logging << std::endl;
+        std::cout << "Start: " << motionMethodToString(method) << ", logging enabled " << enable_logging
+                  << ", pipeline " << use_pipeline << std::endl;
     }
 
     /*
@@ -63,7 +132,12 @@ runTrial(MotionMethod method, int numIterations, char *videoFilename, bool enabl
      */
     double totalTime = 0;
     int frameCount = 0;
+    if (enable_logging) {
+        logger.resetImageCounters();
+    }
     int motionCount = 0;
+    FrameFormat frameFormat = FRAME_BGR;
+    LatencyHistogram motionLatency;
     for (int i = 0; i < numIterations; ++i) {
 
         // Read video
@@ -75,8 +149,9 @@ runTrial(MotionMethod method, int numIterations, char *videoFilename, bool enabl
             return EXIT_FAILURE;
         }
 
-        cv::Mat frame;
-        cv::Mat prevFrame;
+        FrameReader reader(video, read_luma);
+        VideoFrame frame;
+        VideoFrame prevFrame;
 
         // setup run
         frameCount = 0;
@@ -90,32 +165,65 @@ runTrial(MotionMethod method, int numIterations, char *videoFilename, bool enabl
 
         // Camera sensor takes a while to calibrate, skip the first few frames
         for (int w = 0; w < WARM_UP_FRAMES; ++w) {
-            cv::Mat drop_frame;
-            video.read(drop_frame);
+            VideoFrame drop_frame;
+            reader.read(drop_frame);
         }
 
         // Initialise detector
         MotionDetector *detector = motionDetectorFactory(method);
         int num_init_frames = detector->numInitFrames();
         for (int i = 0; i < num_init_frames; ++i) {
-            video.read(prevFrame);
-            detector->initFrame(prevFrame);
+            reader.read(prevFrame);
+            detector->initFrame(prevFrame.image());
         }
+        frameFormat = reader.format();
 
         // we count the operations performed by the face detector as a measure of how much work we are doing
         faceDetector.resetCounters();
+        if (manager) {
+            manager->resetCounters();
+        }
+        motionLatency.reset();
 
         // don't want to include setup time so start timing now
         double startTime = (double) cv::getTickCount();
-        while (video.read(frame)) {
+        if (use_pipeline) {
+            FramePipeline pipeline(reader, *detector,
+                                   (ProcessingType::MANAGER == processingType) ? manager : nullptr);
+            frameCount = pipeline.run([&](PipelineFrame &item) {
+                if (item.moved) {
+                    ++motionCount;
+                    LOG_INFO("motion", item.frame.image());
+                }
+            });
+            totalTime += ((double) cv::getTickCount() - startTime);
+            motionLatency = pipeline.motionLatency();
+            if (enable_output) {
+                pipeline.printStats(std::cout);
+            }
+            continue;
+        }
+
+        while (reader.read(frame)) {
             ++frameCount;
             logger.nextFrame();
+            cv::Mat &image = frame.image();
             bool moved = true;
-            moved = detector->detectMotion(frame);
+            std::vector<cv::Rect> motion_regions;
+            int64 motion_ticks = cv::getTickCount();
+            {
+                TRACE_SPAN("detect motion", frameCount);
+                if (manager && manager->motionRegionDetection()) {
+                    moved = detector->detectMotionRegions(image, motion_regions);
+                } else {
+                    moved = detector->detectMotion(image);
+                }
+            }
+            motionLatency.recordSince(motion_ticks);
 
             if (moved) {
                 ++motionCount;
-                logger.info("motion", frame);
+                LOG_INFO("motion", image);
             }
 
             if (moved) {
@@ -125,20 +233,19 @@ runTrial(MotionMethod method, int numIterations, char *videoFilename, bool enabl
 
                     case ProcessingType::NAIVE:
                         if (!manager) {
-                            // Convert OpenCV image format to Dlib's image format
-                            dlib::cv_image<dlib::bgr_pixel> frame_dlib(frame);
-
-                            // Detect faces in the image
-                            std::vector<dlib::rectangle> faceRects = faceDetector.detectFaces(frame_dlib);
-                            if (logger.debugEnabled()) {
-                                logger.debug("Number of faces detected: " + std::to_string(faceRects.size()));
+                            // Detect faces in the image, using the luma plane directly if the frame was read as luma
+                            std::vector<dlib::rectangle> faceRects = (1 == image.channels())
+                                    ? faceDetector.detectFaces(dlib::cv_image<unsigned char>(image))
+                                    : faceDetector.detectFaces(dlib::cv_image<dlib::bgr_pixel>(image));
+                            LOG_DEBUG("Number of faces detected: " + std::to_string(faceRects.size()));
+
+                            // These are the transformed and extracted faces, which need a colour frame
+                            std::vector<dlib::matrix<dlib::rgb_pixel>> faces;
+                            if (!faceRects.empty()) {
+                                dlib::cv_image<dlib::bgr_pixel> frame_dlib(frame.colour());
+                                faces = faceDetector.extractFaceImages(frame_dlib, faceRects);
                             }
 
-                            // These are the transformed and extracted faces
-                            std::vector<dlib::matrix<dlib::rgb_pixel>> faces = faceDetector.extractFaceImages(
-                                    frame_dlib,
-                                    faceRects);
-
                             if (faces.size() > 0) {
                                 /*
                                  * This call asks the DNN to convert each face image in faces into a 128D vector.
@@ -154,7 +261,7 @@ runTrial(MotionMethod method, int numIterations, char *videoFilename, bool enabl
 
                     case ProcessingType::MANAGER:
                         if (manager) {
-                            manager->newFrame(frameCount, frame);
+                            manager->newFrame(frameCount, frame, motion_regions);
                         }
                         break;
                 }
@@ -163,26 +270,88 @@ runTrial(MotionMethod method, int numIterations, char *videoFilename, bool enabl
             prevFrame = frame;
         }
         totalTime += ((double) cv::getTickCount() - startTime);
+
+        // wait for logged images to be written, outside the timing, so the writer isn't competing with later runs
+        if (enable_logging) {
+            logger.flush();
+        }
     }
 
 
+    if (motion_frames) {
+        *motion_frames = motionCount;
+    }
+
     // Calculate Frames per second (FPS)
     float fps = cv::getTickFrequency() / (totalTime / (frameCount * numIterations));
     FaceCounters counters = faceDetector.getCounters();
+    /*
+     * Each new face should be analysed exactly once, so in the manager runs the number of landmark,
+     * face extract and descriptor operations should all equal the number of new faces
+     */
+    ManagerCounters manager_counters = manager ? manager->getCounters() : ManagerCounters();
+
+    // latencies of the last iteration, like the counters
+    StageLatencies latencies = faceDetector.getLatencies();
+    if (manager) {
+        latencies.merge(manager->getLatencies());
+    }
+    latencies[LATENCY_MOTION].merge(motionLatency);
     if (enable_output) {
         std::cout
-                << "File, method, Manager?, Detect inteval, #frames, FPS, #motion frames, #face detect, #face extract, #face descriptor"
-                <<
-                std::endl;
+                << "File, method, Manager?, Detect inteval, Tracker, Motion regions?, Scale, Budget, Format, #frames, FPS, #motion frames, #face detect, #detect pixels, #face landmarks, #face extract, #face descriptor"
+                << ", #descriptor batches, mean batch size, max batch size, #new faces, #new people"
+                << ", #evicted (capacity), #evicted (expired), gallery bytes"
+                << ", #trackers started, #trackers lost, mean track length"
+                << ", #full scans, #window scans, #reanchored"
+                << latencyHeadings()
+                << std::endl;
         std::cout << "End: " << videoFilename << ", "
                   << motionMethodToString(method)
                   << ", " << processingTypeToString(processingType)
                   << ", " << ((nullptr == manager) ? "" : std::to_string(manager->detectorFrameInterval()))
+                  << ", " << ((nullptr == manager) ? "" : trackerTypeToString(manager->trackerType()))
+                  << ", " << ((nullptr == manager) ? "" : (manager->motionRegionDetection() ? "YES" : "NO"))
+                  << ", " << ((nullptr == manager) ? "" : std::to_string(manager->processingScale()))
+                  << ", " << budgetToString(manager)
+                  << ", " << frameFormatToString(frameFormat)
                   << ", " << frameCount << ", " << fps << ", " << motionCount
                   << ", " << counters.detect_count_
+                  << ", " << counters.detect_pixels_
+                  << ", " << counters.landmark_count_
                   << ", " << counters.extract_face_image_count_
                   << ", " << counters.face_descriptor_count_
+                  << ", " << counters.face_descriptor_batch_count_
+                  << ", " << counters.meanDescriptorBatchSize()
+                  << ", " << counters.face_descriptor_max_batch_size_
+                  << ", " << manager_counters.new_face_count_
+                  << ", " << manager_counters.new_person_count_
+                  << ", " << manager_counters.evicted_capacity_count_
+                  << ", " << manager_counters.evicted_expired_count_
+                  << ", " << (manager ? manager->galleryMemoryUsage() : 0)
+                  << ", " << manager_counters.tracker_start_count_
+                  << ", " << manager_counters.tracker_lost_count_
+                  << ", " << manager_counters.meanTrackLength()
+                  << ", " << manager_counters.full_scan_count_
+                  << ", " << manager_counters.window_scan_count_
+                  << ", " << manager_counters.reanchor_count_
+                  << latencyColumns(latencies)
                   << std::endl;
+
+        if (enable_logging) {
+            ImageLogCounters log_counters = logger.imageCounters();
+            std::cout << "Image log, format, policy, #queued, #written, #dropped, #downsampled, #full waits, #failed"
+                      << std::endl;
+            std::cout << "Image log: " << imageLogFormatToString(logger.imageFormat())
+                      << ", " << logQueuePolicyToString(logger.queuePolicy())
+                      << ", " << log_counters.queued_
+                      << ", " << log_counters.written_
+                      << ", " << log_counters.dropped_
+                      << ", " << log_counters.downsampled_
+                      << ", " << log_counters.full_waits_
+                      << ", " << log_counters.failed_
+                      << std::endl;
+        }
     }
 
     return 0;
@@ -191,14 +360,18 @@ runTrial(MotionMethod method, int numIterations, char *videoFilename, bool enabl
 
 int
 runMethods(int numIterations, char *videoFilename, ProcessingType processingType, FaceDetector &faceDetector,
-           Manager *manager) {
+           Manager *manager, bool use_pipeline) {
     MotionMethod methods[] = {MOTION_ALWAYS, MOTION_NEVER,
                               MOTION_EVERY_OTHER, MOTION_EVERY_TEN,
                               MOTION_CONTOURS,
                               MOTION_MSE, MOTION_MSE_WITH_BLUR,
-                              MOTION_DIFF, MOTION_DIFF_WITH_BLUR};
+                              MOTION_DIFF, MOTION_DIFF_WITH_BLUR, MOTION_DIFF_FUSED,
+                              MOTION_DIFF_TILED,
+                              MOTION_CONTOURS_FIXED, MOTION_MSE_FIXED, MOTION_MSE_WITH_BLUR_FIXED,
+                              MOTION_BACKGROUND};
     for (const MotionMethod method : methods) {
-        int result = runTrial(method, numIterations, videoFilename, false, true, processingType, faceDetector, manager);
+        int result = runTrial(method, numIterations, videoFilename, false, true, processingType, faceDetector, manager,
+                              use_pipeline);
         if (0 != result) {
             std::cerr << "Stopping early due to error" << std::endl;
             return result;
@@ -207,6 +380,146 @@ runMethods(int numIterations, char *videoFilename, ProcessingType processingType
     return 0;
 }
 
+/*
+ * Run two motion detectors over the same frames of the video and report how often they agree, used to check
+ * the accuracy of the fixed point detectors against the float versions they replace
+ */
+int
+compareMethods(MotionMethod expected_method, MotionMethod actual_method, char *videoFilename) {
+    cv::VideoCapture video(videoFilename);
+    if (!video.isOpened()) {
+        std::cout << "Could not read video file" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    cv::Mat frame;
+    for (int w = 0; w < WARM_UP_FRAMES; ++w) {
+        video.read(frame);
+    }
+
+    MotionDetector *expected = motionDetectorFactory(expected_method);
+    MotionDetector *actual = motionDetectorFactory(actual_method);
+    int num_init_frames = std::max(expected->numInitFrames(), actual->numInitFrames());
+    for (int i = 0; i < num_init_frames; ++i) {
+        video.read(frame);
+        if (i < expected->numInitFrames()) {
+            expected->initFrame(frame);
+        }
+        if (i < actual->numInitFrames()) {
+            actual->initFrame(frame);
+        }
+    }
+
+    int frameCount = 0;
+    int expectedCount = 0;
+    int actualCount = 0;
+    int agreeCount = 0;
+    while (video.read(frame)) {
+        bool expected_moved = expected->detectMotion(frame);
+        bool actual_moved = actual->detectMotion(frame);
+        ++frameCount;
+        expectedCount += expected_moved ? 1 : 0;
+        actualCount += actual_moved ? 1 : 0;
+        agreeCount += (expected_moved == actual_moved) ? 1 : 0;
+    }
+    delete expected;
+    delete actual;
+
+    std::cout << "File, method, compared with, #frames, #motion frames, #compared motion frames, #agree, agreement"
+              << std::endl;
+    std::cout << videoFilename
+              << ", " << motionMethodToString(actual_method)
+              << ", " << motionMethodToString(expected_method)
+              << ", " << frameCount << ", " << actualCount << ", " << expectedCount << ", " << agreeCount
+              << ", " << ((0 == frameCount) ? 1.0 : agreeCount / (double) frameCount) << std::endl;
+    return 0;
+}
+
+/*
+ * Run the manager with a motion detector and a baseline detector and report how many motion frames and face
+ * detections the detector saves, which matters most for videos where the lighting changes
+ */
+int
+reportSavings(MotionMethod baseline_method, MotionMethod method, int numIterations, char *videoFilename,
+              FaceDetector &faceDetector, bool use_pipeline) {
+    int motion_frames[2] = {0, 0};
+    int face_detections[2] = {0, 0};
+    MotionMethod methods[] = {baseline_method, method};
+    for (int i = 0; i < 2; ++i) {
+        Manager *manager = new Manager(faceDetector);
+        manager->detectorFrameInterval(5);
+        int result = runTrial(methods[i], numIterations, videoFilename, false, false, ProcessingType::MANAGER,
+                              faceDetector, manager, use_pipeline, &motion_frames[i]);
+        face_detections[i] = faceDetector.getCounters().detect_count_;
+        delete manager;
+        if (0 != result) {
+            return result;
+        }
+    }
+
+    std::cout << "File, method, compared with, #motion frames, #motion frames saved, #face detect, #face detect saved"
+              << std::endl;
+    std::cout << videoFilename
+              << ", " << motionMethodToString(method)
+              << ", " << motionMethodToString(baseline_method)
+              << ", " << motion_frames[1] << ", " << (motion_frames[0] - motion_frames[1])
+              << ", " << face_detections[1] << ", " << (face_detections[0] - face_detections[1]) << std::endl;
+    return 0;
+}
+
+/*
+ * Check that the manager forgets unknown people when it has too many and when they haven't been seen for a while.
+ * The video is run through a manager that may only remember one unknown person who isn't being tracked. The
+ * manager is then reset, as it is between benchmark iterations, and given blank frames in which nobody can be
+ * seen, after which everyone it still remembers should expire.
+ */
+int
+checkUnknownEviction(char *videoFilename, FaceDetector &faceDetector) {
+    cv::VideoCapture video(videoFilename);
+    if (!video.isOpened()) {
+        std::cout << "Could not read video file" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Manager manager(faceDetector);
+    manager.detectorFrameInterval(5);
+    manager.maxUnknownPeople(EVICTION_MAX_UNKNOWN_PEOPLE);
+
+    cv::Mat frame;
+    cv::Mat blank;
+    int frame_no = 0;
+    int over_capacity_frames = 0;
+    while (video.read(frame)) {
+        if (blank.empty()) {
+            blank = cv::Mat::zeros(frame.size(), frame.type());
+        }
+        manager.newFrame(++frame_no, frame);
+        // people being tracked are never forgotten
+        if (manager.unknownCount() > EVICTION_MAX_UNKNOWN_PEOPLE + manager.visibleCount()) {
+            ++over_capacity_frames;
+        }
+    }
+    if (blank.empty()) {
+        std::cout << "Could not read video file" << std::endl;
+        return EXIT_FAILURE;
+    }
+    ManagerCounters after_video = manager.getCounters();
+    int remembered = manager.unknownCount();
+
+    manager.reset();
+    manager.unknownPersonExpiryFrames(EVICTION_EXPIRY_FRAMES);
+    for (int i = 1; i <= EVICTION_EXPIRY_FRAMES + 1; ++i) {
+        manager.newFrame(i, blank);
+    }
+    int expired = manager.getCounters().evicted_expired_count_ - after_video.evicted_expired_count_;
+
+    bool passed = (0 == over_capacity_frames) && (0 == manager.unknownCount()) && (remembered == expired);
+    std::cout << "Unknown people eviction: " << after_video.new_person_count_ << " new people, "
+              << after_video.evicted_capacity_count_ << " forgotten over capacity, " << over_capacity_frames
+              << " frames over capacity, " << remembered << " remembered, " << expired << " expired after reset, "
+              << manager.unknownCount() << " left" << (passed ? "" : " FAILED") << std::endl;
+    return passed ? 0 : EXIT_FAILURE;
+}
 
 int main(int argc, char **argv) {
     if (argc < 3) {
@@ -214,9 +527,39 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
+    // optional trailing arguments to select the multi-threaded pipeline, reading frames as luma and image logging
+    bool use_pipeline = false;
+    bool trace = false;
+    while (argc > 3) {
+        std::string flag = stringToUpper(argv[argc - 1]);
+        if ("PIPELINE" == flag) {
+            use_pipeline = true;
+        } else if ("LUMA" == flag) {
+            read_luma = true;
+        } else if (("BLOCK" == flag) || ("DROP" == flag) || ("DOWNSAMPLE" == flag)) {
+            logger.queuePolicy(logQueuePolicyFromString(flag));
+        } else if (("PNG" == flag) || ("RAW" == flag) || ("RLE" == flag)) {
+            logger.imageFormat(imageLogFormatFromString(flag));
+        } else if ("TRACE" == flag) {
+            trace = true;
+        } else {
+            break;
+        }
+        --argc;
+    }
+
+    // a trace of every method would be far too large to load
+    if (trace && (4 != argc)) {
+        std::cout << "TRACE needs a method" << std::endl;
+        usage();
+        return EXIT_FAILURE;
+    }
+
     char *videoFilename = argv[1];
     int numIterations = atoi(argv[2]);
-    std::cout << "Read " << videoFilename << " " << numIterations << " times" << std::endl;
+    std::cout << "Read " << videoFilename << " " << numIterations << " times"
+              << (use_pipeline ? " using pipeline" : "") << (read_luma ? " as luma" : "")
+              << ((L_MIN_COMPILED > L_ERROR) ? " with logging compiled out" : "") << std::endl;
 
     FaceDetector faceDetector("models");
 
@@ -232,24 +575,52 @@ int main(int argc, char **argv) {
     if (4 == argc) {
         std::string methodName = argv[3];
         MotionMethod method = motionMethodFromString(methodName);
-        // TODO add manager
-        return runTrial(method, numIterations, videoFilename, true, true, ProcessingType::NAIVE, faceDetector, nullptr);
+        Manager manager(faceDetector);
+        if (trace) {
+            tracer.start();
+        }
+        int result = runTrial(method, numIterations, videoFilename, true, true, ProcessingType::MANAGER,
+                              faceDetector, &manager, use_pipeline);
+        if (trace) {
+            if (!tracer.stop(TRACE_FILENAME)) {
+                return EXIT_FAILURE;
+            }
+            std::cout << "Trace written to " << TRACE_FILENAME << ", " << tracer.droppedEvents()
+                      << " spans dropped" << std::endl;
+        }
+        return result;
 
     } else {
         // run complete set of trials
         std::cout << "Running all methods using only motion detection" << std::endl;
-        int result = runMethods(numIterations, videoFilename, ProcessingType::NONE, faceDetector, nullptr);
+        int result = runMethods(numIterations, videoFilename, ProcessingType::NONE, faceDetector, nullptr,
+                                use_pipeline);
+
+        if (0 == result) {
+            std::cout << "Comparing fixed point motion detectors with the float versions" << std::endl;
+            MotionMethod fixed_methods[][2] = {{MOTION_CONTOURS,      MOTION_CONTOURS_FIXED},
+                                               {MOTION_MSE,           MOTION_MSE_FIXED},
+                                               {MOTION_MSE_WITH_BLUR, MOTION_MSE_WITH_BLUR_FIXED}};
+            for (const auto &methods : fixed_methods) {
+                result = compareMethods(methods[0], methods[1], videoFilename);
+                if (0 != result) {
+                    break;
+                }
+            }
+        }
 
         if (0 == result) {
             std::cout << "Running all methods using naive approach" << std::endl;
-            result = runMethods(numIterations, videoFilename, ProcessingType::NAIVE, faceDetector, nullptr);
+            result = runMethods(numIterations, videoFilename, ProcessingType::NAIVE, faceDetector, nullptr,
+                                use_pipeline);
         }
 
         if (0 == result) {
             std::cout << "Running all methods with manager (interval 5)" << std::endl;
             Manager *manager = new Manager(faceDetector);
             manager->detectorFrameInterval(5);
-            result = runMethods(numIterations, videoFilename, ProcessingType::MANAGER, faceDetector, manager);
+            result = runMethods(numIterations, videoFilename, ProcessingType::MANAGER, faceDetector, manager,
+                                use_pipeline);
             delete manager;
         }
 
@@ -257,7 +628,102 @@ int main(int argc, char **argv) {
             std::cout << "Running all methods with manager (interval 10)" << std::endl;
             Manager *manager = new Manager(faceDetector);
             manager->detectorFrameInterval(10);
-            result = runMethods(numIterations, videoFilename, ProcessingType::MANAGER, faceDetector, manager);
+            result = runMethods(numIterations, videoFilename, ProcessingType::MANAGER, faceDetector, manager,
+                                use_pipeline);
+            delete manager;
+        }
+
+        if (0 == result) {
+            int num_threads = std::thread::hardware_concurrency();
+            std::cout << "Running all methods with manager (interval 5, " << num_threads << " worker threads)"
+                      << std::endl;
+            Manager *manager = new Manager(faceDetector);
+            manager->detectorFrameInterval(5);
+            manager->workerThreads(num_threads);
+            result = runMethods(numIterations, videoFilename, ProcessingType::MANAGER, faceDetector, manager,
+                                use_pipeline);
+            delete manager;
+        }
+
+        if (0 == result) {
+            std::cout << "Running all methods with manager (interval 5, detection in motion regions)" << std::endl;
+            Manager *manager = new Manager(faceDetector);
+            manager->detectorFrameInterval(5);
+            manager->motionRegionDetection(true);
+            result = runMethods(numIterations, videoFilename, ProcessingType::MANAGER, faceDetector, manager,
+                                use_pipeline);
+            delete manager;
+        }
+
+        if (0 == result) {
+            std::cout << "Running all methods with manager (interval 30, tracker windows interval 5)" << std::endl;
+            Manager *manager = new Manager(faceDetector);
+            manager->detectorFrameInterval(30);
+            manager->trackerWindowInterval(5);
+            result = runMethods(numIterations, videoFilename, ProcessingType::MANAGER, faceDetector, manager,
+                                use_pipeline);
+            delete manager;
+        }
+
+        if (0 == result) {
+            std::cout << "Running all methods with manager (interval 5, processing scale 0.5)" << std::endl;
+            Manager *manager = new Manager(faceDetector);
+            manager->detectorFrameInterval(5);
+            manager->processingScale(0.5);
+            result = runMethods(numIterations, videoFilename, ProcessingType::MANAGER, faceDetector, manager,
+                                use_pipeline);
+            delete manager;
+        }
+
+        /*
+         * Let the manager choose the detector interval and scale. The achieved FPS and the number of full scans
+         * show how much detection was given up to meet the budget, the interval and scale are the final values.
+         * Manager::reset() puts the budget back to its starting interval and scale so every method starts the same.
+         */
+        if (0 == result) {
+            std::cout << "Running all methods with manager (budget 15 FPS)" << std::endl;
+            Manager *manager = new Manager(faceDetector);
+            manager->detectionBudget(BUDGET_FPS, 15);
+            result = runMethods(numIterations, videoFilename, ProcessingType::MANAGER, faceDetector, manager,
+                                use_pipeline);
+            delete manager;
+        }
+
+        if (0 == result) {
+            std::cout << "Running all methods with manager (budget 0.1s latency)" << std::endl;
+            Manager *manager = new Manager(faceDetector);
+            manager->detectionBudget(BUDGET_LATENCY, 0.1);
+            result = runMethods(numIterations, videoFilename, ProcessingType::MANAGER, faceDetector, manager,
+                                use_pipeline);
+            delete manager;
+        }
+
+        if (0 == result) {
+            std::cout << "Checking the manager forgets unknown people (interval 5)" << std::endl;
+            result = checkUnknownEviction(videoFilename, faceDetector);
+        }
+
+        if (0 == result) {
+            std::cout << "Savings from the background model motion detector (manager interval 5)" << std::endl;
+            result = reportSavings(MOTION_DIFF, MOTION_BACKGROUND, numIterations, videoFilename, faceDetector,
+                                   use_pipeline);
+        }
+
+        /*
+         * Compare the tracker backends. Motion detection is always on so every frame is tracked, identity
+         * continuity is shown by how long trackers last and how many new people are created when a face is lost.
+         */
+        TrackerType tracker_types[] = {TRACKER_CORRELATION, TRACKER_KCF, TRACKER_MEDIANFLOW};
+        for (const TrackerType tracker_type : tracker_types) {
+            if (0 != result) {
+                break;
+            }
+            std::cout << "Running manager with " << trackerTypeToString(tracker_type) << " tracker (interval 5)"
+                      << std::endl;
+            Manager *manager = new Manager(faceDetector, tracker_type);
+            manager->detectorFrameInterval(5);
+            result = runTrial(MOTION_ALWAYS, numIterations, videoFilename, false, true, ProcessingType::MANAGER,
+                              faceDetector, manager, use_pipeline);
             delete manager;
         }
 
@@ -8,13 +8,17 @@
  */
 
 #include <cmath>
+#include <cstring>
 #include <iomanip>
+#include <thread>
 
 #include "imagelogger.h"
 #include "facedetector.h"
 #include "manager.h"
 #include "util.h"
 #include "demo-util.h"
+#include "pipeline.h"
+#include "tracing.h"
 
 
 const double FPS_MOVING_AVERAGE_WEIGHT = 0.9;
@@ -45,8 +49,12 @@ void usage() {
     std::cout
             << "Takes an input video file and annotates it with fae tracking results and frame rate and writes output to another video file"
             << std::endl;
-    std::cout << "Usage: <input filename> <output filename> [method] [[name face-image-filename]+]" << std::endl;
-    std::cout << "Valid methods: NONE, CONTOURS, MSE, MSE_WITH_BLUR, DIFF, DIFF_WITH_BLUR" << std::endl;
+    std::cout << "Usage: <input filename> <output filename> [method] [--luma] [--trace trace-filename] [--gallery gallery-filename] [[name face-image-filename]+]"
+              << std::endl;
+    std::cout << "--luma reads frames without RGB conversion if the video backend supports it" << std::endl;
+    std::cout << "--trace writes a timeline of each frame that can be loaded into chrome://tracing" << std::endl;
+    std::cout << "Valid methods: NONE, CONTOURS, MSE, MSE_WITH_BLUR, DIFF, DIFF_WITH_BLUR, DIFF_FUSED, DIFF_TILED,"
+              << " CONTOURS_FIXED, MSE_FIXED, MSE_WITH_BLUR_FIXED, BACKGROUND" << std::endl;
 }
 
 int main(int argc, char **argv) {
@@ -66,12 +74,43 @@ int main(int argc, char **argv) {
 
     FaceDetector faceDetector("models");
     Manager *manager = new Manager(faceDetector);
+    manager->workerThreads(std::thread::hardware_concurrency());
 
-    for (int f = 4; f < argc; f += 2) {
+    int first_person = 4;
+    bool luma_only = false;
+    if ((argc > first_person) && (0 == strcmp("--luma", argv[first_person]))) {
+        luma_only = true;
+        ++first_person;
+    }
+
+    std::string trace_filename;
+    if ((argc > first_person + 1) && (0 == strcmp("--trace", argv[first_person]))) {
+        trace_filename = argv[first_person + 1];
+        std::cout << "Trace: " << trace_filename << std::endl;
+        first_person += 2;
+    }
+
+    if ((argc > first_person + 1) && (0 == strcmp("--gallery", argv[first_person]))) {
+        std::string gallery_filename = argv[first_person + 1];
+        std::cout << "Gallery: " << gallery_filename << std::endl;
+        if (!manager->loadGallery(gallery_filename)) {
+            std::cout << "Could not load gallery file" << std::endl;
+            return EXIT_FAILURE;
+        }
+        first_person += 2;
+    }
+
+    std::vector<std::pair<std::string, std::string>> people;
+    for (int f = first_person; f + 1 < argc; f += 2) {
         std::string name = argv[f];
         std::string face_filename = argv[f + 1];
         std::cout << "Name: " << name << ", face: " << face_filename << std::endl;
-        manager->addPerson(name, face_filename);
+        people.push_back(std::make_pair(name, face_filename));
+    }
+    if (!people.empty()) {
+        EnrolmentStats enrolment = manager->addPeople(people);
+        std::cout << "Enrolled " << enrolment.new_person_count_ << " of " << enrolment.image_count_
+                  << " people at " << enrolment.imagesPerSecond() << " images per second" << std::endl;
     }
 
     // Read video
@@ -96,23 +135,26 @@ int main(int argc, char **argv) {
     cv::VideoWriter output_video(outputVideoFilename, CV_FOURCC('M', 'J', 'P', 'G'), input_fps,
                                  cv::Size(frame_width, frame_height));
 
+    // Motion and face detection use the luma plane, colour frames are only built for new faces and the output
+    FrameReader reader(input_video, luma_only);
+
     // Camera sensor takes a while to calibrate, skip the first few frames
     for (int w = 0; w < WARM_UP_FRAMES; ++w) {
-        cv::Mat drop_frame;
-        input_video.read(drop_frame);
+        VideoFrame drop_frame;
+        reader.read(drop_frame);
     }
 
-    cv::Mat frame;
-    cv::Mat prevFrame;
+    VideoFrame prevFrame;
     int frameCount = 0;
 
     // Initialise detector
     MotionDetector *detector = motionDetectorFactory(method);
     int num_init_frames = detector->numInitFrames();
     for (int i = 0; i < num_init_frames; ++i) {
-        input_video.read(prevFrame);
-        detector->initFrame(prevFrame);
+        reader.read(prevFrame);
+        detector->initFrame(prevFrame.image());
     }
+    std::cout << "Reading " << frameFormatToString(reader.format()) << " frames" << std::endl;
 
     double meanFrameTime = 0;
     double minFps = std::numeric_limits<double>::max();
@@ -120,27 +162,27 @@ int main(int argc, char **argv) {
     double startTicks = (double) cv::getTickCount();
     double lastFrame = startTicks;
 
-    while (input_video.read(frame)) {
-        ++frameCount;
-        logger.nextFrame();
-        bool moved = detector->detectMotion(frame);
+    // only the frames are traced, not loading the gallery
+    if (!trace_filename.empty()) {
+        tracer.start();
+    }
 
-        if (moved) {
-            manager->newFrame(frameCount, frame);
-        }
+    // decode, motion detection, face tracking and output each run on their own thread
+    FramePipeline pipeline(reader, *detector, manager);
+    frameCount = pipeline.run([&](PipelineFrame &item) {
+        cv::Mat &frame = item.frame.colour();
 
-        auto visible_people = manager->visiblePeople();
-        for (auto person : visible_people) {
+        for (const auto &person : item.visible_people) {
             // draw box around tracked person
-            dlib::rectangle bb = person->boundingBox();
+            dlib::rectangle bb = person.bounding_box;
             cv::rectangle(frame, dlibRectangleToOpenCV(bb), PERSON_BOX_COLOUR, PERSON_BOX_THICKNESS);
 
             // draw person's identifier next to bounding box
-            std::string name = person->externalId();
+            std::string name = person.external_id;
             if (0 == name.length()) {
                 // If no external ID known, just use local ID
                 std::stringstream nameStream;
-                nameStream << PERSON_UNKNOWN_PREFIX << person->localId();
+                nameStream << PERSON_UNKNOWN_PREFIX << person.local_id;
                 name = nameStream.str();
             }
             cv::Point namePos(bb.left(), bb.top());
@@ -152,7 +194,7 @@ int main(int argc, char **argv) {
         double now = (double) cv::getTickCount();
         double thisFrame = now - lastFrame;
         lastFrame = now;
-        double biasCorrectedMeanFrameTime = meanFrameTime / (1.0 - std::pow(FPS_MOVING_AVERAGE_WEIGHT, frameCount));
+        double biasCorrectedMeanFrameTime = meanFrameTime / (1.0 - std::pow(FPS_MOVING_AVERAGE_WEIGHT, item.frame_no));
         meanFrameTime = (FPS_MOVING_AVERAGE_WEIGHT * biasCorrectedMeanFrameTime) +
                         (1.0 - FPS_MOVING_AVERAGE_WEIGHT) * thisFrame;
         double fps = cv::getTickFrequency() / meanFrameTime;
@@ -163,13 +205,13 @@ int main(int argc, char **argv) {
         std::stringstream fpsText;
         fpsText << std::setprecision(FPS_PRECISION)
                 << FPS_TEXT_PREFIX << std::setw(FPS_WIDTH) << fps
-                << VISIBLE_COUNT_PREFIX << std::setw(VISIBLE_COUNT_WIDTH) << manager->visibleCount()
-                << KNOWN_COUNT_PREFIX << std::setw(KNOWN_COUNT_WIDTH) << manager->knownCount();
+                << VISIBLE_COUNT_PREFIX << std::setw(VISIBLE_COUNT_WIDTH) << item.visible_count
+                << KNOWN_COUNT_PREFIX << std::setw(KNOWN_COUNT_WIDTH) << item.known_count;
         cv::putText(frame, fpsText.str(), FPS_TEXT_POSITION, FPS_TEXT_FONT, FPS_TEXT_SCALE, FPS_TEXT_COLOUR,
                     FPS_TEXT_THICKNESS);
 
         output_video.write(frame);
-    }
+    });
 
     double endTicks = (double) cv::getTickCount();
     double durationTicks = endTicks - startTicks;
@@ -180,6 +222,11 @@ int main(int argc, char **argv) {
     output_video.release();
 
     std::cout << "Mean FPS " << meanFps << ", Min FPS " << minFps << ", Max FPS " << maxFps << std::endl;
+    pipeline.printStats(std::cout);
+
+    if (!trace_filename.empty() && !tracer.stop(trace_filename)) {
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
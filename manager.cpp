@@ -9,12 +9,46 @@
 
 
 #include "manager.h"
+#include "galleryfile.h"
 #include "imagelogger.h"
+#include "tracing.h"
 #include "util.h"
 #include <algorithm>
+#include <cctype>
+#include <cmath>
 
 #include <dlib/image_io.h>
 
+#include <dirent.h>
+
+/*
+ * Number of images addPeople() analyses before computing their descriptors. All the jittered face images in a
+ * group are passed to the DNN together so this bounds the memory used, about 6.75MB per person.
+ */
+size_t const ENROLMENT_GROUP_SIZE = 16;
+
+// Number of ranges parallelFor() gives each worker thread, a few per thread evens out the load
+long const PARALLEL_CHUNKS_PER_THREAD = 2;
+
+/*
+ * Motion regions are padded before searching them for faces since the moving part of a person may not
+ * include all of their face. The padding is a fraction of the region size but at least the minimum.
+ */
+double const DETECTION_REGION_PADDING = 0.25;
+int const DETECTION_REGION_MIN_PADDING = 40;
+
+// Regions smaller than this are grown since the HOG detector can't find faces smaller than 80x80
+int const DETECTION_REGION_MIN_SIZE = 120;
+
+// Padding around a tracker when looking for its face again, each side is padded by this fraction of the tracker size
+double const TRACKER_WINDOW_PADDING = 0.5;
+
+// If the padded regions cover more than this fraction of the frame it is cheaper to search the whole frame
+double const DETECTION_REGION_MAX_COVERAGE = 0.6;
+
+// File types that addPeople() will load from a directory
+char const *const ENROLMENT_IMAGE_EXTENSIONS[] = {".jpg", ".jpeg", ".png", ".bmp"};
+
 bool
 rectangleComparator(const dlib::rectangle &l, const dlib::rectangle &r) {
     return l.left() < r.left();
@@ -27,54 +61,86 @@ personComparator(const std::shared_ptr<Person> &l, const std::shared_ptr<Person>
 
 void
 Manager::newFrame(int frame_no, cv::Mat &frame) {
-    dlib::cv_image<dlib::bgr_pixel> frame_dlib(frame);
+    newFrame(frame_no, frame, std::vector<cv::Rect>());
+}
 
-    // Update the trackers
-    std::vector<int> low_confidence_trackers;
-    for (auto it = trackers_.begin(); it != trackers_.end(); ++it) {
-        double confidence = it->second->update(frame_dlib);
-        auto tracked_person = findPerson(it->first);
-        tracked_person->boundingBox(it->second->get_position());
-        if (logger.debugEnabled()) {
-            logger.debug(
-                    "Tracker for : " + std::to_string(it->first) + " has confidence " + std::to_string(confidence));
-        }
+static dlib::rectangle
+scaleRectangle(const dlib::rectangle &r, double scale) {
+    return dlib::rectangle(std::lround(r.left() * scale), std::lround(r.top() * scale),
+                           std::lround(r.right() * scale), std::lround(r.bottom() * scale));
+}
 
-        if (confidence < min_tracker_confidence_) {
-            low_confidence_trackers.push_back(it->first);
-        }
-    }
+void
+Manager::newFrame(int frame_no, cv::Mat &frame, const std::vector<cv::Rect> &motion_regions) {
+    VideoFrame video_frame(frame);
+    newFrame(frame_no, video_frame, motion_regions);
+}
 
-    if (low_confidence_trackers.size() > 0) {
-        if (logger.debugEnabled()) {
-            logger.debug(std::to_string(low_confidence_trackers.size()) + " trackers with confidence less than " +
-                         std::to_string(min_tracker_confidence_) + " to dispose of");
-        }
-        for (auto it = low_confidence_trackers.begin(); it != low_confidence_trackers.end(); ++it) {
-            trackers_.erase(*it);
-        }
+void
+Manager::newFrame(int frame_no, VideoFrame &frame, const std::vector<cv::Rect> &motion_regions) {
+    TRACE_SPAN("Manager::newFrame", frame_no);
+    int64 start_ticks = cv::getTickCount();
+    int initial_new_face_count = counters_.new_face_count_;
+    int initial_tracker_lost_count = counters_.tracker_lost_count_;
+    last_frame_ = frame_no;
+
+    /*
+     * Detection and tracking run on a copy of the frame scaled by processing_scale_, everything in trackers_ is
+     * in the coordinates of the scaled frame. This is the luma plane if the frame was read as luma. Face images
+     * are always taken from the full size colour frame and the bounding boxes of people are always in full size
+     * frame coordinates.
+     */
+    cv::Mat work = frame.image();
+    if (processing_scale_ < 1.0) {
+        TRACE_SPAN("scale frame");
+        cv::resize(work, scaled_frame_, cv::Size(), processing_scale_, processing_scale_, cv::INTER_AREA);
+        work = scaled_frame_;
+    }
+    if (processing_scale_ != active_scale_) {
+        rescaleTrackers(work);
     }
 
-    // Detect faces in the image
-    // TODO Would it be useful to make this adaptive based on frame rate?
-    if (0 == (frame_no % detector_frame_interval_)) {
-        std::vector<dlib::rectangle> faceRects = face_detector_.detectFaces(frame_dlib);
-        if (logger.debugEnabled()) {
-            logger.debug("Number of faces detected: " +
-                         std::to_string(faceRects.size()) +
-                         ", current visible faces: " +
-                         std::to_string(trackers_.size()));
+    // Update the trackers
+    updateTrackers(work);
+
+    /*
+     * Detect faces in the image. Every detector_frame_interval_ frames the whole frame (or the areas with
+     * motion) is searched to find new faces. If enabled, on other frames just the areas around the trackers are
+     * searched to confirm the faces are still there and correct any tracker drift. The interval is adjusted
+     * after each frame if there is a detection budget.
+     */
+    bool full_scan = (0 == (frame_no % detector_frame_interval_));
+    bool window_scan = !full_scan && (tracker_window_interval_ > 0) &&
+                       (0 == (frame_no % tracker_window_interval_)) && !trackers_.empty();
+    if (full_scan || window_scan) {
+        std::vector<cv::Rect> search_regions = full_scan ? detectionRegions(work, motion_regions)
+                                                         : trackerWindows(work);
+        if (full_scan) {
+            ++counters_.full_scan_count_;
+        } else {
+            ++counters_.window_scan_count_;
         }
+        std::vector<dlib::rectangle> faceRects;
+        {
+            TRACE_SPAN(full_scan ? "full scan" : "window scan");
+            faceRects = detectFaces(work, search_regions);
+        }
+        LOG_DEBUG("Number of faces detected: " +
+                  std::to_string(faceRects.size()) +
+                  ", current visible faces: " +
+                  std::to_string(trackers_.size()));
 
         // which local IDs have been matched with detected faces
         std::set<int> matched_ids;
 
+        // detected faces that did not match any of the trackers
+        std::vector<dlib::rectangle> new_faces;
+
         if (faceRects.size() > 0) {
+            TRACE_SPAN("match faces");
             for (auto itf = faceRects.begin(); itf != faceRects.end(); ++itf) {
                 dlib::rectangle &face_rect = *itf;
-                if (logger.debugEnabled()) {
-                    logger.debug("Face rectangle (from detector): ", face_rect);
-                }
+                LOG_DEBUG("Face rectangle (from detector): ", face_rect);
 
                 // face centre from detector
                 long face_centre_x = face_rect.left() + face_rect.width() / 2;
@@ -90,10 +156,8 @@ Manager::newFrame(int frame_no, cv::Mat &frame) {
                 int matched_id = 0;
                 for (auto itt = trackers_.begin(); itt != trackers_.end(); ++itt) {
                     int tracker_local_id = itt->first;
-                    dlib::rectangle tracker_rect = itt->second->get_position();
-                    if (logger.debugEnabled()) {
-                        logger.debug("Face rectangle (from tracker): ", tracker_rect);
-                    }
+                    dlib::rectangle tracker_rect = itt->second->position();
+                    LOG_DEBUG("Face rectangle (from tracker): ", tracker_rect);
 
                     // face centre from tracker
                     long tracker_centre_x = tracker_rect.left() + tracker_rect.width() / 2;
@@ -119,70 +183,332 @@ Manager::newFrame(int frame_no, cv::Mat &frame) {
                         (tracker_centre_y <= face_rect.bottom())) {
 
                         if (!is_face_matched) {
-                            logger.debug("Detected face and tracked face match. Local ID = " +
-                                         std::to_string(tracker_local_id));
+                            LOG_DEBUG("Detected face and tracked face match. Local ID = " +
+                                      std::to_string(tracker_local_id));
                             is_face_matched = true;
                             matched_id = tracker_local_id;
                         } else {
-                            logger.debug("Duplicate tracker/face match Local IDs = " +
-                                         std::to_string(matched_id) + " & " +
-                                         std::to_string(tracker_local_id));
+                            LOG_DEBUG("Duplicate tracker/face match Local IDs = " +
+                                      std::to_string(matched_id) + " & " +
+                                      std::to_string(tracker_local_id));
                             // TODO handle duplicates by finding best match
                         }
                         matched_ids.insert(tracker_local_id);
                     }
                 }
 
-                /*
-                 * Did we detect a new face? This could be a face we've seen before but has been off camera so
-                 * we need to calculate a face descriptor and compare with descriptors we've see before.
-                 */
+                // Move the tracker back onto the face if it has drifted
+                if (is_face_matched && (tracker_window_interval_ > 0)) {
+                    startTracker(work, matched_id, face_rect);
+                    ++counters_.reanchor_count_;
+                }
+
+                // Did we detect a new face? Defer working out who it is until we have seen all the faces
                 if (!is_face_matched) {
-                    logger.debug("New face detected at ", face_rect);
-                    FaceDescriptor descriptor = getFaceDescriptor(frame_dlib, face_rect, false);
-                    auto known_person = findPerson(descriptor);
-                    int new_tracker_id = 0;
-                    if (!known_person) {
-                        // Person we have not seen before
-                        auto person = handleNewPerson(frame_dlib, face_rect);
-                        new_tracker_id = person->localId();
-
-                    } else {
-                        // Person we've seen before
-                        new_tracker_id = known_person->localId();
-                    }
-                    personVisible(new_tracker_id);
-                    matched_ids.insert(new_tracker_id);
-
-                    dlib::rectangle padded_rectangle(face_rect.left() - tracker_horizontal_margin_,
-                                                     face_rect.top() - tracker_vertical_margin_,
-                                                     face_rect.right() + tracker_horizontal_margin_,
-                                                     face_rect.bottom() + tracker_vertical_margin_);
-                    dlib::correlation_tracker *tracker = new dlib::correlation_tracker();
-                    tracker->start_track(frame_dlib, padded_rectangle);
-                    trackers_[new_tracker_id] = std::unique_ptr<dlib::correlation_tracker>(tracker);
-                    if (logger.debugEnabled()) {
-                        logger.debug("New tracker for " + std::to_string(new_tracker_id), padded_rectangle);
-                    }
+                    LOG_DEBUG("New face detected at ", face_rect);
+                    new_faces.push_back(face_rect);
                 }
             }
         }
 
+        handleNewFaces(work, frame, new_faces, matched_ids);
+
         // now we need to handle any leftover trackers that were not matched up with faces
         // set of all tracked local IDs
+        TRACE_SPAN("unmatched trackers");
         std::set<int> tracked_ids = extract_keys(trackers_);
         std::set<int> difference;
         std::set_difference(tracked_ids.begin(), tracked_ids.end(),
                             matched_ids.begin(), matched_ids.end(),
                             std::inserter(difference, difference.begin()));
-        if (logger.debugEnabled()) {
-            logger.debug("Found " + std::to_string(difference.size()) +
-                         " local IDS that are tracked but not detected: " +
-                         set_to_string(difference, ","));
-        }
+        LOG_DEBUG("Found " + std::to_string(difference.size()) +
+                  " local IDS that are tracked but not detected: " +
+                  set_to_string(difference, ","));
         for (int id : difference) {
-            personNotVisible(id);
+            // a face that was not searched for may still be there
+            dlib::rectangle tracker_rect = trackers_[id]->position();
+            cv::Point tracker_centre((int) (tracker_rect.left() + tracker_rect.width() / 2),
+                                     (int) (tracker_rect.top() + tracker_rect.height() / 2));
+            bool searched = search_regions.empty() ||
+                            std::any_of(search_regions.begin(), search_regions.end(),
+                                        [&](const cv::Rect &region) { return region.contains(tracker_centre); });
+            if (searched) {
+                personNotVisible(id);
+            }
+        }
+    }
+
+    evictUnknownPeople();
+
+    if (detection_controller_) {
+        double seconds = ((double) cv::getTickCount() - start_ticks) / cv::getTickFrequency();
+        detection_controller_->frameProcessed(seconds, full_scan, (int) trackers_.size(),
+                                              counters_.new_face_count_ - initial_new_face_count,
+                                              counters_.tracker_lost_count_ - initial_tracker_lost_count);
+        detector_frame_interval_ = detection_controller_->interval();
+        processing_scale_ = detection_controller_->scale();
+    }
+}
+
+void
+Manager::detectionBudget(BudgetType type, double target) {
+    if (target > 0) {
+        detection_controller_.reset(new DetectionController(type, target, detector_frame_interval_,
+                                                            processing_scale_));
+    } else {
+        detection_controller_.reset();
+    }
+}
+
+std::vector<cv::Rect>
+Manager::detectionRegions(const cv::Mat &frame, const std::vector<cv::Rect> &motion_regions) const {
+    if (!motion_region_detection_ || motion_regions.empty()) {
+        return std::vector<cv::Rect>();
+    }
+
+    // motion regions are in full size frame coordinates
+    std::vector<cv::Rect> scaled_regions;
+    for (const cv::Rect &region : motion_regions) {
+        scaled_regions.push_back(dlibRectangleToOpenCV(scaleRectangle(openCVRectToDlib(region), active_scale_)));
+    }
+    return searchRegions(frame, scaled_regions, DETECTION_REGION_PADDING);
+}
+
+// Windows around the trackers so that the faces being tracked can be found again without searching the whole frame
+std::vector<cv::Rect>
+Manager::trackerWindows(const cv::Mat &frame) const {
+    std::vector<cv::Rect> windows;
+    for (auto it = trackers_.begin(); it != trackers_.end(); ++it) {
+        windows.push_back(dlibRectangleToOpenCV(it->second->position()));
+    }
+    return searchRegions(frame, windows, TRACKER_WINDOW_PADDING);
+}
+
+/*
+ * Pad the areas to search, merge any that overlap so that no part of the frame is searched twice and faces
+ * aren't split between regions. Returns no regions if it would be cheaper to search the whole frame.
+ */
+std::vector<cv::Rect>
+Manager::searchRegions(const cv::Mat &frame, const std::vector<cv::Rect> &areas, double padding) const {
+    std::vector<cv::Rect> regions;
+    cv::Rect frame_rect(0, 0, frame.cols, frame.rows);
+    for (const cv::Rect &area : areas) {
+        int x_padding = std::max(DETECTION_REGION_MIN_PADDING, (int) (area.width * padding));
+        int y_padding = std::max(DETECTION_REGION_MIN_PADDING, (int) (area.height * padding));
+        x_padding = std::max(x_padding, (DETECTION_REGION_MIN_SIZE - area.width) / 2);
+        y_padding = std::max(y_padding, (DETECTION_REGION_MIN_SIZE - area.height) / 2);
+        cv::Rect padded(area.x - x_padding, area.y - y_padding,
+                        area.width + 2 * x_padding, area.height + 2 * y_padding);
+        padded &= frame_rect;
+        if (padded.area() > 0) {
+            regions.push_back(padded);
+        }
+    }
+
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = 0; i < regions.size() && !merged; ++i) {
+            for (size_t j = i + 1; j < regions.size(); ++j) {
+                if ((regions[i] & regions[j]).area() > 0) {
+                    regions[i] |= regions[j];
+                    regions.erase(regions.begin() + j);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    long long total_area = 0;
+    for (const cv::Rect &region : regions) {
+        total_area += region.area();
+    }
+    if (total_area > DETECTION_REGION_MAX_COVERAGE * frame_rect.area()) {
+        regions.clear();
+    }
+    return regions;
+}
+
+static std::vector<dlib::rectangle>
+detectFacesIn(FaceDetector &face_detector, const cv::Mat &image) {
+    if (1 == image.channels()) {
+        return face_detector.detectFaces(dlib::cv_image<unsigned char>(image));
+    }
+    return face_detector.detectFaces(dlib::cv_image<dlib::bgr_pixel>(image));
+}
+
+std::vector<dlib::rectangle>
+Manager::detectFaces(const cv::Mat &frame, const std::vector<cv::Rect> &regions) {
+    if (regions.empty()) {
+        return detectFacesIn(face_detector_, frame);
+    }
+
+    // crops share the frame's pixels, the detected faces are moved back to frame coordinates
+    std::vector<dlib::rectangle> faces;
+    for (const cv::Rect &region : regions) {
+        for (const dlib::rectangle &face : detectFacesIn(face_detector_, frame(region))) {
+            faces.push_back(dlib::translate_rect(face, region.x, region.y));
+        }
+        LOG_DEBUG("Searched motion region ", openCVRectToDlib(region));
+    }
+    return faces;
+}
+
+/*
+ * Work out who the newly detected faces belong to and start tracking them. A new face could be someone we've
+ * seen before but who has been off camera so we need to calculate a face descriptor and compare with descriptors
+ * we've seen before. The descriptors for all the new faces are calculated in a single batch which is much cheaper
+ * than running the DNN once for each face.
+ */
+void
+Manager::handleNewFaces(const cv::Mat &work, VideoFrame &frame, std::vector<dlib::rectangle> &new_faces,
+                        std::set<int> &matched_ids) {
+    if (new_faces.empty()) {
+        return;
+    }
+
+    TRACE_SPAN("new faces");
+    counters_.new_face_count_ += new_faces.size();
+
+    // the faces were found in the scaled frame but the face images are taken from the full size frame
+    std::vector<dlib::rectangle> frame_faces;
+    for (const dlib::rectangle &face_rect : new_faces) {
+        frame_faces.push_back(scaleRectangle(face_rect, 1.0 / active_scale_));
+    }
+    // this is the only place colour is needed so a luma frame is converted here, and only for frames with new faces
+    dlib::cv_image<dlib::bgr_pixel> image(frame.colour());
+    std::vector<FaceAnalysis> faces = face_detector_.analyseFaces(image, frame_faces);
+    face_detector_.computeFaceDescriptors(faces);
+
+    for (size_t i = 0; i < new_faces.size(); ++i) {
+        dlib::rectangle &face_rect = new_faces[i];
+        int64 search_ticks = cv::getTickCount();
+        std::shared_ptr<Person> known_person;
+        {
+            TRACE_SPAN("gallery search");
+            known_person = findPerson(faces[i].descriptor);
+        }
+        latencies_[LATENCY_GALLERY_SEARCH].recordSince(search_ticks);
+        int new_tracker_id = 0;
+        if (!known_person) {
+            // Person we have not seen before
+            auto person = handleNewPerson(faces[i]);
+            new_tracker_id = person->localId();
+
+        } else {
+            // Person we've seen before
+            new_tracker_id = known_person->localId();
+            personSeen(*known_person);
+        }
+        personVisible(new_tracker_id);
+        matched_ids.insert(new_tracker_id);
+
+        startTracker(work, new_tracker_id, face_rect);
+        ++counters_.tracker_start_count_;
+    }
+}
+
+// Start tracking a face, replacing any existing tracker for the person. Margins are in full size frame pixels.
+void
+Manager::startTracker(const cv::Mat &frame, int local_id, const dlib::rectangle &face_rect) {
+    TRACE_SPAN("start tracker", TRACE_CURRENT_FRAME, local_id);
+    long horizontal_margin = std::lround(tracker_horizontal_margin_ * active_scale_);
+    long vertical_margin = std::lround(tracker_vertical_margin_ * active_scale_);
+    dlib::rectangle padded_rectangle(face_rect.left() - horizontal_margin,
+                                     face_rect.top() - vertical_margin,
+                                     face_rect.right() + horizontal_margin,
+                                     face_rect.bottom() + vertical_margin);
+    std::unique_ptr<FaceTracker> tracker = faceTrackerFactory(tracker_type_);
+    tracker->start(frame, padded_rectangle);
+    trackers_[local_id] = std::move(tracker);
+    LOG_DEBUG("New tracker for " + std::to_string(local_id), padded_rectangle);
+}
+
+/*
+ * Update all the trackers with the new frame and dispose of any that have lost track of their face.
+ * The tracker updates are independent of each other so may be run concurrently, the results are then
+ * applied in local ID order so the outcome is the same as updating the trackers one at a time.
+ */
+void
+Manager::updateTrackers(const cv::Mat &frame) {
+    TRACE_SPAN("update trackers");
+    std::vector<int> tracker_ids;
+    std::vector<FaceTracker *> trackers;
+    for (auto it = trackers_.begin(); it != trackers_.end(); ++it) {
+        tracker_ids.push_back(it->first);
+        trackers.push_back(it->second.get());
+    }
+
+    std::vector<double> confidences(trackers.size());
+    int64 start_ticks = cv::getTickCount();
+    if (worker_pool_ && trackers.size() > 1) {
+        dlib::parallel_for(*worker_pool_, 0, trackers.size(), [&](long i) {
+            // the worker threads don't know which frame this is
+            TRACE_SPAN("update tracker", last_frame_, tracker_ids[i]);
+            confidences[i] = trackers[i]->update(frame);
+        });
+    } else {
+        for (size_t i = 0; i < trackers.size(); ++i) {
+            TRACE_SPAN("update tracker", TRACE_CURRENT_FRAME, tracker_ids[i]);
+            confidences[i] = trackers[i]->update(frame);
+        }
+    }
+    counters_.tracked_frame_count_ += trackers.size();
+    if (!trackers.empty()) {
+        latencies_[LATENCY_TRACKER_UPDATE].recordSince(start_ticks);
+    }
+
+    std::vector<int> low_confidence_trackers;
+    for (size_t i = 0; i < trackers.size(); ++i) {
+        auto tracked_person = findPerson(tracker_ids[i]);
+        tracked_person->boundingBox(scaleRectangle(trackers[i]->position(), 1.0 / active_scale_));
+        personSeen(*tracked_person);
+        LOG_DEBUG("Tracker for : " + std::to_string(tracker_ids[i]) + " has confidence " +
+                  std::to_string(confidences[i]));
+
+        if (confidences[i] < min_tracker_confidence_) {
+            low_confidence_trackers.push_back(tracker_ids[i]);
+        }
+    }
+
+    if (low_confidence_trackers.size() > 0) {
+        LOG_DEBUG(std::to_string(low_confidence_trackers.size()) + " trackers with confidence less than " +
+                  std::to_string(min_tracker_confidence_) + " to dispose of");
+        for (auto it = low_confidence_trackers.begin(); it != low_confidence_trackers.end(); ++it) {
+            trackers_.erase(*it);
         }
+        counters_.tracker_lost_count_ += low_confidence_trackers.size();
+    }
+}
+
+/*
+ * The processing scale has changed so restart the trackers on the newly scaled frame where they were
+ * in the previous frame.
+ */
+void
+Manager::rescaleTrackers(const cv::Mat &frame) {
+    TRACE_SPAN("rescale trackers");
+    double ratio = processing_scale_ / active_scale_;
+    for (auto it = trackers_.begin(); it != trackers_.end(); ++it) {
+        dlib::rectangle position = scaleRectangle(it->second->position(), ratio);
+        std::unique_ptr<FaceTracker> tracker = faceTrackerFactory(tracker_type_);
+        tracker->start(frame, position);
+        it->second = std::move(tracker);
+    }
+    LOG_DEBUG("Processing scale changed from " + std::to_string(active_scale_) + " to " +
+              std::to_string(processing_scale_) + ", restarted " + std::to_string(trackers_.size()) +
+              " trackers");
+    active_scale_ = processing_scale_;
+}
+
+void
+Manager::workerThreads(int num_threads) {
+    worker_threads_ = std::max(1, num_threads);
+    if (worker_threads_ > 1) {
+        worker_pool_.reset(new dlib::thread_pool(worker_threads_));
+    } else {
+        worker_pool_.reset();
     }
 }
 
@@ -236,17 +562,131 @@ Manager::isSameRegion(const dlib::rectangle &bb1, const dlib::rectangle &bb2) co
 // Find a person using a descriptor. Returns nullptr if no face found
 std::shared_ptr<Person>
 Manager::findPerson(const FaceDescriptor &descriptor) const {
-    for (const  auto item : people_) {
-        if (isSamePerson(descriptor, item.second->faceDescriptor())) {
-            return item.second;
+    GalleryMatch match = approximate_index_ ? approximate_index_->findNearest(descriptor, descriptor_threshold_)
+                                            : gallery_.findNearest(descriptor, descriptor_threshold_);
+    if (!match.found()) {
+        return nullptr;
+    }
+    return findPerson(match.local_id);
+}
+
+void
+Manager::rememberPerson(const std::shared_ptr<Person> &person) {
+    people_[person->localId()] = person;
+    person->lastSeenFrame(last_frame_);
+    if (person->externalId().empty()) {
+        unknown_lru_.push_front(person->localId());
+        unknown_lru_position_[person->localId()] = unknown_lru_.begin();
+    }
+    if (!gallery_.add(person->localId(), person->faceDescriptor())) {
+        logger.error("Face descriptor for local ID " + std::to_string(person->localId()) +
+                     " has " + std::to_string(person->faceDescriptor().size()) + " values, expected " +
+                     std::to_string(FACE_DESCRIPTOR_SIZE));
+        return;
+    }
+
+    size_t slot;
+    if (approximate_index_ && gallery_.findSlot(person->localId(), slot)) {
+        approximate_index_->insert(slot);
+    }
+}
+
+void
+Manager::personSeen(Person &person) {
+    person.lastSeenFrame(last_frame_);
+    auto it = unknown_lru_position_.find(person.localId());
+    if (it != unknown_lru_position_.end()) {
+        unknown_lru_.splice(unknown_lru_.begin(), unknown_lru_, it->second);
+    }
+}
+
+/*
+ * Visible people are seen every frame so they are always at the front of the LRU list and everyone that
+ * might need to be forgotten is at the back.
+ */
+void
+Manager::evictUnknownPeople() {
+    TRACE_SPAN("evict unknown people");
+    while (!unknown_lru_.empty()) {
+        int local_id = unknown_lru_.back();
+        std::shared_ptr<Person> person = findPerson(local_id);
+
+        // someone may have been given an external ID since they were first seen, they are no longer unknown
+        if (!person || !person->externalId().empty()) {
+            unknown_lru_position_.erase(local_id);
+            unknown_lru_.pop_back();
+            continue;
+        }
+
+        bool expired = (unknown_person_expiry_frames_ > 0) &&
+                       (last_frame_ - person->lastSeenFrame() > unknown_person_expiry_frames_);
+        bool over_capacity = (max_unknown_people_ > 0) && ((int) unknown_lru_.size() > max_unknown_people_);
+        if ((!expired && !over_capacity) || (trackers_.count(local_id) > 0)) {
+            break;
         }
+
+        LOG_DEBUG("Forgetting unknown person " + std::to_string(local_id) + " last seen in frame " +
+                  std::to_string(person->lastSeenFrame()));
+        forgetPerson(local_id);
+        if (expired) {
+            ++counters_.evicted_expired_count_;
+        } else {
+            ++counters_.evicted_capacity_count_;
+        }
+    }
+}
+
+// The gallery slot is reused by the next new person, the approximate index skips it until then
+void
+Manager::forgetPerson(int local_id) {
+    auto it = unknown_lru_position_.find(local_id);
+    if (it != unknown_lru_position_.end()) {
+        unknown_lru_.erase(it->second);
+        unknown_lru_position_.erase(it);
+    }
+    trackers_.erase(local_id);
+    gallery_.remove(local_id);
+    people_.erase(local_id);
+}
+
+size_t
+Manager::galleryMemoryUsage() const {
+    size_t bytes = gallery_.memoryUsage();
+    if (approximate_index_) {
+        bytes += approximate_index_->memoryUsage();
+    }
+    for (const auto &item : people_) {
+        const Person &person = *item.second;
+        bytes += sizeof(Person) + person.externalId().capacity() +
+                 person.faceDescriptor().size() * sizeof(float) + person.faceImageBytes();
+    }
+    bytes += people_.size() * 4 * sizeof(void *);
+    bytes += unknown_lru_.size() * (3 * sizeof(void *) + sizeof(int)) +
+             unknown_lru_position_.size() * (sizeof(int) + 3 * sizeof(void *));
+    return bytes;
+}
+
+void
+Manager::approximateSearch(bool enable) {
+    if (enable && !approximate_index_) {
+        approximate_index_.reset(new ApproximateFaceIndex(gallery_, approximate_index_params_));
+        approximate_index_->rebuild();
+    } else if (!enable) {
+        approximate_index_.reset();
+    }
+}
+
+void
+Manager::approximateSearchEf(int ef) {
+    approximate_index_params_.search_ef = std::max(1, ef);
+    if (approximate_index_) {
+        approximate_index_->searchEf(ef);
     }
-    return nullptr;
 }
 
 std::shared_ptr<Person>
 Manager::addPerson(const std::string &external_id, const std::string &face_filename) {
-    logger.debug("Add person " + external_id + " with file " + face_filename);
+    LOG_DEBUG("Add person " + external_id + " with file " + face_filename);
 
     // load image from file
     dlib::array2d<dlib::rgb_pixel> img;
@@ -263,13 +703,13 @@ Manager::addPerson(const std::string &external_id, const std::string &face_filen
 
     // extract face image
     dlib::rectangle face_box = face_bbs[0];
-    dlib::matrix<dlib::rgb_pixel> face_chip = face_detector_.extractFaceImage(img, face_box);
+    FaceAnalysis face = face_detector_.analyseFace(img, face_box);
 
     // get face descriptor - use jitter to make the descriptor more resistant to noise
-    FaceDescriptor descriptor = face_detector_.getFaceDescriptor(face_chip, true);
+    FaceDescriptor descriptor = face_detector_.getFaceDescriptor(face.chip, true);
 
     Image tmp_face_image; // convert from matrix to array2d
-    dlib::assign_image(tmp_face_image, face_chip);
+    dlib::assign_image(tmp_face_image, face.chip);
 
     // create person and store details in seen list
     // TODO calculate blur
@@ -279,10 +719,200 @@ Manager::addPerson(const std::string &external_id, const std::string &face_filen
     person->externalId(external_id);
 
     // Remember the person so we can identify them if seen
-    people_[person->localId()] = person;
+    rememberPerson(person);
     return person;
 }
 
+EnrolmentStats
+Manager::addPeople(const std::vector<std::pair<std::string, std::string>> &people) {
+    EnrolmentStats stats;
+    double start_ticks = (double) cv::getTickCount();
+
+    for (size_t group_start = 0; group_start < people.size(); group_start += ENROLMENT_GROUP_SIZE) {
+        size_t group_size = std::min(ENROLMENT_GROUP_SIZE, people.size() - group_start);
+
+        // load the images, detect the faces and extract the face chips concurrently
+        std::vector<dlib::array2d<dlib::rgb_pixel>> images(group_size);
+        std::vector<std::vector<FaceAnalysis>> faces(group_size);
+        std::vector<char> loaded(group_size, false);
+        parallelFor(group_size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                try {
+                    dlib::load_image(images[i], people[group_start + i].second);
+                    loaded[i] = true;
+                } catch (dlib::error &e) {
+                    // leave the image empty so no faces are found, the error is reported below
+                }
+            }
+            face_detector_.analyseImages(images, begin, end, faces);
+        });
+
+        // work out who can be enrolled, the counters and logger are only updated from this thread
+        std::vector<size_t> accepted;
+        int num_faces = 0;
+        long long num_pixels = 0;
+        for (size_t i = 0; i < group_size; ++i) {
+            const std::string &external_id = people[group_start + i].first;
+            const std::string &face_filename = people[group_start + i].second;
+            num_faces += faces[i].size();
+            num_pixels += (long long) images[i].nr() * images[i].nc();
+            if (!loaded[i]) {
+                logger.error("Unable to load " + face_filename + " for " + external_id);
+            } else if (1 != faces[i].size()) {
+                logger.error(std::to_string(faces[i].size()) + " faces detected for " +
+                             external_id + " in file " + face_filename + " needed 1");
+            } else {
+                accepted.push_back(i);
+                continue;
+            }
+            ++stats.failed_count_;
+        }
+        face_detector_.recordConcurrentWork(group_size, num_pixels, num_faces);
+        stats.image_count_ += group_size;
+        if (accepted.empty()) {
+            continue;
+        }
+
+        /*
+         * Generate the jittered face images concurrently and put them all through the DNN in one call so that
+         * its mini-batches are full. Each face has its own random number generator seeded from its position
+         * in the list so the descriptors don't depend on the number of threads.
+         */
+        std::vector<dlib::matrix<dlib::rgb_pixel>> crops(accepted.size() * FACE_JITTER_COUNT);
+        parallelFor(accepted.size(), [&](size_t begin, size_t end) {
+            for (size_t a = begin; a < end; ++a) {
+                dlib::rand rnd;
+                rnd.set_seed(std::to_string(group_start + accepted[a]));
+                auto jittered = FaceDetector::jitterFace(faces[accepted[a]][0].chip, rnd);
+                std::move(jittered.begin(), jittered.end(), crops.begin() + a * FACE_JITTER_COUNT);
+            }
+        });
+        std::vector<FaceDescriptor> descriptors = face_detector_.getFaceDescriptors(std::move(crops));
+
+        for (size_t a = 0; a < accepted.size(); ++a) {
+            const FaceAnalysis &face = faces[accepted[a]][0];
+            FaceDescriptor descriptor = dlib::mean(dlib::mat(descriptors.data() + a * FACE_JITTER_COUNT,
+                                                             FACE_JITTER_COUNT));
+            Image tmp_face_image;
+            dlib::assign_image(tmp_face_image, face.chip);
+            auto person = makePerson(face.bounds, tmp_face_image, 0, descriptor);
+            person->externalId(people[group_start + accepted[a]].first);
+            rememberPerson(person);
+            ++stats.new_person_count_;
+        }
+    }
+
+    stats.seconds_ = ((double) cv::getTickCount() - start_ticks) / cv::getTickFrequency();
+    LOG_INFO("Enrolled " + std::to_string(stats.new_person_count_) + " of " +
+             std::to_string(stats.image_count_) + " images at " +
+             std::to_string(stats.imagesPerSecond()) + " images per second");
+    return stats;
+}
+
+EnrolmentStats
+Manager::addPeople(const std::string &directory) {
+    std::vector<std::pair<std::string, std::string>> people;
+    DIR *dir = opendir(directory.c_str());
+    if (!dir) {
+        logger.error("Unable to read directory " + directory);
+        return EnrolmentStats();
+    }
+    while (struct dirent *entry = readdir(dir)) {
+        std::string filename = entry->d_name;
+        size_t dot = filename.rfind('.');
+        if ((std::string::npos == dot) || (0 == dot)) {
+            continue;
+        }
+        std::string extension = filename.substr(dot);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        for (const char *image_extension : ENROLMENT_IMAGE_EXTENSIONS) {
+            if (extension == image_extension) {
+                people.push_back(std::make_pair(filename.substr(0, dot), directory + "/" + filename));
+                break;
+            }
+        }
+    }
+    closedir(dir);
+
+    // directory order is arbitrary, sort so the local IDs are always the same
+    std::sort(people.begin(), people.end());
+    return addPeople(people);
+}
+
+void
+Manager::parallelFor(size_t count, const std::function<void(size_t, size_t)> &fn) {
+    if (worker_pool_ && count > 1) {
+        dlib::parallel_for_blocked(*worker_pool_, 0, count, [&](long begin, long end) {
+            fn(begin, end);
+        }, PARALLEL_CHUNKS_PER_THREAD);
+    } else if (count > 0) {
+        fn(0, count);
+    }
+}
+
+bool
+Manager::loadGallery(const std::string &filename) {
+    if (!people_.empty()) {
+        logger.error("Can't load gallery " + filename + " as " + std::to_string(people_.size()) +
+                     " people are already known");
+        return false;
+    }
+
+    std::shared_ptr<GalleryFile> file = GalleryFile::open(filename);
+    if (!file) {
+        return false;
+    }
+    if (!gallery_.adopt(file->descriptors(), file->localIds(), file->size(), file)) {
+        logger.error("Gallery file " + filename + " contains duplicate local IDs");
+        return false;
+    }
+
+    // descriptors are only in the gallery and face images are decoded from the file if they are needed
+    for (size_t i = 0; i < file->size(); ++i) {
+        auto person = std::make_shared<Person>(file->localId(i), file, i);
+        person->externalId(file->externalId(i));
+        people_[person->localId()] = person;
+        if (person->externalId().empty()) {
+            unknown_lru_.push_back(person->localId());
+            unknown_lru_position_[person->localId()] = std::prev(unknown_lru_.end());
+        }
+        last_local_id_ = std::max(last_local_id_, person->localId());
+    }
+
+    if (approximate_index_) {
+        approximate_index_->rebuild();
+    }
+    logger.info("Loaded " + std::to_string(file->size()) + " people from " + filename);
+    return true;
+}
+
+FaceDescriptor
+Manager::faceDescriptor(int local_id) const {
+    size_t slot;
+    if (!gallery_.findSlot(local_id, slot)) {
+        return FaceDescriptor();
+    }
+    return dlib::mat(gallery_.slotDescriptor(slot), FACE_DESCRIPTOR_SIZE);
+}
+
+bool
+Manager::saveGallery(const std::string &filename, bool include_chips) const {
+    std::vector<GalleryFileEntry> entries;
+    for (const auto &item : people_) {
+        const Person &person = *item.second;
+        // the gallery has the descriptors of people loaded from a gallery file as well as everyone else
+        size_t slot;
+        if (!gallery_.findSlot(person.localId(), slot)) {
+            logger.error("No face descriptor for local ID " + std::to_string(person.localId()) +
+                         ", not saved to " + filename);
+            continue;
+        }
+        entries.push_back(GalleryFileEntry{person.localId(), person.externalId(), gallery_.slotDescriptor(slot),
+                                           include_chips ? &person.faceImage() : nullptr});
+    }
+    return GalleryFile::write(filename, entries, include_chips);
+}
+
 
 /*
  * Find a person using a bounding box. Only checks for people that
@@ -323,38 +953,25 @@ Manager::findPerson(int local_id) const {
     }
 }
 
-FaceDescriptor
-Manager::getFaceDescriptor(const dlib::cv_image<dlib::bgr_pixel> &image,
-                           const dlib::rectangle &face_bounds,
-                           bool use_jitter) {
-    // These are the transformed and extracted faces
-    dlib::matrix<dlib::rgb_pixel> face = face_detector_.extractFaceImage(image, face_bounds);
-
-    /*
-     * This call asks the DNN to convert each face image in faces into a 128D vector.
-     * In this 128D vector space, images from the same person will be close to each other
-     * but vectors from different people will be far apart.  So we can use these vectors to
-     * identify if a pair of images are from the same person or from different people.
-     */
-    return face_detector_.getFaceDescriptor(face, use_jitter);
-}
-
+/*
+ * Add a person we have not seen before. The landmarks, face chip and descriptor already calculated
+ * when the face was detected are reused.
+ */
 std::shared_ptr<Person>
-Manager::handleNewPerson(dlib::cv_image<dlib::bgr_pixel> image,
-                         dlib::rectangle &rectangle) {
-    // These are the transformed and extracted faces
-    dlib::matrix<dlib::rgb_pixel> face = face_detector_.extractFaceImage(image, rectangle);
-
+Manager::handleNewPerson(const FaceAnalysis &face) {
     // TODO determine amount of blurriness
     double blur = 0;
 
-    FaceDescriptor face_descriptor = getFaceDescriptor(image, rectangle, use_jitter_);
+    // A jittered descriptor is more accurate but needs to be calculated separately
+    FaceDescriptor face_descriptor = use_jitter_ ? face_detector_.getFaceDescriptor(face.chip, true)
+                                                 : face.descriptor;
     Image tmp_face_image; // convert from matrix to array2d
-    dlib::assign_image(tmp_face_image, face);
+    dlib::assign_image(tmp_face_image, face.chip);
 
     // Put person on known list and currently visible list
-    auto person = makePerson(rectangle, tmp_face_image, blur, face_descriptor);
-    people_[person->localId()] = person;
+    auto person = makePerson(face.bounds, tmp_face_image, blur, face_descriptor);
+    rememberPerson(person);
+    ++counters_.new_person_count_;
     return person;
 }
 
@@ -365,6 +982,17 @@ Manager::makePerson(const dlib::rectangle &rectangle, const Image &face_image, d
 }
 
 void Manager::reset() {
+    // frame numbers start again, keep how long ago everyone was seen so unknown people still expire
+    for (auto &entry : people_) {
+        entry.second->lastSeenFrame(entry.second->lastSeenFrame() - last_frame_);
+    }
     last_frame_ = 0;
     trackers_.clear();
+
+    // a detection budget starts again from the interval and scale it was given
+    if (detection_controller_) {
+        detection_controller_->reset();
+        detector_frame_interval_ = detection_controller_->interval();
+        processing_scale_ = detection_controller_->scale();
+    }
 }
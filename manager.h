@@ -10,12 +10,26 @@
 #ifndef FINAL_PROJECT_MANAGER_H
 #define FINAL_PROJECT_MANAGER_H
 
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <map>
+#include <set>
+#include <unordered_map>
 #include <string>
 #include <memory>
 #include <dlib/dnn.h>
 #include <dlib/image_processing.h>
+#include <dlib/threads.h>
 
+#include "detectioncontroller.h"
 #include "facedetector.h"
+#include "facegallery.h"
+#include "galleryfile.h"
+#include "faceindex.h"
+#include "facetracker.h"
+#include "latencyhistogram.h"
+#include "videoframe.h"
 
 //  Note that in dlib there is no explicit image object, just a 2D array and
 // various pixel types. For readability we define an image type here.
@@ -31,6 +45,16 @@ public:
         dlib::assign_image(face_image_, face_image);
     }
 
+    /*
+     * A person loaded from a gallery file. Their descriptor is only kept in the manager's gallery and their face
+     * image, if the file has one, stays in the file until it is first asked for.
+     */
+    Person(int id, const std::shared_ptr<const GalleryFile> &file, size_t file_index)
+            : local_id_(id), face_blur_(0),
+              gallery_file_(file->hasChips() ? file : std::shared_ptr<const GalleryFile>()),
+              gallery_file_index_(file_index) {
+    }
+
     int localId() const {
         return local_id_;
     }
@@ -51,6 +75,7 @@ public:
         bounding_box_ = new_box;
     }
 
+    // Empty for people loaded from a gallery file, see Manager::faceDescriptor()
     const FaceDescriptor &faceDescriptor() const {
         return face_descriptor_;
     }
@@ -59,12 +84,23 @@ public:
         face_descriptor_ = new_descriptor;
     }
 
+    // Decoded from the gallery file the first time it is needed for people loaded from one
     const Image &faceImage() const {
+        if (gallery_file_) {
+            gallery_file_->chip(gallery_file_index_, face_image_);
+            gallery_file_.reset();
+        }
         return face_image_;
     }
 
     void faceImage(const Image &new_image) {
         dlib::assign_image(face_image_, new_image);
+        gallery_file_.reset();
+    }
+
+    // Memory used by the face image, not counting an image that is still in a gallery file
+    size_t faceImageBytes() const {
+        return face_image_.size() * sizeof(dlib::rgb_pixel);
     }
 
     double faceBlur() const {
@@ -87,6 +123,14 @@ public:
         return ++non_visible_frames_;
     }
 
+    int lastSeenFrame() const {
+        return last_seen_frame_;
+    }
+
+    void lastSeenFrame(int frame_no) {
+        last_seen_frame_ = frame_no;
+    }
+
 private:
     // Identifier local to this session that only applies within the current "session"
     int local_id_ = 0;
@@ -98,22 +142,93 @@ private:
     dlib::rectangle bounding_box_;
 
     // Image of the person's face as last seen
-    Image face_image_;
+    mutable Image face_image_;
 
     // Measure of the amount of blurring in the current face image
     double face_blur_;
 
     int non_visible_frames_ = 0;
 
+    // Frame in which the person was last tracked or detected
+    int last_seen_frame_ = 0;
+
     // Face descriptor used to determine if two faces are the same
     FaceDescriptor face_descriptor_;
+
+    // gallery file the face image hasn't been decoded from yet, null once it has or if there is no image
+    mutable std::shared_ptr<const GalleryFile> gallery_file_;
+    size_t gallery_file_index_ = 0;
+};
+
+
+// counters so we can easily check how much work the manager is doing
+struct ManagerCounters {
+public:
+    // detected faces that did not match an existing tracker
+    int new_face_count_ = 0;
+
+    // new faces that did not match anyone we have seen before
+    int new_person_count_ = 0;
+
+    // unknown people forgotten because there were too many or they had not been seen for too long
+    int evicted_capacity_count_ = 0;
+    int evicted_expired_count_ = 0;
+
+    // trackers started, trackers disposed of due to low confidence and the total number of frames tracked
+    int tracker_start_count_ = 0;
+    int tracker_lost_count_ = 0;
+    int tracked_frame_count_ = 0;
+
+    // searches of the whole frame (or motion regions), searches around the trackers and trackers restarted on a face
+    int full_scan_count_ = 0;
+    int window_scan_count_ = 0;
+    int reanchor_count_ = 0;
+
+    inline void reset() {
+        new_face_count_ = 0;
+        new_person_count_ = 0;
+        evicted_capacity_count_ = 0;
+        evicted_expired_count_ = 0;
+        tracker_start_count_ = 0;
+        tracker_lost_count_ = 0;
+        tracked_frame_count_ = 0;
+        full_scan_count_ = 0;
+        window_scan_count_ = 0;
+        reanchor_count_ = 0;
+    }
+
+    // mean number of frames a face is followed before the tracker is lost or the face is no longer detected
+    inline double meanTrackLength() const {
+        return (0 == tracker_start_count_) ? 0 : (double) tracked_frame_count_ / tracker_start_count_;
+    }
 };
 
+// Work done by a call to Manager::addPeople()
+struct EnrolmentStats {
+public:
+    // images read, including any that could not be used
+    int image_count_ = 0;
+
+    // images that could not be read or did not contain exactly one face
+    int failed_count_ = 0;
+
+    int new_person_count_ = 0;
+
+    double seconds_ = 0;
+
+    inline double imagesPerSecond() const {
+        return (seconds_ > 0) ? image_count_ / seconds_ : 0;
+    }
+};
+
+// Smallest frame scale the manager will use for detection and tracking
+double const MIN_PROCESSING_SCALE = 0.05;
 
 // Manages a list of tracked objects
 class Manager {
 public:
-    Manager(FaceDetector &face_detector) : face_detector_(face_detector) {
+    Manager(FaceDetector &face_detector, TrackerType tracker_type = TRACKER_CORRELATION)
+            : face_detector_(face_detector), tracker_type_(tracker_type) {
     }
 
     /*
@@ -123,6 +238,18 @@ public:
      */
     void newFrame(int frame_no, cv::Mat &frame);
 
+    /*
+     * As newFrame() but only look for new faces in and around the areas where motion was detected. If there are
+     * no regions the whole frame is searched. Trackers are only dropped when the area around them was searched.
+     */
+    void newFrame(int frame_no, cv::Mat &frame, const std::vector<cv::Rect> &motion_regions);
+
+    /*
+     * As newFrame() for a frame which may have been read as luma only. Faces are detected and tracked in the
+     * luma image and the frame is only converted to colour if there are new faces to analyse.
+     */
+    void newFrame(int frame_no, VideoFrame &frame, const std::vector<cv::Rect> &motion_regions);
+
     std::vector<std::shared_ptr<Person>> visiblePeople() const;
 
     int visibleCount() const;
@@ -140,7 +267,34 @@ public:
      */
     std::shared_ptr<Person> addPerson(const std::string &external_id, const std::string &face_filename);
 
-    // Find a person using a descriptor. Returns nullptr if no face found
+    /*
+     * Add many people at once, each image must contain exactly one face. Images are loaded and analysed on the
+     * worker threads and the jittered face images of several people are run through the DNN together.
+     * People are added in the order given so they get the same local IDs as if addPerson() had been called
+     * for each of them.
+     */
+    EnrolmentStats addPeople(const std::vector<std::pair<std::string, std::string>> &people);
+
+    // Add everyone in a directory of images, using each file name without its extension as the external ID
+    EnrolmentStats addPeople(const std::string &directory);
+
+    /*
+     * Load people from a gallery file written by saveGallery(). The file is memory mapped and its descriptors
+     * searched in place so no faces need to be analysed. Local IDs are kept so the manager must not already
+     * know about anyone. Returns false on error.
+     */
+    bool loadGallery(const std::string &filename);
+
+    /*
+     * Save everyone the manager knows about to a gallery file, optionally including their face images.
+     * Returns false on error.
+     */
+    bool saveGallery(const std::string &filename, bool include_chips) const;
+
+    /*
+     * Find the person whose face is closest to the descriptor. Returns nullptr if no face is
+     * closer than the descriptor threshold.
+     */
     std::shared_ptr<Person> findPerson(const FaceDescriptor &descriptor) const;
 
     /*
@@ -170,27 +324,195 @@ public:
     }
 
     /*
-     * Clear current state but not set of known people
+     * Adjust the detector interval and processing scale after every frame to keep within a budget of target
+     * frames per second (BUDGET_FPS) or seconds per frame (BUDGET_LATENCY). Starts from the current interval
+     * and never uses a larger scale than the current processing scale, which are both overridden while there
+     * is a budget. A target of 0 removes the budget leaving the interval and scale at their latest values.
+     */
+    void detectionBudget(BudgetType type, double target);
+
+    // null if there is no detection budget, can be used to change the range of intervals and scales
+    DetectionController *detectionController() const {
+        return detection_controller_.get();
+    }
+
+    /*
+     * get / set the scale of the frame used for face detection and tracking, between 0 and 1. Detection is
+     * much faster on a smaller frame, but faces must still be at least 80x80 pixels after scaling to be found.
+     * Face images are always taken from the full size frame and bounding boxes are always in full size frame
+     * coordinates. Can be changed at any time, the trackers are restarted at the new scale on the next frame.
+     */
+    double processingScale() const {
+        return processing_scale_;
+    }
+
+    void processingScale(double scale) {
+        processing_scale_ = std::min(1.0, std::max(MIN_PROCESSING_SCALE, scale));
+    }
+
+    /*
+     * get / set how often to look for the tracked faces in windows around the trackers between the runs of
+     * the detector over the whole frame. Matched trackers are restarted on the detected face so they don't
+     * drift. This is much cheaper than searching the whole frame so allows the full frame interval to be
+     * increased, since that is then only needed to find new faces. 0 (the default) disables this.
+     */
+    int trackerWindowInterval() const {
+        return tracker_window_interval_;
+    }
+
+    void trackerWindowInterval(int interval) {
+        tracker_window_interval_ = std::max(0, interval);
+    }
+
+    TrackerType trackerType() const {
+        return tracker_type_;
+    }
+
+    /*
+     * get / set whether the face detector should only search the areas of the frame where motion was
+     * detected. Only has an effect if the motion regions are passed to newFrame().
+     */
+    bool motionRegionDetection() const {
+        return motion_region_detection_;
+    }
+
+    void motionRegionDetection(bool enable) {
+        motion_region_detection_ = enable;
+    }
+
+    /*
+     * get / set whether to use an approximate nearest neighbour index when searching for a face.
+     * This is much faster for very large numbers of people but may occasionally miss a match.
+     */
+    bool approximateSearch() const {
+        return nullptr != approximate_index_;
+    }
+
+    void approximateSearch(bool enable);
+
+    /*
+     * get / set the number of candidates considered by the approximate search. Larger values
+     * give better recall at the cost of higher latency.
+     */
+    int approximateSearchEf() const {
+        return approximate_index_params_.search_ef;
+    }
+
+    void approximateSearchEf(int ef);
+
+    /*
+     * get / set the maximum number of unknown people (those without an external ID) to remember. When there are
+     * more the least recently seen are forgotten. People who are currently visible are never forgotten.
+     * 0 (the default) means no limit.
+     */
+    int maxUnknownPeople() const {
+        return max_unknown_people_;
+    }
+
+    void maxUnknownPeople(int max_people) {
+        max_unknown_people_ = std::max(0, max_people);
+    }
+
+    /*
+     * get / set the number of frames after which an unknown person who has not been seen is forgotten.
+     * 0 (the default) means never.
+     */
+    int unknownPersonExpiryFrames() const {
+        return unknown_person_expiry_frames_;
+    }
+
+    void unknownPersonExpiryFrames(int frames) {
+        unknown_person_expiry_frames_ = std::max(0, frames);
+    }
+
+    int unknownCount() const {
+        return unknown_lru_.size();
+    }
+
+    // Approximate number of bytes used to remember people, including their face images and the search structures
+    size_t galleryMemoryUsage() const;
+
+    // Copy of a person's face descriptor from the gallery, empty if they are not known
+    FaceDescriptor faceDescriptor(int local_id) const;
+
+    /*
+     * get / set the number of worker threads used to update the trackers concurrently.
+     * 1 (the default) updates the trackers on the calling thread.
+     */
+    int workerThreads() const {
+        return worker_threads_;
+    }
+
+    void workerThreads(int num_threads);
+
+    /*
+     * Clear current state but not set of known people. Frame numbers passed to newFrame() can start again from 0,
+     * the frames people were last seen in are adjusted to match. A detection budget goes back to the interval and
+     * scale it started with.
      */
     void reset();
 
+    // also clears the latency histograms
+    void resetCounters() {
+        counters_.reset();
+        latencies_.reset();
+    }
+
+    ManagerCounters getCounters() const {
+        return counters_;
+    }
+
+    /*
+     * Latency of updating all the trackers for a frame and of each gallery search for a new face. The face
+     * detector's own latencies cover detection and analysing the faces.
+     */
+    const StageLatencies &getLatencies() const {
+        return latencies_;
+    }
+
 private:
     void personVisible(int local_id);
 
     void personNotVisible(int local_id);
 
+    // Remember a person so that we can identify them when they are seen again
+    void rememberPerson(const std::shared_ptr<Person> &person);
+
+    // Record that a person was seen in the current frame
+    void personSeen(Person &person);
+
+    // Forget unknown people if there are too many or they have not been seen recently enough
+    void evictUnknownPeople();
+
+    void forgetPerson(int local_id);
+
+    void updateTrackers(const cv::Mat &frame);
+
     /*
-     * Compute a face descriptor from a face rectangle. Using jitter will compute a mean
-     * of multiple perturbed versions of the image (minor changes in position, rotation and left/right flip)
-     * which may give better recognition results but which is slower so we probably don't
-     * want to do this every time we are testing a potentially unknown face.
+     * Work out which parts of the frame the face detector should search. Returns no regions if the whole
+     * frame should be searched.
      */
-    FaceDescriptor getFaceDescriptor(const dlib::cv_image<dlib::bgr_pixel> &image,
-                                     const dlib::rectangle &face_bounds,
-                                     bool use_jitter);
+    std::vector<cv::Rect> detectionRegions(const cv::Mat &frame, const std::vector<cv::Rect> &motion_regions) const;
+
+    std::vector<cv::Rect> trackerWindows(const cv::Mat &frame) const;
+
+    std::vector<cv::Rect> searchRegions(const cv::Mat &frame, const std::vector<cv::Rect> &areas,
+                                        double padding) const;
+
+    void startTracker(const cv::Mat &frame, int local_id, const dlib::rectangle &face_rect);
+
+    void rescaleTrackers(const cv::Mat &frame);
+
+    // frame may be BGR or grey
+    std::vector<dlib::rectangle> detectFaces(const cv::Mat &frame, const std::vector<cv::Rect> &regions);
 
-    std::shared_ptr<Person> handleNewPerson(dlib::cv_image<dlib::bgr_pixel> image,
-                                            dlib::rectangle &rectangle);
+    void handleNewFaces(const cv::Mat &work, VideoFrame &frame, std::vector<dlib::rectangle> &new_faces,
+                        std::set<int> &matched_ids);
+
+    std::shared_ptr<Person> handleNewPerson(const FaceAnalysis &face);
+
+    // Run fn(begin, end) over [0, count) on the worker threads if there are any
+    void parallelFor(size_t count, const std::function<void(size_t, size_t)> &fn);
 
     std::shared_ptr<Person> makePerson(const dlib::rectangle &rectangle, const Image &face_image, double blur,
                                        const FaceDescriptor &face_descriptor);
@@ -201,8 +523,31 @@ private:
     // People who are known to the system. This "owns" the Person instances
     std::map<int, std::shared_ptr<Person>> people_;
 
+    // Descriptors of everyone in people_ stored so they can be searched quickly
+    FaceGallery gallery_;
+
+    // Optional index over gallery_, null when searching the whole gallery
+    ApproximateIndexParameters approximate_index_params_;
+    std::unique_ptr<ApproximateFaceIndex> approximate_index_;
+
+    /*
+     * Local IDs of the people without an external ID, most recently seen first, so that the ones to forget
+     * can be found without scanning everyone.
+     */
+    std::list<int> unknown_lru_;
+    std::unordered_map<int, std::list<int>::iterator> unknown_lru_position_;
+
+    // 0 for no limit
+    int max_unknown_people_ = 0;
+    int unknown_person_expiry_frames_ = 0;
+
     // Map local ID to the tracker currently tracking the object with this ID
-    std::map<int, std::unique_ptr<dlib::correlation_tracker>> trackers_;
+    std::map<int, std::unique_ptr<FaceTracker>> trackers_;
+
+    // Type of tracker created for each new face
+    TrackerType tracker_type_;
+
+    bool motion_region_detection_ = false;
 
     int last_frame_ = 0;
 
@@ -217,6 +562,7 @@ private:
     // TODO The slower the frame rate the lower the bounding box threshold needs to be as faces could have moved further between frames
     float bounding_box_threshold_ = 0.5;
 
+    // Trackers below this confidence are disposed of, see FaceTracker for the scale used
     double min_tracker_confidence_ = 7;
 
     // Margins around object (face) to use when instantiating a new tracker
@@ -225,6 +571,26 @@ private:
 
     // number of frames between each run of the face detector. 1 means every frame
     int detector_frame_interval_ = 5;
+
+    // number of frames between searching around the trackers, 0 to disable
+    int tracker_window_interval_ = 0;
+
+    // requested scale of the frame used for detection and tracking and the scale used by the current trackers
+    double processing_scale_ = 1.0;
+    double active_scale_ = 1.0;
+
+    // reused for each frame to avoid allocating a new image every time
+    cv::Mat scaled_frame_;
+
+    // adjusts detector_frame_interval_ and processing_scale_, null if there is no detection budget
+    std::unique_ptr<DetectionController> detection_controller_;
+
+    // Threads used to run independent work such as tracker updates concurrently, null if single threaded
+    int worker_threads_ = 1;
+    std::unique_ptr<dlib::thread_pool> worker_pool_;
+
+    ManagerCounters counters_;
+    StageLatencies latencies_;
 };
 
 #endif //FINAL_PROJECT_PERSON_H
@@ -8,7 +8,12 @@
  */
 
 #include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
+#include <malloc.h>
 #include <opencv2/opencv.hpp>
 #include <opencv2/objdetect.hpp>
 #include <opencv2/tracking.hpp>
@@ -18,6 +23,12 @@
 #include <dlib/image_processing/frontal_face_detector.h>
 
 #include "util.h"
+#include "demo-util.h"
+#include "facegallery.h"
+#include "faceindex.h"
+#include "imagelogfile.h"
+#include "imagelogger.h"
+#include "tracing.h"
 
 // TODO make the number of iterations configurable
 int const TEST_ITERATIONS = 10000;
@@ -29,6 +40,7 @@ int const THRESHOLD_MIN = 127;
 int const THRESHOLD_MAX = 255;
 
 int const MOTION_BLUR_KERNEL_SIZE = 21;
+int const MOTION_THRESH_MIN = 25;
 int const MOTION_DILATE_KERNEL_SIZE = 3;
 cv::Mat const MOTION_DILATE_STRUCTURING = cv::getStructuringElement(cv::MORPH_ELLIPSE,
                                                                     cv::Size(MOTION_DILATE_KERNEL_SIZE,
@@ -40,6 +52,118 @@ cv::Point const MOTION_DILATE_ANCHOR = cv::Point(-1, -1);
 int const MOTION_DILATE_ITERATIONS = 2;
 double const MOTION_ACCUMULATOR_WEIGHT = 0.5;
 
+// Same threshold as the manager uses to decide whether two faces are the same person
+float const GALLERY_MATCH_THRESHOLD = 0.6;
+
+// Gallery sizes to test and the approximate number of descriptor comparisons to make for each size
+int const GALLERY_SIZES[] = {100, 1000, 10000, 100000, 1000000};
+long const GALLERY_COMPARISONS = 10000000;
+int const GALLERY_MIN_ITERATIONS = 3;
+
+/*
+ * Approximate index recall test. Building the graph costs far more than a search so the largest gallery
+ * size is skipped to keep the run time reasonable.
+ */
+int const INDEX_MAX_GALLERY_SIZE = 100000;
+int const INDEX_QUERIES = 1000;
+int const INDEX_SEARCH_EFS[] = {10, 20, 40, 80, 160};
+
+// Noise added to each element of a known descriptor to simulate another image of the same person
+double const INDEX_QUERY_NOISE = 0.03;
+
+// Number of the oldest descriptors replaced to check the index still finds everyone after slots are reused
+int const INDEX_CHURN = 100;
+
+/*
+ * Motion detector allocation check. The detectors are given a few frames to size their buffers and then
+ * every allocation made while processing the rest is counted.
+ */
+int const ALLOCATION_WARM_UP_FRAMES = 5;
+int const ALLOCATION_TEST_FRAMES = 100;
+
+/*
+ * Most allocations a motion detector may make per frame once it is running. OpenCV's blur, morphology and contour
+ * functions make a few small ones for each call, an allocation per row or per pixel would be many more.
+ */
+int const ALLOCATION_LIMIT_PER_FRAME = 100;
+
+// Horizontal shift between the motion detector test frames so that the detectors see some motion
+int const MOTION_FRAME_SHIFT = 8;
+
+// Number of frames the fused frame difference detector is compared with the original one
+int const FUSED_COMPARISON_FRAMES = 20;
+
+// files written when timing debug image logging, removed afterwards. Few iterations as frames are large
+int const IMAGE_LOG_ITERATIONS = 50;
+std::string const IMAGE_LOG_TEST_PNG = "micro-benchmarks-image.png";
+std::string const IMAGE_LOG_TEST_FILE = "micro-benchmarks-images.fmlog";
+
+// trace written when timing spans with tracing enabled, removed afterwards
+std::string const TRACE_TEST_FILE = "micro-benchmarks-trace.json";
+
+/*
+ * Count heap allocations by replacing the allocation functions with wrappers around the glibc allocator.
+ * Allocations are only counted while count_allocations is set, from any thread as OpenCV may use a thread pool.
+ */
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+std::atomic<bool> count_allocations(false);
+std::atomic<long> allocation_count(0);
+std::atomic<size_t> largest_allocation(0);
+
+static void
+allocated(size_t size) {
+    if (count_allocations.load(std::memory_order_relaxed)) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        size_t largest = largest_allocation.load(std::memory_order_relaxed);
+        while ((size > largest) && !largest_allocation.compare_exchange_weak(largest, size)) {
+        }
+    }
+}
+
+extern "C" {
+void *malloc(size_t size) {
+    allocated(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocated(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocated(size);
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    allocated(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    allocated(size);
+    *ptr = __libc_memalign(alignment, size);
+    return (nullptr == *ptr) ? ENOMEM : 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    allocated(size);
+    return __libc_memalign(alignment, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+}
+
 dlib::frontal_face_detector face_detector = dlib::get_frontal_face_detector();
 
 dlib::shape_predictor landmark_detector;
@@ -148,6 +272,35 @@ cv::Rect2d opencv_tracker_roi_large;
 
 cv::Rect2d opencv_tracker_roi_small;
 
+// Gallery of face descriptors stored the way the manager originally stored them
+std::map<int, dlib::matrix<float, 0, 1>> gallery_map;
+
+FaceGallery gallery_simd;
+
+ApproximateFaceIndex gallery_index(gallery_simd);
+
+dlib::matrix<float, 0, 1> gallery_query;
+
+int gallery_match_result;
+
+// Test frames that differ by a small horizontal shift, so the motion detectors see some motion
+cv::Mat motion_frames[2];
+
+int motion_frame_index = 0;
+
+MotionDetector *frame_difference_detector;
+
+MotionDetector *fused_frame_difference_detector;
+
+TiledFrameDifferenceMotionDetector *tiled_frame_difference_detector;
+
+// detector timed by timed_detector_motion() for comparing float and fixed point detectors
+MotionDetector *timed_detector;
+
+long tiles_visited = 0;
+
+bool motion_result;
+
 // check cost of call via function pointer
 void no_op() {
 }
@@ -349,6 +502,348 @@ void opencv_medianflow_tracker_update_small() {
     medianflow_tracker_small->update(example_image, opencv_tracker_roi_small);
 }
 
+void frame_difference_detector_motion() {
+    motion_result = frame_difference_detector->detectMotion(motion_frames[++motion_frame_index % 2]);
+}
+
+void fused_frame_difference_detector_motion() {
+    motion_result = fused_frame_difference_detector->detectMotion(motion_frames[++motion_frame_index % 2]);
+}
+
+void timed_detector_motion() {
+    motion_result = timed_detector->detectMotion(motion_frames[++motion_frame_index % 2]);
+}
+
+// the motion frames as luma, as read by FrameReader in luma mode
+cv::Mat motion_luma_frames[2];
+
+void fused_frame_difference_detector_luma() {
+    motion_result = fused_frame_difference_detector->detectMotion(motion_luma_frames[++motion_frame_index % 2]);
+}
+
+void frame_difference_detector_still() {
+    motion_result = frame_difference_detector->detectMotion(motion_frames[0]);
+}
+
+void tiled_frame_difference_detector_motion() {
+    motion_result = tiled_frame_difference_detector->detectMotion(motion_frames[++motion_frame_index % 2]);
+    tiles_visited += tiled_frame_difference_detector->tilesVisited();
+}
+
+void tiled_frame_difference_detector_still() {
+    motion_result = tiled_frame_difference_detector->detectMotion(motion_frames[0]);
+    tiles_visited += tiled_frame_difference_detector->tilesVisited();
+}
+
+// Original manager search, linear scan of a map stopping at the first descriptor under the threshold
+void gallery_map_scan() {
+    gallery_match_result = NO_LOCAL_ID;
+    for (const auto &item : gallery_map) {
+        if (dlib::length(gallery_query - item.second) < GALLERY_MATCH_THRESHOLD) {
+            gallery_match_result = item.first;
+            break;
+        }
+    }
+}
+
+// Search of the contiguous gallery, always finds the best match
+void gallery_simd_scan() {
+    gallery_match_result = gallery_simd.findNearest(gallery_query, GALLERY_MATCH_THRESHOLD).local_id;
+}
+
+// Descriptors from the face recognition DNN have roughly unit length
+dlib::matrix<float, 0, 1> random_descriptor(dlib::rand &rnd) {
+    dlib::matrix<float, 0, 1> descriptor(FACE_DESCRIPTOR_SIZE);
+    for (long i = 0; i < descriptor.size(); ++i) {
+        descriptor(i) = rnd.get_random_gaussian();
+    }
+    return descriptor / dlib::length(descriptor);
+}
+
+/*
+ * Compare the approximate index with an exact search of the gallery. The queries are noisy copies of descriptors
+ * in the gallery, recall@1 is the proportion of the queries matched by the exact search for which the index
+ * returns the same person. The index can only return descriptors within the threshold so it never matches a
+ * query the exact search doesn't.
+ */
+void gallery_index_recall(dlib::rand &rnd, const std::string &label) {
+    std::vector<dlib::matrix<float, 0, 1>> queries;
+    for (int i = 0; i < INDEX_QUERIES; ++i) {
+        size_t slot = rnd.get_random_64bit_number() % gallery_simd.slotCount();
+        dlib::matrix<float, 0, 1> query(FACE_DESCRIPTOR_SIZE);
+        for (long j = 0; j < query.size(); ++j) {
+            query(j) = gallery_simd.slotDescriptor(slot)[j] + INDEX_QUERY_NOISE * rnd.get_random_gaussian();
+        }
+        queries.push_back(query);
+    }
+
+    std::vector<int> expected;
+    double start_time = (double) cv::getTickCount();
+    for (const auto &query : queries) {
+        expected.push_back(gallery_simd.findNearest(query, GALLERY_MATCH_THRESHOLD).local_id);
+    }
+    double exact_time = ((double) cv::getTickCount() - start_time) / (cv::getTickFrequency() * queries.size());
+    long matched_queries = std::count_if(expected.begin(), expected.end(),
+                                         [](int local_id) { return NO_LOCAL_ID != local_id; });
+
+    std::cout << "Approximate index (" << label << ") : " << gallery_index.memoryUsage()
+              << " bytes, exact search " << exact_time << " seconds" << std::endl;
+    for (int ef : INDEX_SEARCH_EFS) {
+        gallery_index.searchEf(ef);
+        std::vector<GalleryMatch> matches;
+        start_time = (double) cv::getTickCount();
+        for (const auto &query : queries) {
+            matches.push_back(gallery_index.findNearest(query, GALLERY_MATCH_THRESHOLD));
+        }
+        double search_time = ((double) cv::getTickCount() - start_time) / (cv::getTickFrequency() * queries.size());
+
+        // queries the exact search doesn't match would agree whenever the index finds nothing, so aren't counted
+        int agreed = 0;
+        for (size_t i = 0; i < queries.size(); ++i) {
+            if ((NO_LOCAL_ID != expected[i]) && (expected[i] == matches[i].local_id)) {
+                ++agreed;
+            }
+        }
+        std::cout << "Approximate index (" << label << ", ef " << ef << ") : recall@1 "
+                  << ((0 == matched_queries) ? 0.0 : (double) agreed / matched_queries) << " of "
+                  << matched_queries << " matched queries, " << search_time << " seconds" << std::endl;
+    }
+}
+
+/*
+ * Replace the oldest descriptors in the gallery with new ones, as the manager does when it forgets unknown
+ * people, so the gallery reuses their slots and the index has to link them in again.
+ */
+void gallery_index_churn(dlib::rand &rnd, int gallery_size) {
+    int churn = std::min(INDEX_CHURN, gallery_size);
+    for (int local_id = 1; local_id <= churn; ++local_id) {
+        gallery_simd.remove(local_id);
+    }
+
+    double start_time = (double) cv::getTickCount();
+    for (int local_id = 1; local_id <= churn; ++local_id) {
+        dlib::matrix<float, 0, 1> descriptor = random_descriptor(rnd);
+        gallery_map[local_id] = descriptor;
+        gallery_simd.add(local_id, descriptor);
+        size_t slot;
+        if (gallery_simd.findSlot(local_id, slot)) {
+            gallery_index.insert(slot);
+        }
+    }
+    double insert_time = ((double) cv::getTickCount() - start_time) / (cv::getTickFrequency() * churn);
+
+    std::string size_text = std::to_string(gallery_size);
+    std::cout << "Approximate index (" << size_text << ") : " << churn << " slots reused, " << insert_time
+              << " seconds per insert" << std::endl;
+    gallery_index_recall(rnd, size_text + " after reuse");
+}
+
+/*
+ * Count the allocations made by a motion detector once it has warmed up. The detectors keep all their working
+ * images between frames so none of the allocations should be as large as a working image, any that remain are
+ * made inside OpenCV (e.g. the filter objects created by GaussianBlur, erode and dilate and the storage used by
+ * findContours). Returns false if an allocation is as large as the detector's grey working image or there are
+ * more than ALLOCATION_LIMIT_PER_FRAME allocations per frame.
+ */
+bool motion_detector_allocations(MotionMethod method) {
+    MotionDetector *detector = motionDetectorFactory(method);
+    for (int i = 0; i < detector->numInitFrames(); ++i) {
+        detector->initFrame(motion_frames[i % 2]);
+    }
+
+    // detect regions as well so the contour vectors reach their steady state size
+    std::vector<cv::Rect> regions;
+    for (int i = 0; i < ALLOCATION_WARM_UP_FRAMES; ++i) {
+        detector->detectMotion(motion_frames[i % 2]);
+        detector->detectMotionRegions(motion_frames[(i + 1) % 2], regions);
+    }
+
+    allocation_count = 0;
+    largest_allocation = 0;
+    count_allocations = true;
+    for (int i = 0; i < ALLOCATION_TEST_FRAMES; ++i) {
+        detector->detectMotion(motion_frames[i % 2]);
+        detector->detectMotionRegions(motion_frames[(i + 1) % 2], regions);
+    }
+    count_allocations = false;
+    delete detector;
+
+    // the detectors resize frames to MOTION_WIDTH, the smallest working image is the 8 bit grey one
+    int working_rows = (int) std::round(motion_frames[0].rows * MOTION_WIDTH / (double) motion_frames[0].cols);
+    size_t image_bytes = (size_t) MOTION_WIDTH * working_rows;
+    double per_frame = (double) allocation_count / (2 * ALLOCATION_TEST_FRAMES);
+    bool small = largest_allocation < image_bytes;
+    bool few = per_frame <= ALLOCATION_LIMIT_PER_FRAME;
+    std::cout << "Motion detector allocations (" << motionMethodToString(method) << ") : " << per_frame
+              << " per frame, largest " << largest_allocation << " bytes"
+              << (small ? "" : " FAILED image sized allocation") << (few ? "" : " FAILED too many allocations")
+              << std::endl;
+    return small && few;
+}
+
+/*
+ * Check that the fused frame difference detector gives exactly the same results as the original. OpenCV may use
+ * a different greyscale conversion if it was built with IPP, in which case the results can differ slightly.
+ */
+bool fused_frame_difference_matches() {
+    cv::Mat grey;
+    cv::cvtColor(example_image, grey, cv::COLOR_BGR2GRAY);
+    cv::Mat fused_grey(example_image.size(), CV_8UC1);
+    fusedGreyscale(example_image.data, example_image.step, fused_grey.data, fused_grey.step, example_image.cols,
+                   example_image.rows);
+    int grey_differences = cv::countNonZero(grey != fused_grey);
+
+    MotionDetector *original = motionDetectorFactory(MOTION_DIFF);
+    MotionDetector *fused = motionDetectorFactory(MOTION_DIFF_FUSED);
+    for (int i = 0; i < original->numInitFrames(); ++i) {
+        original->initFrame(motion_frames[i % 2]);
+        fused->initFrame(motion_frames[i % 2]);
+    }
+
+    // alternate between the same frame and a shifted one so there are frames with and without motion
+    int motion_differences = 0;
+    std::vector<cv::Rect> original_regions;
+    std::vector<cv::Rect> fused_regions;
+    for (int i = 0; i < FUSED_COMPARISON_FRAMES; ++i) {
+        const cv::Mat &frame = motion_frames[(i / 2) % 2];
+        bool original_moved = original->detectMotionRegions(frame, original_regions);
+        bool fused_moved = fused->detectMotionRegions(frame, fused_regions);
+        if ((original_moved != fused_moved) || (original_regions != fused_regions)) {
+            ++motion_differences;
+        }
+    }
+    delete original;
+    delete fused;
+
+    std::cout << "Fused frame difference (" << FusedFrameDifference::kernelName() << ") : " << grey_differences
+              << " greyscale pixels and " << motion_differences << " of " << FUSED_COMPARISON_FRAMES
+              << " frames differ from cvtColor and DIFF" << std::endl;
+    return (0 == grey_differences) && (0 == motion_differences);
+}
+
+// Changed pixels counted by the fused kernel run on each tile with a new kernel, so nothing is carried between tiles
+long tiled_reference_count(const cv::Mat &prev, const cv::Mat &current, const cv::Mat &next) {
+    cv::Mat scratch(next.size(), CV_8UC1);
+    cv::Rect frame_rect(0, 0, next.cols, next.rows);
+    long count = 0;
+    for (int y = 0; y < next.rows; y += MOTION_TILE_SIZE) {
+        for (int x = 0; x < next.cols; x += MOTION_TILE_SIZE) {
+            cv::Rect area = cv::Rect(x, y, MOTION_TILE_SIZE, MOTION_TILE_SIZE) & frame_rect;
+            FusedFrameDifference kernel;
+            count += kernel.apply(next.ptr(area.y) + area.x, next.step, 1, prev.ptr(area.y) + area.x,
+                                  current.ptr(area.y) + area.x, scratch.ptr(area.y) + area.x, scratch.step,
+                                  nullptr, 0, area.width, area.height, MOTION_THRESH_MIN);
+        }
+    }
+    return count;
+}
+
+/*
+ * Check that the tiled frame difference detector counts the same changed pixels as the fused kernel run on each
+ * tile separately and finds motion in the same frames as DIFF_FUSED. The frames are cropped so that their width is
+ * not a multiple of the tile size, so the right hand tiles are narrower than the rest.
+ */
+bool tiled_frame_difference_matches() {
+    int width = motion_frames[0].cols;
+    if (0 == width % MOTION_TILE_SIZE) {
+        --width;
+    }
+    cv::Rect crop(0, 0, width, motion_frames[0].rows);
+    cv::Mat frames[2];
+    cv::Mat greys[2];
+    for (int i = 0; i < 2; ++i) {
+        frames[i] = motion_frames[i](crop).clone();
+        greys[i].create(frames[i].size(), CV_8UC1);
+        fusedGreyscale(frames[i].data, frames[i].step, greys[i].data, greys[i].step, frames[i].cols,
+                       frames[i].rows);
+    }
+
+    // the frames are used at their own size
+    TiledFrameDifferenceMotionDetector tiled(0, MOTION_DIFF_THRESHOLD);
+    FusedFrameDifferenceMotionDetector fused(0, MOTION_DIFF_THRESHOLD);
+    std::vector<int> history = {0, 1};
+    for (int i : history) {
+        tiled.initFrame(frames[i]);
+        fused.initFrame(frames[i]);
+    }
+
+    // alternate between the same frame and a shifted one so there are frames with and without motion
+    int count_differences = 0;
+    int motion_differences = 0;
+    std::vector<cv::Rect> regions;
+    for (int i = 0; i < FUSED_COMPARISON_FRAMES; ++i) {
+        history.push_back((i / 2) % 2);
+        const cv::Mat &frame = frames[history.back()];
+        bool tiled_moved = tiled.detectMotionRegions(frame, regions);
+        bool fused_moved = fused.detectMotion(frame);
+        long expected = tiled_reference_count(greys[history[i]], greys[history[i + 1]], greys[history[i + 2]]);
+        if (tiled.changedPixels() != expected) {
+            ++count_differences;
+        }
+        if (tiled_moved != fused_moved) {
+            ++motion_differences;
+        }
+    }
+
+    std::cout << "Tiled frame difference (" << width << " pixels wide) : " << count_differences << " of "
+              << FUSED_COMPARISON_FRAMES << " frames have different counts to separate tiles and "
+              << motion_differences << " different motion to DIFF_FUSED" << std::endl;
+    return (0 == count_differences) && (0 == motion_differences);
+}
+
+// Debug images as ImageLogger writes them, one PNG per image or appended to an image log file
+cv::Mat image_log_image;
+ImageLogWriter image_log_writer;
+int image_log_seq = 0;
+
+void write_image_png() {
+    cv::imwrite(IMAGE_LOG_TEST_PNG, image_log_image);
+}
+
+void append_image_log() {
+    image_log_writer.append(0, ++image_log_seq, "benchmark", image_log_image);
+}
+
+// A typical manager debug message, timed with logging disabled to see what building the message costs
+int log_message_id = 0;
+
+void eager_disabled_log() {
+    logger.debug("Tracker for : " + std::to_string(++log_message_id) + " has confidence " + std::to_string(0.5));
+}
+
+void lazy_disabled_log() {
+    LOG_DEBUG("Tracker for : " + std::to_string(++log_message_id) + " has confidence " + std::to_string(0.5));
+}
+
+// A span around a trivial operation, timed with tracing disabled and enabled to see what a span costs
+int traced_value = 0;
+
+void trace_span() {
+    TRACE_SPAN("benchmark", traced_value, traced_value);
+    ++traced_value;
+}
+
+// Returns true if every image appended to the image log file reads back unchanged
+bool image_log_matches(const std::vector<cv::Mat> &images) {
+    ImageLogReader reader;
+    if (!reader.open(IMAGE_LOG_TEST_FILE) || (reader.records().size() != images.size())) {
+        std::cout << "Image log file: could not read back " << images.size() << " images " << reader.error()
+                  << std::endl;
+        return false;
+    }
+    int differences = 0;
+    cv::Mat image;
+    for (size_t i = 0; i < images.size(); ++i) {
+        if (!reader.read(reader.records()[i], image) || (image.size() != images[i].size()) ||
+            (image.type() != images[i].type()) || (0 != cv::norm(image, images[i], cv::NORM_INF))) {
+            ++differences;
+        }
+    }
+    std::cout << "Image log file: " << differences << " of " << images.size() << " images differ when read back"
+              << std::endl;
+    return 0 == differences;
+}
+
 /*
  * Time an operation specified via a function pointer.
  * We assume that that the time taken to call the function whilst non-zero is small enough to
@@ -495,6 +990,115 @@ int main(int argc, char **argv) {
     timer(TEST_ITERATIONS, convert_dlib_large, "Convert image to dlib (large)");
     timer(TEST_ITERATIONS, convert_dlib_small, "Convert image to dlib (small)");
 
+    motion_frames[0] = example_image;
+    cv::Mat shift = (cv::Mat_<double>(2, 3) << 1, 0, MOTION_FRAME_SHIFT, 0, 1, 0);
+    cv::warpAffine(example_image, motion_frames[1], shift, example_image.size());
+
+    frame_difference_detector = motionDetectorFactory(MOTION_DIFF);
+    fused_frame_difference_detector = motionDetectorFactory(MOTION_DIFF_FUSED);
+    for (int i = 0; i < 2; ++i) {
+        frame_difference_detector->initFrame(motion_frames[i]);
+        fused_frame_difference_detector->initFrame(motion_frames[i]);
+    }
+    timer(TEST_ITERATIONS, frame_difference_detector_motion, "Frame difference motion detector");
+    timer(TEST_ITERATIONS, fused_frame_difference_detector_motion, "Fused frame difference motion detector");
+
+    // reading frames as luma saves the greyscale conversion
+    for (int i = 0; i < 2; ++i) {
+        cv::cvtColor(motion_frames[i], motion_luma_frames[i], cv::COLOR_BGR2GRAY);
+    }
+    delete fused_frame_difference_detector;
+    fused_frame_difference_detector = motionDetectorFactory(MOTION_DIFF_FUSED);
+    for (int i = 0; i < 2; ++i) {
+        fused_frame_difference_detector->initFrame(motion_luma_frames[i]);
+    }
+    timer(TEST_ITERATIONS, fused_frame_difference_detector_luma, "Fused frame difference motion detector (luma)");
+
+    // the tiled detector should stop early on frames with motion and cost about the same as a full scan without
+    tiled_frame_difference_detector = new TiledFrameDifferenceMotionDetector(MOTION_WIDTH, MOTION_DIFF_THRESHOLD);
+    for (int i = 0; i < 2; ++i) {
+        tiled_frame_difference_detector->initFrame(motion_frames[i]);
+    }
+    timer(TEST_ITERATIONS, tiled_frame_difference_detector_motion, "Tiled frame difference motion detector");
+    std::cout << "Tiled frame difference: " << (double) tiles_visited / TEST_ITERATIONS << " of "
+              << tiled_frame_difference_detector->tileCount() << " tiles visited per frame with motion" << std::endl;
+    timer(TEST_ITERATIONS, frame_difference_detector_still, "Frame difference motion detector (no motion)");
+    tiles_visited = 0;
+    timer(TEST_ITERATIONS, tiled_frame_difference_detector_still, "Tiled frame difference motion detector (no motion)");
+    std::cout << "Tiled frame difference: " << (double) tiles_visited / TEST_ITERATIONS << " of "
+              << tiled_frame_difference_detector->tileCount() << " tiles visited per frame without motion" << std::endl;
+
+    // the fixed point detectors keep an 8 bit running average instead of a float one
+    MotionMethod accumulator_methods[] = {MOTION_CONTOURS, MOTION_CONTOURS_FIXED, MOTION_MSE, MOTION_MSE_FIXED,
+                                          MOTION_MSE_WITH_BLUR, MOTION_MSE_WITH_BLUR_FIXED, MOTION_BACKGROUND};
+    for (const MotionMethod method : accumulator_methods) {
+        timed_detector = motionDetectorFactory(method);
+        for (int i = 0; i < timed_detector->numInitFrames(); ++i) {
+            timed_detector->initFrame(motion_frames[i % 2]);
+        }
+        std::string title = motionMethodToString(method) + " motion detector";
+        timer(TEST_ITERATIONS, timed_detector_motion, title.c_str());
+        delete timed_detector;
+    }
+
+    int result = fused_frame_difference_matches() ? 0 : 1;
+    if (!tiled_frame_difference_matches()) {
+        result = 1;
+    }
+    MotionMethod motion_methods[] = {MOTION_CONTOURS, MOTION_MSE, MOTION_MSE_WITH_BLUR, MOTION_DIFF,
+                                     MOTION_DIFF_WITH_BLUR, MOTION_DIFF_FUSED, MOTION_DIFF_TILED,
+                                     MOTION_CONTOURS_FIXED, MOTION_MSE_FIXED, MOTION_MSE_WITH_BLUR_FIXED,
+                                     MOTION_BACKGROUND};
+    for (const MotionMethod method : motion_methods) {
+        if (!motion_detector_allocations(method)) {
+            result = 1;
+        }
+    }
+
+    /*
+     * Debug image logging, a colour frame and a motion mask are the most common images. The image log file
+     * is written once with and once without run length encoding, and checked after each.
+     */
+    std::vector<cv::Mat> logged_images = {example_image, example_binary};
+    std::vector<std::string> logged_names = {"frame", "mask"};
+    for (size_t i = 0; i < logged_images.size(); ++i) {
+        image_log_image = logged_images[i];
+        timer(IMAGE_LOG_ITERATIONS, write_image_png, ("Log image as PNG (" + logged_names[i] + ")").c_str());
+    }
+    std::remove(IMAGE_LOG_TEST_PNG.c_str());
+    for (bool compress : {false, true}) {
+        if (!image_log_writer.open(IMAGE_LOG_TEST_FILE, compress, false)) {
+            result = 1;
+            continue;
+        }
+        std::vector<cv::Mat> appended;
+        for (size_t i = 0; i < logged_images.size(); ++i) {
+            image_log_image = logged_images[i];
+            timer(IMAGE_LOG_ITERATIONS, append_image_log,
+                  ("Log image to image log file" + std::string(compress ? " with RLE (" : " (") + logged_names[i] +
+                   ")").c_str());
+            appended.insert(appended.end(), IMAGE_LOG_ITERATIONS, logged_images[i]);
+        }
+        image_log_writer.close();
+        if (!image_log_matches(appended)) {
+            result = 1;
+        }
+    }
+    std::remove(IMAGE_LOG_TEST_FILE.c_str());
+
+    logger.enable(false);
+    timer(TEST_ITERATIONS, eager_disabled_log, "Disabled debug message");
+    timer(TEST_ITERATIONS, lazy_disabled_log, "Disabled debug message (LOG_DEBUG)");
+    logger.enable(true);
+
+    timer(TEST_ITERATIONS, trace_span, "Trace span (tracing disabled)");
+    tracer.start();
+    timer(TEST_ITERATIONS, trace_span, "Trace span (tracing enabled)");
+    if (!tracer.stop(TRACE_TEST_FILE)) {
+        result = 1;
+    }
+    std::remove(TRACE_TEST_FILE.c_str());
+
     timer(TEST_ITERATIONS, face_landmarks_large, "Face landmarks (large)");
     if (do_small_face_tests) {
         timer(TEST_ITERATIONS, face_landmarks_small, "Face landmarks (small)");
@@ -526,5 +1130,41 @@ int main(int argc, char **argv) {
     timer(TEST_SLOW_ITERATIONS, detect_faces_opencv_large, "OpenCV detect faces (large)");
     timer(TEST_SLOW_ITERATIONS, detect_faces_opencv_small, "OpenCV detect faces (small)");
 
-    return 0;
+    /*
+     * Face search. Random descriptors are almost never within the threshold of each other so both
+     * methods end up comparing the query with every descriptor in the gallery.
+     */
+    std::cout << "Gallery search using " << FaceGallery::kernelName() << " kernel" << std::endl;
+    dlib::rand rnd;
+    gallery_query = random_descriptor(rnd);
+    double index_build_time = 0;
+    for (int gallery_size : GALLERY_SIZES) {
+        bool use_index = gallery_size <= INDEX_MAX_GALLERY_SIZE;
+        while ((int) gallery_map.size() < gallery_size) {
+            int local_id = gallery_map.size() + 1;
+            dlib::matrix<float, 0, 1> descriptor = random_descriptor(rnd);
+            gallery_map[local_id] = descriptor;
+            gallery_simd.add(local_id, descriptor);
+
+            // the index is built incrementally as the manager would when it sees new people
+            size_t slot;
+            if (use_index && gallery_simd.findSlot(local_id, slot)) {
+                double start_time = (double) cv::getTickCount();
+                gallery_index.insert(slot);
+                index_build_time += ((double) cv::getTickCount() - start_time) / cv::getTickFrequency();
+            }
+        }
+        int iterations = std::max((long) GALLERY_MIN_ITERATIONS, GALLERY_COMPARISONS / gallery_size);
+        std::string size_text = std::to_string(gallery_size);
+        timer(iterations, gallery_map_scan, ("Gallery map scan (" + size_text + ")").c_str());
+        timer(iterations, gallery_simd_scan, ("Gallery SIMD scan (" + size_text + ")").c_str());
+        if (use_index) {
+            std::cout << "Approximate index (" << size_text << ") : built in " << index_build_time << " seconds"
+                      << std::endl;
+            gallery_index_recall(rnd, size_text);
+            gallery_index_churn(rnd, gallery_size);
+        }
+    }
+
+    return result;
 }
@@ -11,6 +11,8 @@
 #include "motiondetector.h"
 
 #include <stdlib.h>
+#include <algorithm>
+#include <cmath>
 
 int const MOTION_BLUR_KERNEL_SIZE = 21;
 int const MOTION_THRESH_MIN = 25;
@@ -26,120 +28,232 @@ cv::Point const MOTION_DILATE_ANCHOR = cv::Point(-1, -1);
 int const MOTION_DILATE_ITERATIONS = 2;
 double const MOTION_ACCUMULATOR_WEIGHT = 0.5;
 
-cv::Mat
-resizeToWidth(cv::Mat src, int width) {
-    cv::Mat dest;
+// The fixed point running average uses a weight of 1 / 2^shift, the same as MOTION_ACCUMULATOR_WEIGHT
+int const MOTION_ACCUMULATOR_SHIFT = 1;
+
+/*
+ * Background model constants. Means have BACKGROUND_MEAN_BITS fractional bits, variances BACKGROUND_VARIANCE_BITS
+ * and weights are fractions of 65536. The model learns at a rate of 1 / 2^shift, roughly the last 32 frames.
+ */
+int const BACKGROUND_MEAN_BITS = 8;
+int const BACKGROUND_VARIANCE_BITS = 4;
+int const BACKGROUND_LEARNING_SHIFT = 5;
+int const BACKGROUND_MAX_WEIGHT = 0xffff;
+int const BACKGROUND_INITIAL_VARIANCE = 225 << BACKGROUND_VARIANCE_BITS;
+int const BACKGROUND_MIN_VARIANCE = 16 << BACKGROUND_VARIANCE_BITS;
+int const BACKGROUND_MAX_VARIANCE = 900 << BACKGROUND_VARIANCE_BITS;
+
+// A pixel matches a component if it is within 2.5 standard deviations, 2.5^2 = 25 / 4
+int const BACKGROUND_MATCH_NUMERATOR = 25;
+int const BACKGROUND_MATCH_DENOMINATOR = 4;
+
+// The second component is only part of the background if the first has less than 70% of the weight
+int const BACKGROUND_WEIGHT = 45875;
+
+// Limits of the lighting compensation, a bigger change than this is treated as motion
+double const BACKGROUND_MIN_GAIN = 0.5;
+double const BACKGROUND_MAX_GAIN = 2.0;
+
+// Each frame the motion score of every tile is multiplied by this before adding the pixels changed in the tile
+double const MOTION_TILE_SCORE_DECAY = 0.5;
+
+// Scale a box found in a resized image back to the coordinates of the original frame
+cv::Rect
+scaleRegion(const cv::Rect &region, const cv::Mat &resized, const cv::Mat &frame) {
+    double x_scale = frame.cols / (double) resized.cols;
+    double y_scale = frame.rows / (double) resized.rows;
+    cv::Rect scaled((int) std::floor(region.x * x_scale), (int) std::floor(region.y * y_scale),
+                    (int) std::ceil(region.width * x_scale), (int) std::ceil(region.height * y_scale));
+    return scaled & cv::Rect(0, 0, frame.cols, frame.rows);
+}
+
+// Resize into dest, which is only reallocated if the size of the frames changes
+void
+resizeToWidth(cv::Mat src, int width, cv::Mat &dest) {
     int rows = src.rows;
     int cols = src.cols;
     double ratio = width / (double) cols;
     int height = (int) std::round(rows * ratio);
     cv::resize(src, dest, cv::Size(width, height), 0, 0, cv::INTER_AREA);
-    return dest;
+}
+
+// Frames may be BGR or already grey, such as the luma plane of a frame captured as YUV
+void
+convertToGrey(const cv::Mat &frame, cv::Mat &grey) {
+    if (1 == frame.channels()) {
+        frame.copyTo(grey);
+    } else {
+        cv::cvtColor(frame, grey, cv::COLOR_BGR2GRAY);
+    }
+}
+
+// As convertToGrey() for part of a frame, grey must already be allocated
+void
+convertToGrey(const cv::Mat &frame, const cv::Rect &area, cv::Mat &grey) {
+    if (1 == frame.channels()) {
+        cv::Mat grey_area = grey(area);
+        frame(area).copyTo(grey_area);
+    } else {
+        fusedGreyscale(frame.ptr(area.y) + area.x * 3, frame.step, grey.ptr(area.y) + area.x, grey.step,
+                       area.width, area.height);
+    }
+}
+
+
+// Fixed point equivalent of cv::accumulateWeighted for 8 bit images, rounding to the nearest grey level
+void
+accumulateShift(const cv::Mat &frame, cv::Mat &accumulator) {
+    int const keep = (1 << MOTION_ACCUMULATOR_SHIFT) - 1;
+    int const round = 1 << (MOTION_ACCUMULATOR_SHIFT - 1);
+    int width = frame.cols * frame.channels();
+    for (int y = 0; y < frame.rows; ++y) {
+        const uint8_t *src = frame.ptr<uint8_t>(y);
+        uint8_t *acc = accumulator.ptr<uint8_t>(y);
+        for (int x = 0; x < width; ++x) {
+            acc[x] = (uint8_t) ((acc[x] * keep + src[x] + round) >> MOTION_ACCUMULATOR_SHIFT);
+        }
+    }
 }
 
 
 void
 ContourMotionDetector::initFrame(cv::Mat frame) {
-    logger.debug("ContourMotionDetector::first-frame", frame);
-    cv::Mat processed = preProcessImage(frame);
-    logger.debug("ContourMotionDetector::first-frame-processed", processed);
-    processed.convertTo(accumulator_, CV_32FC1);
+    LOG_DEBUG("ContourMotionDetector::first-frame", frame);
+    preProcessImage(frame, current_);
+    LOG_DEBUG("ContourMotionDetector::first-frame-processed", current_);
+    if (fixed_point_) {
+        current_.copyTo(accumulator_);
+    } else {
+        current_.convertTo(accumulator_, CV_32FC1);
+    }
+
+    abs_accumulator_.create(current_.size(), CV_8UC1);
+    diff_.create(current_.size(), CV_8UC1);
+    thres_.create(current_.size(), CV_8UC1);
+    dilated_.create(current_.size(), CV_8UC1);
 }
 
 
 bool
 ContourMotionDetector::detectMotion(cv::Mat frame) {
-    cv::Mat cur = preProcessImage(frame);
-    logger.debug("ContourMotionDetector::pre-process", cur);
+    return detect(frame, nullptr);
+}
 
-    // We need to conver the accumulator back to 8bit values for comparison
-    cv::Mat abs_accumulator;
-    cv::convertScaleAbs(accumulator_, abs_accumulator);
-    logger.debug("ContourMotionDetector::abs_accumulator", abs_accumulator);
 
-    // accumlate running averate of frames seen so far
-    cv::accumulateWeighted(cur, accumulator_, MOTION_ACCUMULATOR_WEIGHT);
-    logger.trace("ContourMotionDetector::accumulator", accumulator_);
+bool
+ContourMotionDetector::detectMotionRegions(cv::Mat frame, std::vector<cv::Rect> &regions) {
+    regions.clear();
+    return detect(frame, &regions);
+}
+
 
-    // difference between accumulator and current frame
-    cv::Mat diff;
-    cv::absdiff(cur, abs_accumulator, diff);
-    logger.trace("ContourMotionDetector::diff", diff);
+bool
+ContourMotionDetector::detect(cv::Mat frame, std::vector<cv::Rect> *regions) {
+    preProcessImage(frame, current_);
+    LOG_DEBUG("ContourMotionDetector::pre-process", current_);
+
+    if (fixed_point_) {
+        // difference from the average of the previous frames before adding this one
+        cv::absdiff(current_, accumulator_, diff_);
+        accumulateShift(current_, accumulator_);
+        LOG_TRACE("ContourMotionDetector::accumulator", accumulator_);
+    } else {
+        // We need to conver the accumulator back to 8bit values for comparison
+        cv::convertScaleAbs(accumulator_, abs_accumulator_);
+        LOG_DEBUG("ContourMotionDetector::abs_accumulator", abs_accumulator_);
+
+        // accumlate running averate of frames seen so far
+        cv::accumulateWeighted(current_, accumulator_, MOTION_ACCUMULATOR_WEIGHT);
+        LOG_TRACE("ContourMotionDetector::accumulator", accumulator_);
+
+        // difference between accumulator and current frame
+        cv::absdiff(current_, abs_accumulator_, diff_);
+    }
+    LOG_TRACE("ContourMotionDetector::diff", diff_);
 
     // binarise
-    cv::Mat thres;
-    cv::threshold(diff, thres, MOTION_THRESH_MIN, MOTION_THRESH_MAX, cv::THRESH_BINARY);
-    logger.trace("ContourMotionDetector::threshold", thres);
+    cv::threshold(diff_, thres_, MOTION_THRESH_MIN, MOTION_THRESH_MAX, cv::THRESH_BINARY);
+    LOG_TRACE("ContourMotionDetector::threshold", thres_);
 
-    cv::Mat dilated;
-    cv::dilate(thres, dilated, MOTION_DILATE_STRUCTURING, MOTION_DILATE_ANCHOR, MOTION_DILATE_ITERATIONS);
-    logger.debug("ContourMotionDetector::dilated", dilated);
+    cv::dilate(thres_, dilated_, MOTION_DILATE_STRUCTURING, MOTION_DILATE_ANCHOR, MOTION_DILATE_ITERATIONS);
+    LOG_DEBUG("ContourMotionDetector::dilated", dilated_);
 
-    std::vector<std::vector<cv::Point>> contours;
-    std::vector<cv::Vec4i> hierarchy;
-    cv::findContours(dilated, contours, hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE, cv::Point(0, 0));
+    // the contour vectors keep their capacity between frames
+    cv::findContours(dilated_, contours_, hierarchy_, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE, cv::Point(0, 0));
 
-    // See if any contours are bigger than the threshold
-    for (std::vector<std::vector<cv::Point>>::iterator it = contours.begin(); it != contours.end(); ++it) {
+    // See if any contours are bigger than the threshold, if we need the regions we have to check them all
+    bool moved = false;
+    for (std::vector<std::vector<cv::Point>>::iterator it = contours_.begin(); it != contours_.end(); ++it) {
         double area = cv::contourArea(*it);
         if (area > motion_dectected_area_) {
-            return true;
+            if (!regions) {
+                return true;
+            }
+            moved = true;
+            regions->push_back(scaleRegion(cv::boundingRect(*it), dilated_, frame));
         }
     }
 
-    return false;
+    return moved;
 }
 
 
-cv::Mat
-ContourMotionDetector::preProcessImage(cv::Mat frame) {
-    cv::Mat small = resizeToWidth(frame, image_width_);
-    cv::Mat grey;
-    cv::cvtColor(small, grey, cv::COLOR_BGR2GRAY);
-    cv::Mat blurred;
-    cv::GaussianBlur(grey, blurred, cv::Size(MOTION_BLUR_KERNEL_SIZE, MOTION_BLUR_KERNEL_SIZE), 0);
-    return blurred;
+void
+ContourMotionDetector::preProcessImage(cv::Mat frame, cv::Mat &processed) {
+    resizeToWidth(frame, image_width_, small_);
+    convertToGrey(small_, grey_);
+    cv::GaussianBlur(grey_, processed, cv::Size(MOTION_BLUR_KERNEL_SIZE, MOTION_BLUR_KERNEL_SIZE), 0);
 }
 
 
 void
 MeanSquaredErrorMotionDetector::initFrame(cv::Mat frame) {
-    logger.debug("MeanSquaredErrorMotionDetector::first-frame", frame);
-    accumulator_ = preProcessImage(frame);
-    logger.debug("MeanSquaredErrorMotionDetector::first-frame-processed", accumulator_);
+    LOG_DEBUG("MeanSquaredErrorMotionDetector::first-frame", frame);
+    preProcessImage(frame, current_);
+    current_.copyTo(accumulator_);
+    LOG_DEBUG("MeanSquaredErrorMotionDetector::first-frame-processed", accumulator_);
 }
 
 
 bool
 MeanSquaredErrorMotionDetector::detectMotion(cv::Mat frame) {
-    cv::Mat cur = preProcessImage(frame);
-    logger.debug("MeanSquaredErrorMotionDetector::pre-process", cur);
+    preProcessImage(frame, current_);
+    LOG_DEBUG("MeanSquaredErrorMotionDetector::pre-process", current_);
 
-    double mean = cv::norm(cur, accumulator_, cv::NORM_L2);
+    double mean = cv::norm(current_, accumulator_, cv::NORM_L2);
     //std::cout << "mean = " << mean << std::endl;
 
     // accumlate running averate of frames seen so far
-    cv::accumulateWeighted(cur, accumulator_, MOTION_ACCUMULATOR_WEIGHT);
-    logger.trace("MeanSquaredErrorMotionDetector::accumulator", accumulator_);
+    if (fixed_point_) {
+        accumulateShift(current_, accumulator_);
+    } else {
+        cv::accumulateWeighted(current_, accumulator_, MOTION_ACCUMULATOR_WEIGHT);
+    }
+    LOG_TRACE("MeanSquaredErrorMotionDetector::accumulator", accumulator_);
 
     return mean > threshold_;
 }
 
 
-cv::Mat
-MeanSquaredErrorMotionDetector::preProcessImage(cv::Mat frame) {
-    cv::Mat small = resizeToWidth(frame, image_width_);
-    cv::Mat grey;
-    cv::cvtColor(small, grey, cv::COLOR_BGR2GRAY);
-    cv::Mat flt;
-    grey.convertTo(flt, CV_32FC1);
+void
+MeanSquaredErrorMotionDetector::preProcessImage(cv::Mat frame, cv::Mat &processed) {
+    resizeToWidth(frame, image_width_, small_);
+    if (fixed_point_) {
+        if (use_blur_) {
+            convertToGrey(small_, grey_);
+            cv::GaussianBlur(grey_, processed, cv::Size(MOTION_BLUR_KERNEL_SIZE, MOTION_BLUR_KERNEL_SIZE), 0);
+        } else {
+            convertToGrey(small_, processed);
+        }
+        return;
+    }
 
+    convertToGrey(small_, grey_);
     if (use_blur_) {
-        cv::Mat blurred;
-        cv::GaussianBlur(flt, blurred, cv::Size(MOTION_BLUR_KERNEL_SIZE, MOTION_BLUR_KERNEL_SIZE), 0);
-        return blurred;
+        grey_.convertTo(flt_, CV_32FC1);
+        cv::GaussianBlur(flt_, processed, cv::Size(MOTION_BLUR_KERNEL_SIZE, MOTION_BLUR_KERNEL_SIZE), 0);
     } else {
-        return flt;
+        grey_.convertTo(processed, CV_32FC1);
     }
 }
 
@@ -147,67 +261,441 @@ MeanSquaredErrorMotionDetector::preProcessImage(cv::Mat frame) {
 void
 FrameDifferenceMotionDetector::initFrame(cv::Mat frame) {
     if (0 == prev_frame_.cols) {
-        prev_frame_ = preProcessImage(frame);
-        logger.debug("FrameDifferenceMotionDetector::prev_frame", prev_frame_);
+        preProcessImage(frame, prev_frame_);
+        LOG_DEBUG("FrameDifferenceMotionDetector::prev_frame", prev_frame_);
     } else {
-        current_frame_ = preProcessImage(frame);
-        logger.debug("FrameDifferenceMotionDetector::current_frame", current_frame_);
+        preProcessImage(frame, current_frame_);
+        LOG_DEBUG("FrameDifferenceMotionDetector::current_frame", current_frame_);
+
+        cv::Size size = current_frame_.size();
+        next_frame_.create(size, CV_8UC1);
+        diff1_.create(size, CV_8UC1);
+        diff2_.create(size, CV_8UC1);
+        motion_.create(size, CV_8UC1);
+        thres_.create(size, CV_8UC1);
+        eroded_.create(size, CV_8UC1);
+        joined_.create(size, CV_8UC1);
     }
 }
 
 
 bool
 FrameDifferenceMotionDetector::detectMotion(cv::Mat frame) {
-    cv::Mat next_frame = preProcessImage(frame);
+    return detect(frame, nullptr);
+}
+
+
+bool
+FrameDifferenceMotionDetector::detectMotionRegions(cv::Mat frame, std::vector<cv::Rect> &regions) {
+    regions.clear();
+    return detect(frame, &regions);
+}
+
+
+bool
+FrameDifferenceMotionDetector::detect(cv::Mat frame, std::vector<cv::Rect> *regions) {
+    preProcessImage(frame, next_frame_);
 
-    cv::Mat diff1;
-    cv::absdiff(prev_frame_, next_frame, diff1);
-    logger.trace("FrameDifferenceMotionDetector::diff1", diff1);
+    cv::absdiff(prev_frame_, next_frame_, diff1_);
+    LOG_TRACE("FrameDifferenceMotionDetector::diff1", diff1_);
 
-    cv::Mat diff2;
-    cv::absdiff(next_frame, current_frame_, diff2);
-    logger.trace("FrameDifferenceMotionDetector::diff2", diff2);
+    cv::absdiff(next_frame_, current_frame_, diff2_);
+    LOG_TRACE("FrameDifferenceMotionDetector::diff2", diff2_);
 
-    prev_frame_ = current_frame_;
-    current_frame_ = next_frame;
+    // the oldest frame's buffer is reused for the next frame
+    cv::swap(prev_frame_, current_frame_);
+    cv::swap(current_frame_, next_frame_);
 
-    cv::Mat motion;
-    cv::bitwise_and(diff1, diff2, motion);
-    logger.debug("FrameDifferenceMotionDetector::bitwise_and", motion);
+    cv::bitwise_and(diff1_, diff2_, motion_);
+    LOG_DEBUG("FrameDifferenceMotionDetector::bitwise_and", motion_);
 
     // binarise
-    cv::Mat thres;
-    cv::threshold(motion, thres, MOTION_THRESH_MIN, MOTION_THRESH_MAX, cv::THRESH_BINARY);
-    logger.trace("FrameDifferenceMotionDetector::threshold", thres);
+    cv::threshold(motion_, thres_, MOTION_THRESH_MIN, MOTION_THRESH_MAX, cv::THRESH_BINARY);
+    LOG_TRACE("FrameDifferenceMotionDetector::threshold", thres_);
 
-    cv::Mat eroded;
-    erode(thres, eroded, MOTION_ERODE_STRUCTURING);
-    logger.debug("FrameDifferenceMotionDetector::eroded", eroded);
+    erode(thres_, eroded_, MOTION_ERODE_STRUCTURING);
+    LOG_DEBUG("FrameDifferenceMotionDetector::eroded", eroded_);
 
     /*
      * Determine number of changed pixels. Binarized image should only have values of 0 and 255
      * so we devide sum by 255 to get count of changed pixels.
      */
-    cv::Scalar sum = cv::sum(eroded);
+    cv::Scalar sum = cv::sum(eroded_);
     double changed_pixels = sum.val[0] / 255;
     //std::cout << "changed_pixels = " << changed_pixels << std::endl;
-    return changed_pixels > threshold_;
+    bool moved = changed_pixels > threshold_;
+
+    // join up nearby changed pixels so that a moving person gives a few regions rather than many small ones
+    if (moved && regions) {
+        cv::dilate(eroded_, joined_, MOTION_DILATE_STRUCTURING, MOTION_DILATE_ANCHOR, MOTION_DILATE_ITERATIONS);
+        cv::findContours(joined_, contours_, hierarchy_, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE,
+                         cv::Point(0, 0));
+        for (const auto &contour : contours_) {
+            regions->push_back(scaleRegion(cv::boundingRect(contour), joined_, frame));
+        }
+    }
+    return moved;
 }
 
 
-cv::Mat
-FrameDifferenceMotionDetector::preProcessImage(cv::Mat frame) {
+void
+FrameDifferenceMotionDetector::preProcessImage(cv::Mat frame, cv::Mat &processed) {
     cv::Mat input = frame;
     if (image_width_ > 0) {
-        input = resizeToWidth(frame, image_width_);
+        resizeToWidth(frame, image_width_, small_);
+        input = small_;
     }
-    cv::Mat grey;
-    cv::cvtColor(input, grey, cv::COLOR_BGR2GRAY);
     if (use_blur_) {
-        cv::Mat blurred;
-        cv::GaussianBlur(grey, blurred, cv::Size(MOTION_BLUR_KERNEL_SIZE, MOTION_BLUR_KERNEL_SIZE), 0);
-        return blurred;
+        convertToGrey(input, grey_);
+        cv::GaussianBlur(grey_, processed, cv::Size(MOTION_BLUR_KERNEL_SIZE, MOTION_BLUR_KERNEL_SIZE), 0);
+    } else {
+        convertToGrey(input, processed);
+    }
+}
+
+
+void
+FusedFrameDifferenceMotionDetector::initFrame(cv::Mat frame) {
+    cv::Mat input = resize(frame);
+    cv::Mat &grey = (0 == prev_frame_.cols) ? prev_frame_ : current_frame_;
+    grey.create(input.size(), CV_8UC1);
+    convertToGrey(input, cv::Rect(0, 0, input.cols, input.rows), grey);
+    LOG_DEBUG("FusedFrameDifferenceMotionDetector::init_frame", grey);
+
+    if (&grey == &current_frame_) {
+        next_frame_.create(input.size(), CV_8UC1);
+        eroded_.create(input.size(), CV_8UC1);
+        joined_.create(input.size(), CV_8UC1);
+        kernel_.resize(input.cols);
+    }
+}
+
+
+bool
+FusedFrameDifferenceMotionDetector::detectMotion(cv::Mat frame) {
+    return detect(frame, nullptr);
+}
+
+
+bool
+FusedFrameDifferenceMotionDetector::detectMotionRegions(cv::Mat frame, std::vector<cv::Rect> &regions) {
+    regions.clear();
+    return detect(frame, &regions);
+}
+
+
+bool
+FusedFrameDifferenceMotionDetector::detect(cv::Mat frame, std::vector<cv::Rect> *regions) {
+    cv::Mat input = resize(frame);
+
+    // the eroded image is only needed to find the regions or to log it
+    bool keep_eroded = regions || logger.debugEnabled();
+    long changed_pixels = kernel_.apply(input.data, input.step, input.channels(), prev_frame_.data,
+                                        current_frame_.data, next_frame_.data, next_frame_.step,
+                                        keep_eroded ? eroded_.data : nullptr, eroded_.step, input.cols, input.rows,
+                                        MOTION_THRESH_MIN);
+    LOG_DEBUG("FusedFrameDifferenceMotionDetector::eroded", eroded_);
+
+    cv::swap(prev_frame_, current_frame_);
+    cv::swap(current_frame_, next_frame_);
+
+    bool moved = changed_pixels > threshold_;
+    if (moved && regions) {
+        cv::dilate(eroded_, joined_, MOTION_DILATE_STRUCTURING, MOTION_DILATE_ANCHOR, MOTION_DILATE_ITERATIONS);
+        cv::findContours(joined_, contours_, hierarchy_, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE,
+                         cv::Point(0, 0));
+        for (const auto &contour : contours_) {
+            regions->push_back(scaleRegion(cv::boundingRect(contour), joined_, frame));
+        }
+    }
+    return moved;
+}
+
+
+cv::Mat
+FusedFrameDifferenceMotionDetector::resize(cv::Mat frame) {
+    if (image_width_ > 0) {
+        resizeToWidth(frame, image_width_, small_);
+        return small_;
+    }
+    return frame;
+}
+
+
+void
+TiledFrameDifferenceMotionDetector::initFrame(cv::Mat frame) {
+    // tiles are converted to grey when they are first needed
+    saveFrame(frame);
+}
+
+
+bool
+TiledFrameDifferenceMotionDetector::detectMotion(cv::Mat frame) {
+    return detect(frame, nullptr);
+}
+
+
+bool
+TiledFrameDifferenceMotionDetector::detectMotionRegions(cv::Mat frame, std::vector<cv::Rect> &regions) {
+    regions.clear();
+    return detect(frame, &regions);
+}
+
+
+bool
+TiledFrameDifferenceMotionDetector::detect(cv::Mat frame, std::vector<cv::Rect> *regions) {
+    long frame_no = frame_count_;
+    int slot = saveFrame(frame);
+    const cv::Mat &prev = greys_[(frame_no - 2) % 3];
+    const cv::Mat &current = greys_[(frame_no - 1) % 3];
+    cv::Mat &next = greys_[slot];
+
+    for (size_t tile = 0; tile < tiles_.size(); ++tile) {
+        tile_scores_[tile] *= MOTION_TILE_SCORE_DECAY;
+    }
+
+    // regions need every tile so the order only matters when stopping early
+    if (!regions) {
+        std::sort(tile_order_.begin(), tile_order_.end(), [this](int a, int b) {
+            return (tile_scores_[a] > tile_scores_[b]) || ((tile_scores_[a] == tile_scores_[b]) && (a < b));
+        });
+    }
+
+    long changed_pixels = 0;
+    bool moved = false;
+    tiles_visited_ = 0;
+    for (size_t i = 0; i < tile_order_.size(); ++i) {
+        int tile = regions ? (int) i : tile_order_[i];
+        const cv::Rect &area = tiles_[tile];
+        convertTile(frame_no - 2, tile);
+        convertTile(frame_no - 1, tile);
+
+        const cv::Mat &input = frames_[slot];
+        long tile_pixels = kernel_.apply(input.ptr(area.y) + area.x * input.channels(), input.step,
+                                         input.channels(), prev.ptr(area.y) + area.x, current.ptr(area.y) + area.x,
+                                         next.ptr(area.y) + area.x, next.step,
+                                         regions ? eroded_.ptr(area.y) + area.x : nullptr, eroded_.step,
+                                         area.width, area.height, MOTION_THRESH_MIN);
+        grey_frame_no_[slot][tile] = frame_no;
+        tile_scores_[tile] += tile_pixels;
+        changed_pixels += tile_pixels;
+        ++tiles_visited_;
+
+        moved = changed_pixels > threshold_;
+        if (moved && !regions) {
+            break;
+        }
+    }
+    changed_pixels_ = changed_pixels;
+
+    if (moved && regions) {
+        cv::dilate(eroded_, joined_, MOTION_DILATE_STRUCTURING, MOTION_DILATE_ANCHOR, MOTION_DILATE_ITERATIONS);
+        cv::findContours(joined_, contours_, hierarchy_, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE,
+                         cv::Point(0, 0));
+        for (const auto &contour : contours_) {
+            regions->push_back(scaleRegion(cv::boundingRect(contour), joined_, frame));
+        }
+    }
+    return moved;
+}
+
+
+int
+TiledFrameDifferenceMotionDetector::saveFrame(cv::Mat frame) {
+    int slot = frame_count_ % 3;
+    ++frame_count_;
+    if (image_width_ > 0) {
+        resizeToWidth(frame, image_width_, frames_[slot]);
     } else {
-        return grey;
+        // copied as the caller may reuse the frame's pixels for the next frame
+        frame.copyTo(frames_[slot]);
+    }
+    if (frames_[slot].size() != greys_[slot].size()) {
+        allocate(frames_[slot].size());
+    }
+    return slot;
+}
+
+
+void
+TiledFrameDifferenceMotionDetector::allocate(cv::Size size) {
+    tiles_.clear();
+    for (int y = 0; y < size.height; y += tile_size_) {
+        for (int x = 0; x < size.width; x += tile_size_) {
+            tiles_.push_back(cv::Rect(x, y, tile_size_, tile_size_) & cv::Rect(0, 0, size.width, size.height));
+        }
+    }
+    tile_scores_.assign(tiles_.size(), 0);
+    tile_order_.resize(tiles_.size());
+    for (size_t tile = 0; tile < tiles_.size(); ++tile) {
+        tile_order_[tile] = (int) tile;
+    }
+
+    for (int slot = 0; slot < 3; ++slot) {
+        greys_[slot].create(size, CV_8UC1);
+        grey_frame_no_[slot].assign(tiles_.size(), -1);
+    }
+    eroded_.create(size, CV_8UC1);
+    joined_.create(size, CV_8UC1);
+    kernel_.resize(tile_size_);
+}
+
+
+void
+TiledFrameDifferenceMotionDetector::convertTile(long frame_no, size_t tile) {
+    int slot = frame_no % 3;
+    if (grey_frame_no_[slot][tile] == frame_no) {
+        return;
+    }
+    convertToGrey(frames_[slot], tiles_[tile], greys_[slot]);
+    grey_frame_no_[slot][tile] = frame_no;
+}
+
+
+void
+BackgroundModelMotionDetector::initFrame(cv::Mat frame) {
+    preProcessImage(frame, grey_);
+    LOG_DEBUG("BackgroundModelMotionDetector::first-frame", grey_);
+
+    // start with the first frame as the background, the second component is replaced by the first mismatch
+    model_.resize(2 * grey_.total());
+    Component *pixel = model_.data();
+    for (int y = 0; y < grey_.rows; ++y) {
+        const uint8_t *src = grey_.ptr<uint8_t>(y);
+        for (int x = 0; x < grey_.cols; ++x, pixel += 2) {
+            pixel[0] = {(uint16_t) (src[x] << BACKGROUND_MEAN_BITS), (uint16_t) BACKGROUND_INITIAL_VARIANCE,
+                        (uint16_t) BACKGROUND_MAX_WEIGHT};
+            pixel[1] = {0, (uint16_t) BACKGROUND_INITIAL_VARIANCE, 0};
+        }
+    }
+
+    foreground_ = cv::Mat::zeros(grey_.size(), CV_8UC1);
+    eroded_.create(grey_.size(), CV_8UC1);
+    joined_.create(grey_.size(), CV_8UC1);
+    gain_ = 1.0;
+}
+
+
+bool
+BackgroundModelMotionDetector::detectMotion(cv::Mat frame) {
+    return detect(frame, nullptr);
+}
+
+
+bool
+BackgroundModelMotionDetector::detectMotionRegions(cv::Mat frame, std::vector<cv::Rect> &regions) {
+    regions.clear();
+    return detect(frame, &regions);
+}
+
+
+bool
+BackgroundModelMotionDetector::detect(cv::Mat frame, std::vector<cv::Rect> *regions) {
+    preProcessImage(frame, grey_);
+
+    gain_ = estimateGain();
+    update((int) std::lround(gain_ * (1 << BACKGROUND_MEAN_BITS)));
+    LOG_DEBUG("BackgroundModelMotionDetector::gain " + std::to_string(gain_));
+    LOG_DEBUG("BackgroundModelMotionDetector::foreground", foreground_);
+
+    erode(foreground_, eroded_, MOTION_ERODE_STRUCTURING);
+    LOG_TRACE("BackgroundModelMotionDetector::eroded", eroded_);
+
+    int changed_pixels = cv::countNonZero(eroded_);
+    bool moved = changed_pixels > threshold_;
+
+    if (moved && regions) {
+        cv::dilate(eroded_, joined_, MOTION_DILATE_STRUCTURING, MOTION_DILATE_ANCHOR, MOTION_DILATE_ITERATIONS);
+        cv::findContours(joined_, contours_, hierarchy_, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE,
+                         cv::Point(0, 0));
+        for (const auto &contour : contours_) {
+            regions->push_back(scaleRegion(cv::boundingRect(contour), joined_, frame));
+        }
+    }
+    return moved;
+}
+
+
+void
+BackgroundModelMotionDetector::preProcessImage(cv::Mat frame, cv::Mat &processed) {
+    resizeToWidth(frame, image_width_, small_);
+    convertToGrey(small_, processed);
+}
+
+
+double
+BackgroundModelMotionDetector::estimateGain() {
+    // pixels that were foreground may be someone walking past so they would bias the estimate
+    int64_t model_sum = 0;
+    int64_t frame_sum = 0;
+    const Component *pixel = model_.data();
+    for (int y = 0; y < grey_.rows; ++y) {
+        const uint8_t *src = grey_.ptr<uint8_t>(y);
+        const uint8_t *fg = foreground_.ptr<uint8_t>(y);
+        for (int x = 0; x < grey_.cols; ++x, pixel += 2) {
+            if (0 == fg[x]) {
+                model_sum += pixel[0].mean;
+                frame_sum += src[x];
+            }
+        }
+    }
+
+    if (0 == frame_sum) {
+        return (0 == model_sum) ? 1.0 : BACKGROUND_MAX_GAIN;
+    }
+    double gain = model_sum / (double) (frame_sum << BACKGROUND_MEAN_BITS);
+    return std::min(BACKGROUND_MAX_GAIN, std::max(BACKGROUND_MIN_GAIN, gain));
+}
+
+
+void
+BackgroundModelMotionDetector::update(int gain) {
+    Component *pixel = model_.data();
+    for (int y = 0; y < grey_.rows; ++y) {
+        const uint8_t *src = grey_.ptr<uint8_t>(y);
+        uint8_t *fg = foreground_.ptr<uint8_t>(y);
+        for (int x = 0; x < grey_.cols; ++x, pixel += 2) {
+            // the pixel at the brightness of the model, with the same fractional bits as the means
+            int value = std::min(src[x] * gain, 0xffff);
+
+            int matched = -1;
+            for (int c = 0; c < 2; ++c) {
+                int diff = (value - pixel[c].mean) / (1 << (BACKGROUND_MEAN_BITS - BACKGROUND_VARIANCE_BITS));
+                if (diff * diff * BACKGROUND_MATCH_DENOMINATOR <
+                    (pixel[c].variance << BACKGROUND_VARIANCE_BITS) * BACKGROUND_MATCH_NUMERATOR) {
+                    matched = c;
+                    break;
+                }
+            }
+            bool background = (0 == matched) || ((1 == matched) && (pixel[0].weight < BACKGROUND_WEIGHT));
+            fg[x] = background ? 0 : 255;
+
+            for (int c = 0; c < 2; ++c) {
+                Component &component = pixel[c];
+                if (c == matched) {
+                    int diff = value - component.mean;
+                    int scaled_diff = diff / (1 << (BACKGROUND_MEAN_BITS - BACKGROUND_VARIANCE_BITS));
+                    int dist = (scaled_diff * scaled_diff) >> BACKGROUND_VARIANCE_BITS;
+                    int variance = component.variance + (dist - component.variance) / (1 << BACKGROUND_LEARNING_SHIFT);
+                    component.mean = (uint16_t) (component.mean + diff / (1 << BACKGROUND_LEARNING_SHIFT));
+                    component.variance = (uint16_t) std::min(BACKGROUND_MAX_VARIANCE,
+                                                             std::max(BACKGROUND_MIN_VARIANCE, variance));
+                    component.weight = (uint16_t) (component.weight +
+                                                   ((BACKGROUND_MAX_WEIGHT - component.weight) >>
+                                                    BACKGROUND_LEARNING_SHIFT));
+                } else {
+                    component.weight = (uint16_t) (component.weight - (component.weight >> BACKGROUND_LEARNING_SHIFT));
+                }
+            }
+
+            // nothing matched so the weakest component is replaced by the new value
+            if (matched < 0) {
+                pixel[1] = {(uint16_t) value, (uint16_t) BACKGROUND_INITIAL_VARIANCE,
+                            (uint16_t) (1 << (16 - BACKGROUND_LEARNING_SHIFT))};
+            }
+            if (pixel[1].weight > pixel[0].weight) {
+                std::swap(pixel[0], pixel[1]);
+            }
+        }
     }
 }
@@ -12,15 +12,21 @@
 #ifndef MOTION_DETECTOR_H_
 #define MOTION_DETECTOR_H_
 
+#include "framedifference.h"
 #include "imagelogger.h"
 
 #include <opencv2/opencv.hpp>
 
 /**
- * Motion detectors are stateful classes that detect motion in a sequence of images
+ * Motion detectors are stateful classes that detect motion in a sequence of images. Frames may be 8 bit BGR or
+ * 8 bit grey, such as the luma plane of frames read with FrameReader in luma mode, but all the frames given
+ * to a detector must be of the same type.
  */
 class MotionDetector {
 public:
+    virtual ~MotionDetector() {
+    }
+
     /*
      * How many frames does the detector need before it can start detecting motion
      */
@@ -35,6 +41,16 @@ public:
      * After initialisation determine if this frame contains motion
      */
     virtual bool detectMotion(cv::Mat frame) = 0;
+
+    /*
+     * As detectMotion() but also return boxes around the areas of the frame that changed, in the coordinates
+     * of the supplied frame. Detectors which can't locate motion return no regions, which means that the
+     * whole frame should be treated as having changed.
+     */
+    virtual bool detectMotionRegions(cv::Mat frame, std::vector<cv::Rect> &regions) {
+        regions.clear();
+        return detectMotion(frame);
+    }
 };
 
 
@@ -90,12 +106,17 @@ private:
 
 /**
  * Based on algorithm described in https://www.pyimagesearch.com/2015/05/25/basic-motion-detection-and-tracking-with-python-and-opencv/
+ *
+ * With fixed_point the running average is kept as an 8 bit image and updated with a shift instead of a float
+ * accumulator, which touches a quarter of the data each frame. The average then differs from the float version
+ * by at most one grey level.
  */
 class ContourMotionDetector : public MotionDetector {
 public:
-    ContourMotionDetector(int image_width, int motion_detected_area) {
+    ContourMotionDetector(int image_width, int motion_detected_area, bool fixed_point = false) {
         image_width_ = image_width;
         motion_dectected_area_ = motion_detected_area;
+        fixed_point_ = fixed_point;
     }
 
     virtual int numInitFrames() {
@@ -106,24 +127,47 @@ public:
 
     virtual bool detectMotion(cv::Mat frame);
 
+    virtual bool detectMotionRegions(cv::Mat frame, std::vector<cv::Rect> &regions);
+
 private:
-    cv::Mat preProcessImage(cv::Mat frame);
+    // regions may be null if they are not needed
+    bool detect(cv::Mat frame, std::vector<cv::Rect> *regions);
+
+    void preProcessImage(cv::Mat frame, cv::Mat &processed);
 
     int image_width_;
     int motion_dectected_area_;
+    bool fixed_point_;
+
+    // CV_32FC1, or CV_8UC1 for fixed point
     cv::Mat accumulator_;
+
+    // working images are sized by initFrame() and reused for every frame so detection does not allocate them
+    cv::Mat small_;
+    cv::Mat grey_;
+    cv::Mat current_;
+    cv::Mat abs_accumulator_;
+    cv::Mat diff_;
+    cv::Mat thres_;
+    cv::Mat dilated_;
+    std::vector<std::vector<cv::Point>> contours_;
+    std::vector<cv::Vec4i> hierarchy_;
 };
 
 
 /**
  * Based on algorithm described in https://www.pyimagesearch.com/2014/09/15/python-compare-two-images/
+ *
+ * With fixed_point frames are blurred and compared as 8 bit images and the running average is kept as an 8 bit
+ * image updated with a shift, rather than converting every frame to float.
  */
 class MeanSquaredErrorMotionDetector : public MotionDetector {
 public:
-    MeanSquaredErrorMotionDetector(int image_width, double threshold, bool use_blur) {
+    MeanSquaredErrorMotionDetector(int image_width, double threshold, bool use_blur, bool fixed_point = false) {
         image_width_ = image_width;
         threshold_ = threshold;
         use_blur_ = use_blur;
+        fixed_point_ = fixed_point;
     }
 
     virtual int numInitFrames() {
@@ -135,12 +179,21 @@ public:
     virtual bool detectMotion(cv::Mat frame);
 
 private:
-    cv::Mat preProcessImage(cv::Mat frame);
+    void preProcessImage(cv::Mat frame, cv::Mat &processed);
 
     int image_width_;
     double threshold_;
     bool use_blur_;
+    bool fixed_point_;
+
+    // CV_32FC1, or CV_8UC1 for fixed point
     cv::Mat accumulator_;
+
+    // working images reused for every frame
+    cv::Mat small_;
+    cv::Mat grey_;
+    cv::Mat flt_;
+    cv::Mat current_;
 };
 
 
@@ -165,15 +218,236 @@ public:
 
     virtual bool detectMotion(cv::Mat frame);
 
+    virtual bool detectMotionRegions(cv::Mat frame, std::vector<cv::Rect> &regions);
+
 private:
-    cv::Mat preProcessImage(cv::Mat frame);
+    // regions may be null if they are not needed
+    bool detect(cv::Mat frame, std::vector<cv::Rect> *regions);
+
+    void preProcessImage(cv::Mat frame, cv::Mat &processed);
 
     int image_width_;
     double threshold_;
     bool use_blur_;
+
+    // the last three frames, the buffers are rotated rather than reallocated for each new frame
+    cv::Mat prev_frame_;
+    cv::Mat current_frame_;
+    cv::Mat next_frame_;
+
+    // working images reused for every frame
+    cv::Mat small_;
+    cv::Mat grey_;
+    cv::Mat diff1_;
+    cv::Mat diff2_;
+    cv::Mat motion_;
+    cv::Mat thres_;
+    cv::Mat eroded_;
+    cv::Mat joined_;
+    std::vector<std::vector<cv::Point>> contours_;
+    std::vector<cv::Vec4i> hierarchy_;
+};
+
+/**
+ * Gives the same results as FrameDifferenceMotionDetector without blurring, but converts the frame to grey,
+ * differences, thresholds, erodes and counts the changed pixels in a single pass (see FusedFrameDifference).
+ */
+class FusedFrameDifferenceMotionDetector : public MotionDetector {
+public:
+    FusedFrameDifferenceMotionDetector(int image_width, double threshold) {
+        image_width_ = image_width;
+        threshold_ = threshold;
+    }
+
+    virtual int numInitFrames() {
+        return 2;
+    }
+
+    virtual void initFrame(cv::Mat frame);
+
+    virtual bool detectMotion(cv::Mat frame);
+
+    virtual bool detectMotionRegions(cv::Mat frame, std::vector<cv::Rect> &regions);
+
+private:
+    // regions may be null if they are not needed
+    bool detect(cv::Mat frame, std::vector<cv::Rect> *regions);
+
+    // the resized frame, or the frame itself if it is not resized
+    cv::Mat resize(cv::Mat frame);
+
+    int image_width_;
+    double threshold_;
+    FusedFrameDifference kernel_;
+
     cv::Mat prev_frame_;
     cv::Mat current_frame_;
+    cv::Mat next_frame_;
+
+    // working images reused for every frame
+    cv::Mat small_;
+    cv::Mat eroded_;
+    cv::Mat joined_;
+    std::vector<std::vector<cv::Point>> contours_;
+    std::vector<cv::Vec4i> hierarchy_;
 };
 
+// Size in pixels of the square tiles used by TiledFrameDifferenceMotionDetector, after resizing
+int const MOTION_TILE_SIZE = 64;
+
+/**
+ * Frame differencing that stops as soon as enough pixels have changed. The resized frame is divided into tiles
+ * which are visited in order of how much motion they have had recently, so while something is moving the
+ * threshold is usually crossed after only a few tiles. Tiles are only converted to grey when they are visited,
+ * tiles skipped in earlier frames are converted from the saved frames when they are next needed. Frames without
+ * motion visit every tile and cost about the same as FusedFrameDifferenceMotionDetector.
+ *
+ * Erosion treats the edges of each tile as the edge of the frame so slightly more pixels may be counted than by
+ * FrameDifferenceMotionDetector. detectMotionRegions() always visits every tile.
+ */
+class TiledFrameDifferenceMotionDetector : public MotionDetector {
+public:
+    TiledFrameDifferenceMotionDetector(int image_width, double threshold, int tile_size = MOTION_TILE_SIZE) {
+        image_width_ = image_width;
+        threshold_ = threshold;
+        tile_size_ = tile_size;
+    }
+
+    virtual int numInitFrames() {
+        return 2;
+    }
+
+    virtual void initFrame(cv::Mat frame);
+
+    virtual bool detectMotion(cv::Mat frame);
+
+    virtual bool detectMotionRegions(cv::Mat frame, std::vector<cv::Rect> &regions);
+
+    int tileCount() const {
+        return (int) tiles_.size();
+    }
+
+    // number of tiles looked at for the last frame
+    int tilesVisited() const {
+        return tiles_visited_;
+    }
+
+    // changed pixels counted in the tiles visited for the last frame
+    long changedPixels() const {
+        return changed_pixels_;
+    }
+
+private:
+    // regions may be null if they are not needed
+    bool detect(cv::Mat frame, std::vector<cv::Rect> *regions);
+
+    // save the resized frame and return the slot it was saved in
+    int saveFrame(cv::Mat frame);
+
+    void allocate(cv::Size size);
+
+    // make sure a tile has been converted to grey for a recent frame
+    void convertTile(long frame_no, size_t tile);
+
+    int image_width_;
+    double threshold_;
+    int tile_size_;
+    FusedFrameDifference kernel_;
+
+    // the last three resized frames and their grey versions, frame n is in slot n % 3
+    long frame_count_ = 0;
+    cv::Mat frames_[3];
+    cv::Mat greys_[3];
+
+    // frame number each tile of each grey image was converted from, -1 if it has not been converted
+    std::vector<long> grey_frame_no_[3];
+
+    std::vector<cv::Rect> tiles_;
+
+    // recent motion in each tile and the order to visit the tiles, most motion first
+    std::vector<double> tile_scores_;
+    std::vector<int> tile_order_;
+    int tiles_visited_ = 0;
+    long changed_pixels_ = 0;
+
+    // working images reused for every frame
+    cv::Mat eroded_;
+    cv::Mat joined_;
+    std::vector<std::vector<cv::Point>> contours_;
+    std::vector<cv::Vec4i> hierarchy_;
+};
+
+
+/**
+ * Keeps a background model of two gaussians per pixel of the resized grey frame, in the style of Stauffer and
+ * Grimson's adaptive mixture model, and reports motion when enough pixels don't match the background. Pixels which
+ * keep changing between two values, such as flickering lights or leaves, are absorbed by the second gaussian.
+ *
+ * Before the frame is matched against the model it is scaled by the ratio of the brightness of the model to that
+ * of the frame over the pixels that were background in the previous frame. This removes global lighting changes
+ * such as lights being switched on or the camera adjusting its exposure, which frame differencing reports as
+ * motion. The model is stored in fixed point, 12 bytes per pixel, and updated in the same pass that classifies
+ * the pixels.
+ */
+class BackgroundModelMotionDetector : public MotionDetector {
+public:
+    BackgroundModelMotionDetector(int image_width, double threshold) {
+        image_width_ = image_width;
+        threshold_ = threshold;
+    }
+
+    virtual int numInitFrames() {
+        return 1;
+    }
+
+    virtual void initFrame(cv::Mat frame);
+
+    virtual bool detectMotion(cv::Mat frame);
+
+    virtual bool detectMotionRegions(cv::Mat frame, std::vector<cv::Rect> &regions);
+
+    // ratio of the brightness of the model to that of the last frame
+    double gain() const {
+        return gain_;
+    }
+
+private:
+    /*
+     * mean and variance in grey levels with 8 and 4 fractional bits, weight as a fraction of 65536.
+     * The first component of each pixel has the larger weight.
+     */
+    struct Component {
+        uint16_t mean;
+        uint16_t variance;
+        uint16_t weight;
+    };
+
+    // regions may be null if they are not needed
+    bool detect(cv::Mat frame, std::vector<cv::Rect> *regions);
+
+    void preProcessImage(cv::Mat frame, cv::Mat &processed);
+
+    // ratio of the model's brightness to the frame's over the background pixels of the previous frame
+    double estimateGain();
+
+    // match each pixel against its model, update the model and write the foreground mask
+    void update(int gain);
+
+    int image_width_;
+    double threshold_;
+    double gain_ = 1.0;
+
+    // two components per pixel
+    std::vector<Component> model_;
+
+    // working images reused for every frame, foreground_ is 255 where a pixel did not match the background
+    cv::Mat small_;
+    cv::Mat grey_;
+    cv::Mat foreground_;
+    cv::Mat eroded_;
+    cv::Mat joined_;
+    std::vector<std::vector<cv::Point>> contours_;
+    std::vector<cv::Vec4i> hierarchy_;
+};
 
 #endif // MOTION_DETECTOR_H_
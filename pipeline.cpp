@@ -0,0 +1,187 @@
+/*
+ *  Face manager 0.1
+ *  Multi-threaded decode -> motion detection -> manager -> output pipeline
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include "pipeline.h"
+#include "imagelogger.h"
+#include "tracing.h"
+
+#include <iomanip>
+#include <thread>
+
+FramePipeline::FramePipeline(FrameReader &input, MotionDetector &detector, Manager *manager,
+                             size_t queue_capacity)
+        : input_(input), detector_(detector), manager_(manager),
+          decoded_(queue_capacity), motion_checked_(queue_capacity), processed_(queue_capacity) {
+    decode_stats_.name = "decode";
+    motion_stats_.name = "motion";
+    manager_stats_.name = "manager";
+    output_stats_.name = "output";
+}
+
+int
+FramePipeline::run(const OutputHandler &output) {
+    double start_ticks = (double) cv::getTickCount();
+
+    std::thread decode_thread(&FramePipeline::decodeStage, this);
+    std::thread motion_thread(&FramePipeline::motionStage, this);
+    std::thread manager_thread(&FramePipeline::managerStage, this);
+
+    outputStage(output);
+
+    decode_thread.join();
+    motion_thread.join();
+    manager_thread.join();
+
+    wall_seconds_ = ((double) cv::getTickCount() - start_ticks) / cv::getTickFrequency();
+
+    // queue statistics belong to the stage consuming from the queue
+    motion_stats_.max_queue_depth = decoded_.maxDepth();
+    motion_stats_.mean_queue_depth = decoded_.meanDepth();
+    motion_stats_.full_waits = decoded_.fullWaits();
+    manager_stats_.max_queue_depth = motion_checked_.maxDepth();
+    manager_stats_.mean_queue_depth = motion_checked_.meanDepth();
+    manager_stats_.full_waits = motion_checked_.fullWaits();
+    output_stats_.max_queue_depth = processed_.maxDepth();
+    output_stats_.mean_queue_depth = processed_.meanDepth();
+    output_stats_.full_waits = processed_.fullWaits();
+
+    return output_stats_.frames;
+}
+
+void
+FramePipeline::decodeStage() {
+    tracer.nameThread(decode_stats_.name);
+    int frame_no = 0;
+    while (true) {
+        double start_ticks = (double) cv::getTickCount();
+        PipelineFrame item;
+        {
+            TRACE_SPAN("decode frame", frame_no + 1);
+            // FrameReader reads each frame into a new Mat as earlier frames may still be in use by later stages
+            if (!input_.read(item.frame)) {
+                break;
+            }
+        }
+        item.frame_no = ++frame_no;
+        double seconds = ((double) cv::getTickCount() - start_ticks) / cv::getTickFrequency();
+        decode_stats_.busy_seconds += seconds;
+        decode_stats_.latency.record(seconds);
+        ++decode_stats_.frames;
+
+        if (!decoded_.push(std::move(item))) {
+            break;
+        }
+    }
+    decoded_.close();
+}
+
+void
+FramePipeline::motionStage() {
+    tracer.nameThread(motion_stats_.name);
+    PipelineFrame item;
+    while (decoded_.pop(item)) {
+        double start_ticks = (double) cv::getTickCount();
+        logger.setFrame(item.frame_no);
+        {
+            TRACE_SPAN("detect motion", item.frame_no);
+            if (manager_ && manager_->motionRegionDetection()) {
+                item.moved = detector_.detectMotionRegions(item.frame.image(), item.motion_regions);
+            } else {
+                item.moved = detector_.detectMotion(item.frame.image());
+            }
+        }
+        double seconds = ((double) cv::getTickCount() - start_ticks) / cv::getTickFrequency();
+        motion_stats_.busy_seconds += seconds;
+        motion_stats_.latency.record(seconds);
+        ++motion_stats_.frames;
+
+        if (!motion_checked_.push(std::move(item))) {
+            break;
+        }
+    }
+    motion_checked_.close();
+}
+
+void
+FramePipeline::managerStage() {
+    tracer.nameThread(manager_stats_.name);
+    PipelineFrame item;
+    while (motion_checked_.pop(item)) {
+        double start_ticks = (double) cv::getTickCount();
+        if (manager_) {
+            if (item.moved) {
+                manager_->newFrame(item.frame_no, item.frame, item.motion_regions);
+            }
+
+            for (const auto &person : manager_->visiblePeople()) {
+                TrackedPerson tracked;
+                tracked.local_id = person->localId();
+                tracked.external_id = person->externalId();
+                tracked.bounding_box = person->boundingBox();
+                item.visible_people.push_back(tracked);
+            }
+            item.visible_count = manager_->visibleCount();
+            item.known_count = manager_->knownCount();
+        }
+        double seconds = ((double) cv::getTickCount() - start_ticks) / cv::getTickFrequency();
+        manager_stats_.busy_seconds += seconds;
+        manager_stats_.latency.record(seconds);
+        ++manager_stats_.frames;
+
+        if (!processed_.push(std::move(item))) {
+            break;
+        }
+    }
+    processed_.close();
+}
+
+void
+FramePipeline::outputStage(const OutputHandler &output) {
+    tracer.nameThread(output_stats_.name);
+    PipelineFrame item;
+    while (processed_.pop(item)) {
+        double start_ticks = (double) cv::getTickCount();
+        {
+            TRACE_SPAN("output", item.frame_no);
+            output(item);
+        }
+        double seconds = ((double) cv::getTickCount() - start_ticks) / cv::getTickFrequency();
+        output_stats_.busy_seconds += seconds;
+        output_stats_.latency.record(seconds);
+        ++output_stats_.frames;
+    }
+}
+
+std::vector<StageStats>
+FramePipeline::stats() const {
+    return std::vector<StageStats>{decode_stats_, motion_stats_, manager_stats_, output_stats_};
+}
+
+void
+FramePipeline::printStats(std::ostream &out) const {
+    out << "Stage, #frames, busy seconds, FPS, busy FPS, max queue depth, mean queue depth, #full waits"
+        << ", p50 (ms), p99 (ms), max (ms)" << std::endl;
+    for (const auto &stage : stats()) {
+        double fps = (wall_seconds_ > 0) ? stage.frames / wall_seconds_ : 0;
+        double busy_fps = (stage.busy_seconds > 0) ? stage.frames / stage.busy_seconds : 0;
+        out << "Stage: " << stage.name
+            << ", " << stage.frames
+            << ", " << stage.busy_seconds
+            << ", " << fps
+            << ", " << busy_fps
+            << ", " << stage.max_queue_depth
+            << ", " << stage.mean_queue_depth
+            << ", " << stage.full_waits
+            << ", " << stage.latency.percentile(50) * 1000
+            << ", " << stage.latency.percentile(99) * 1000
+            << ", " << stage.latency.max() * 1000
+            << std::endl;
+    }
+}
@@ -0,0 +1,139 @@
+/*
+ *  Face manager 0.1
+ *  Multi-threaded decode -> motion detection -> manager -> output pipeline
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_PIPELINE_H
+#define FACE_MANAGER_PIPELINE_H
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "boundedqueue.h"
+#include "latencyhistogram.h"
+#include "manager.h"
+#include "motiondetector.h"
+#include "videoframe.h"
+
+size_t const DEFAULT_PIPELINE_QUEUE_CAPACITY = 4;
+
+/*
+ * Snapshot of a visible person taken by the manager stage. The output stage works from this copy
+ * so that it never touches the manager while the next frame is being processed.
+ */
+struct TrackedPerson {
+    int local_id = 0;
+    std::string external_id;
+    dlib::rectangle bounding_box;
+};
+
+// A frame as it moves through the pipeline, stages fill in their results as they go
+struct PipelineFrame {
+    int frame_no = 0;
+    VideoFrame frame;
+    bool moved = false;
+
+    // areas of the frame that changed, only filled in if the manager uses them
+    std::vector<cv::Rect> motion_regions;
+
+    std::vector<TrackedPerson> visible_people;
+    int visible_count = 0;
+    int known_count = 0;
+};
+
+struct StageStats {
+    std::string name;
+
+    // number of frames handled by the stage
+    long frames = 0;
+
+    // time spent doing useful work (i.e. not waiting on a queue)
+    double busy_seconds = 0;
+
+    // distribution of the time spent on each frame
+    LatencyHistogram latency;
+
+    // depth of the queue feeding this stage, not applicable for the decode stage
+    size_t max_queue_depth = 0;
+    double mean_queue_depth = 0;
+
+    // number of times the stage feeding this one blocked because the queue was full
+    long full_waits = 0;
+};
+
+/*
+ * Runs video decoding, motion detection, the manager and output on separate threads connected by
+ * bounded queues. Frames are handled strictly in order by a single thread per stage so the manager sees exactly
+ * the same sequence of frames as it would in a simple read/detect/process loop.
+ *
+ * The caller is responsible for any warm up and motion detector initialisation frames before calling run().
+ * Motion detection and the manager work on frame.image(), so if the frames are read as luma they are only
+ * converted to colour for new faces and by the output handler if it calls frame.colour().
+ *
+ * Note that the logger is shared between stages, image log file names use the frame number of the
+ * motion detection stage which may be a few frames ahead of the manager.
+ */
+class FramePipeline {
+public:
+    typedef std::function<void(PipelineFrame &)> OutputHandler;
+
+    /*
+     * manager may be null in which case frames pass straight from motion detection to output
+     */
+    FramePipeline(FrameReader &input, MotionDetector &detector, Manager *manager,
+                  size_t queue_capacity = DEFAULT_PIPELINE_QUEUE_CAPACITY);
+
+    /*
+     * Process frames until the input is exhausted. The output handler is called on the calling thread
+     * for each frame in order. Returns the number of frames processed.
+     */
+    int run(const OutputHandler &output);
+
+    std::vector<StageStats> stats() const;
+
+    // time taken to detect motion in each frame
+    const LatencyHistogram &motionLatency() const {
+        return motion_stats_.latency;
+    }
+
+    double wallSeconds() const {
+        return wall_seconds_;
+    }
+
+    void printStats(std::ostream &out) const;
+
+private:
+    void decodeStage();
+
+    void motionStage();
+
+    void managerStage();
+
+    void outputStage(const OutputHandler &output);
+
+    FrameReader &input_;
+    MotionDetector &detector_;
+    Manager *manager_;
+
+    BoundedQueue<PipelineFrame> decoded_;
+    BoundedQueue<PipelineFrame> motion_checked_;
+    BoundedQueue<PipelineFrame> processed_;
+
+    StageStats decode_stats_;
+    StageStats motion_stats_;
+    StageStats manager_stats_;
+    StageStats output_stats_;
+
+    double wall_seconds_ = 0;
+};
+
+#endif //FACE_MANAGER_PIPELINE_H
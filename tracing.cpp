@@ -0,0 +1,136 @@
+/*
+ *  Face manager 0.1
+ *  Timeline of where the time goes in each frame, written as Chrome trace-event JSON
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include "tracing.h"
+#include "imagelogger.h"
+
+#include <fstream>
+
+// The single instance of the tracer
+Tracer tracer;
+
+// frame of the last span on this thread that was given one
+static thread_local int current_frame = TRACE_CURRENT_FRAME;
+
+// small numbers are easier to read in the trace viewer than native thread IDs
+static std::atomic<int> next_thread_id(1);
+
+static int
+traceThreadId() {
+    static thread_local int thread_id = next_thread_id++;
+    return thread_id;
+}
+
+static std::string
+jsonString(const std::string &value) {
+    std::string quoted = "\"";
+    for (char c : value) {
+        if (('"' == c) || ('\\' == c)) {
+            quoted += '\\';
+            quoted += c;
+        } else if ((unsigned char) c < 0x20) {
+            quoted += ' ';
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+void
+Tracer::start(size_t max_events) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.clear();
+    thread_names_.clear();
+    max_events_ = max_events;
+    dropped_ = 0;
+    start_time_ = std::chrono::steady_clock::now();
+    enabled_ = true;
+}
+
+bool
+Tracer::stop(const std::string &filename) {
+    enabled_ = false;
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::ofstream out(filename, std::ios::trunc);
+    if (!out) {
+        logger.error("Unable to create trace file " + filename);
+        return false;
+    }
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    const char *separator = "\n";
+    for (const auto &thread : thread_names_) {
+        out << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread.first
+            << ", \"args\": {\"name\": " << jsonString(thread.second) << "}}";
+        separator = ",\n";
+    }
+    for (const auto &event : events_) {
+        out << separator << "{\"name\": " << jsonString(event.name) << ", \"cat\": \"face-manager\", \"ph\": \"X\""
+            << ", \"pid\": 1, \"tid\": " << event.thread
+            << ", \"ts\": " << event.start_us << ", \"dur\": " << event.duration_us << ", \"args\": {";
+        if (TRACE_CURRENT_FRAME != event.frame) {
+            out << "\"frame\": " << event.frame;
+        }
+        if (TRACE_NO_ID != event.local_id) {
+            out << ((TRACE_CURRENT_FRAME != event.frame) ? ", " : "") << "\"local_id\": " << event.local_id;
+        }
+        out << "}}";
+        separator = ",\n";
+    }
+    out << "\n]}" << std::endl;
+
+    out.close();
+    if (!out) {
+        logger.error("Error writing trace file " + filename);
+        return false;
+    }
+    return true;
+}
+
+void
+Tracer::nameThread(const std::string &name) {
+    if (enabled()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        thread_names_[traceThreadId()] = name;
+    }
+}
+
+long
+Tracer::droppedEvents() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
+
+void
+Tracer::record(const char *name, int frame, int local_id, int64_t start_us, int64_t end_us) {
+    int thread = traceThreadId();
+    std::lock_guard<std::mutex> lock(mutex_);
+    // spans still open when tracing stopped are dropped
+    if (!enabled()) {
+        return;
+    }
+    if (events_.size() >= max_events_) {
+        ++dropped_;
+        return;
+    }
+    events_.push_back(TraceEvent{name, frame, local_id, thread, start_us, end_us - start_us});
+}
+
+void
+TraceSpan::begin(const char *name, int frame, int local_id) {
+    if (TRACE_CURRENT_FRAME != frame) {
+        current_frame = frame;
+    }
+    name_ = name;
+    frame_ = current_frame;
+    local_id_ = local_id;
+    start_us_ = tracer.now();
+}
@@ -0,0 +1,127 @@
+/*
+ *  Face manager 0.1
+ *  Timeline of where the time goes in each frame, written as Chrome trace-event JSON
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_TRACING_H
+#define FACE_MANAGER_TRACING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Use the frame number of the last span on the same thread that was given one
+int const TRACE_CURRENT_FRAME = -1;
+
+int const TRACE_NO_ID = -1;
+
+// Spans after this many are counted but not kept, about 50MB
+size_t const DEFAULT_TRACE_MAX_EVENTS = 1000000;
+
+/*
+ * Records spans from any thread while enabled and writes them in the Chrome trace-event format, which can be
+ * loaded into chrome://tracing or https://ui.perfetto.dev (which runs locally in the browser).
+ * While disabled a span costs one atomic load.
+ */
+class Tracer {
+public:
+    // Start recording, discarding anything recorded before
+    void start(size_t max_events = DEFAULT_TRACE_MAX_EVENTS);
+
+    // Stop recording and write the spans to filename. Returns false if the file can't be written.
+    bool stop(const std::string &filename);
+
+    inline bool enabled() const {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // Name the calling thread in the trace, ignored unless recording
+    void nameThread(const std::string &name);
+
+    // spans that were not kept because there were already max_events
+    long droppedEvents() const;
+
+    // microseconds since start()
+    inline int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start_time_).count();
+    }
+
+    // name must be a string literal, or otherwise outlive the tracer
+    void record(const char *name, int frame, int local_id, int64_t start_us, int64_t end_us);
+
+private:
+    struct TraceEvent {
+        const char *name;
+        int frame;
+        int local_id;
+        int thread;
+        int64_t start_us;
+        int64_t duration_us;
+    };
+
+    std::atomic<bool> enabled_{false};
+    std::chrono::steady_clock::time_point start_time_ = std::chrono::steady_clock::now();
+
+    mutable std::mutex mutex_;
+    std::vector<TraceEvent> events_;
+    std::map<int, std::string> thread_names_;
+    size_t max_events_ = DEFAULT_TRACE_MAX_EVENTS;
+    long dropped_ = 0;
+};
+
+// define the single instance all modules will use
+extern Tracer tracer;
+
+/*
+ * A span that lasts until the end of the enclosing scope, use TRACE_SPAN to declare one. Spans given a frame
+ * number set the frame for later spans on the same thread, so only the outermost span of each frame needs one.
+ */
+class TraceSpan {
+public:
+    explicit TraceSpan(const char *name, int frame = TRACE_CURRENT_FRAME, int local_id = TRACE_NO_ID) {
+        if (tracer.enabled()) {
+            begin(name, frame, local_id);
+        }
+    }
+
+    ~TraceSpan() {
+        if (name_) {
+            tracer.record(name_, frame_, local_id_, start_us_, tracer.now());
+        }
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    void begin(const char *name, int frame, int local_id);
+
+    const char *name_ = nullptr;
+    int frame_ = TRACE_CURRENT_FRAME;
+    int local_id_ = TRACE_NO_ID;
+    int64_t start_us_ = 0;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+/*
+ * Trace the rest of the enclosing scope, for example
+ *
+ *     TRACE_SPAN("Manager::newFrame", frame_no);
+ *     TRACE_SPAN("update tracker", frame_no, local_id);
+ */
+#define TRACE_SPAN(...) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+
+#endif //FACE_MANAGER_TRACING_H
@@ -0,0 +1,150 @@
+/*
+ *  Face manager 0.1
+ *  Frames read from a video capture as luma with colour built only when needed
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include "videoframe.h"
+#include "imagelogger.h"
+
+VideoFrame::VideoFrame(const cv::Mat &raw, FrameFormat format) : raw_(raw), format_(format) {
+    // the Y plane comes first so can be used in place
+    switch (format_) {
+        case FRAME_GREY:
+            luma_ = raw_;
+            break;
+        case FRAME_I420:
+        case FRAME_NV12:
+            luma_ = raw_.rowRange(0, raw_.rows * 2 / 3);
+            break;
+        default:
+            break;
+    }
+}
+
+cv::Mat &
+VideoFrame::luma() {
+    if (luma_.empty() && !raw_.empty()) {
+        if (FRAME_YUYV == format_) {
+            cv::extractChannel(raw_, luma_, 0);
+        } else {
+            cv::cvtColor(raw_, luma_, cv::COLOR_BGR2GRAY);
+        }
+    }
+    return luma_;
+}
+
+cv::Mat &
+VideoFrame::colour() {
+    if (FRAME_BGR == format_) {
+        return raw_;
+    }
+    if (colour_.empty() && !raw_.empty()) {
+        switch (format_) {
+            case FRAME_GREY:
+                cv::cvtColor(raw_, colour_, cv::COLOR_GRAY2BGR);
+                break;
+            case FRAME_I420:
+                cv::cvtColor(raw_, colour_, cv::COLOR_YUV2BGR_I420);
+                break;
+            case FRAME_NV12:
+                cv::cvtColor(raw_, colour_, cv::COLOR_YUV2BGR_NV12);
+                break;
+            case FRAME_YUYV:
+                cv::cvtColor(raw_, colour_, cv::COLOR_YUV2BGR_YUYV);
+                break;
+            default:
+                break;
+        }
+    }
+    return colour_;
+}
+
+
+FrameReader::FrameReader(cv::VideoCapture &capture, bool luma_only)
+        : capture_(capture), luma_only_(luma_only) {
+    frame_height_ = (int) capture_.get(CV_CAP_PROP_FRAME_HEIGHT);
+    fourcc_ = (int) capture_.get(CV_CAP_PROP_FOURCC);
+    if (luma_only_ && !capture_.set(CV_CAP_PROP_CONVERT_RGB, 0)) {
+        logger.info("Video capture can't disable RGB conversion, reading BGR frames");
+        luma_only_ = false;
+    }
+}
+
+bool
+FrameReader::read(VideoFrame &frame) {
+    cv::Mat raw;
+    if (!capture_.read(raw)) {
+        return false;
+    }
+
+    FrameFormat format = FRAME_BGR;
+    if (luma_only_ && !detectFormat(raw, format)) {
+        logger.error("Unrecognised frame format from video capture, reading BGR frames instead");
+        disableLuma();
+
+        // a single row is usually a compressed frame, such as MJPEG from a webcam
+        if (1 == raw.rows) {
+            raw = cv::imdecode(raw, cv::IMREAD_COLOR);
+        }
+        if (raw.empty() || (CV_8UC3 != raw.type())) {
+            return read(frame);
+        }
+    }
+
+    format_ = format;
+    frame = VideoFrame(raw, format);
+    return true;
+}
+
+bool
+FrameReader::detectFormat(const cv::Mat &raw, FrameFormat &format) const {
+    switch (raw.type()) {
+        case CV_8UC3:
+            // the backend converted the frame anyway
+            format = FRAME_BGR;
+            return true;
+        case CV_8UC2:
+            format = FRAME_YUYV;
+            return true;
+        case CV_8UC1:
+            if (raw.rows == frame_height_) {
+                format = FRAME_GREY;
+                return true;
+            }
+            if (2 * raw.rows == 3 * frame_height_) {
+                format = (CV_FOURCC('N', 'V', '1', '2') == fourcc_) ? FRAME_NV12 : FRAME_I420;
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+void
+FrameReader::disableLuma() {
+    capture_.set(CV_CAP_PROP_CONVERT_RGB, 1);
+    luma_only_ = false;
+}
+
+std::string
+frameFormatToString(FrameFormat format) {
+    switch (format) {
+        case FRAME_BGR:
+            return "BGR";
+        case FRAME_GREY:
+            return "GREY";
+        case FRAME_I420:
+            return "I420";
+        case FRAME_NV12:
+            return "NV12";
+        case FRAME_YUYV:
+            return "YUYV";
+    }
+    return "";
+}
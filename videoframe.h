@@ -0,0 +1,116 @@
+/*
+ *  Face manager 0.1
+ *  Frames read from a video capture as luma with colour built only when needed
+ *
+ *  Copyright (c) 2018 David Snowdon. All rights reserved.
+ *
+ *  Distributed under the Boost Software License, Version 1.0. (See accompanying
+ *  file LICENSE.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef FACE_MANAGER_VIDEO_FRAME_H
+#define FACE_MANAGER_VIDEO_FRAME_H
+
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+enum FrameFormat {
+    FRAME_BGR,  // 8 bit BGR, as read by cv::VideoCapture with RGB conversion enabled
+    FRAME_GREY, // 8 bit luma only
+    FRAME_I420, // planar YUV 4:2:0, one channel 3/2 of the frame height with the Y plane first
+    FRAME_NV12, // as FRAME_I420 but with the U and V planes interleaved
+    FRAME_YUYV  // packed YUV 4:2:2, two channels with Y in the first
+};
+
+/*
+ * A frame as decoded, from which the luma (Y) plane can be used directly for motion detection, face detection and
+ * tracking. The BGR version is only built the first time colour() is called, which should only be needed for
+ * extracting face images and drawing output. For YUV frames luma() shares the decoded pixels.
+ *
+ * Not thread safe, but a frame may be passed from thread to thread as it is in the pipeline.
+ */
+class VideoFrame {
+public:
+    VideoFrame() {
+    }
+
+    // A BGR frame, luma() converts it when first called
+    explicit VideoFrame(const cv::Mat &bgr) : raw_(bgr), format_(FRAME_BGR) {
+    }
+
+    VideoFrame(const cv::Mat &raw, FrameFormat format);
+
+    FrameFormat format() const {
+        return format_;
+    }
+
+    bool empty() const {
+        return raw_.empty();
+    }
+
+    /*
+     * The image to use for processing that works on either BGR or grey images without needing colour:
+     * the frame itself if it was decoded as BGR, otherwise the luma plane. Never converts the frame.
+     */
+    cv::Mat &image() {
+        return (FRAME_BGR == format_) ? raw_ : luma();
+    }
+
+    // 8 bit grey image of the frame
+    cv::Mat &luma();
+
+    // 8 bit BGR image of the frame
+    cv::Mat &colour();
+
+    // true if colour() was called for a frame that was not decoded as BGR
+    bool colourConverted() const {
+        return (FRAME_BGR != format_) && !colour_.empty();
+    }
+
+private:
+    cv::Mat raw_;
+    FrameFormat format_ = FRAME_BGR;
+    cv::Mat luma_;
+    cv::Mat colour_;
+};
+
+/*
+ * Reads VideoFrames from a capture. In luma mode the capture's RGB conversion is turned off so frames are returned
+ * in the decoder's own YUV format. Not every backend supports this, OpenCV's FFmpeg backend for instance always
+ * converts video files to BGR, and some return formats that can't be recognised, in which case the reader goes
+ * back to reading BGR frames. format() shows what is actually being read.
+ */
+class FrameReader {
+public:
+    FrameReader(cv::VideoCapture &capture, bool luma_only = false);
+
+    // Returns false at the end of the video. Each frame is read into new buffers.
+    bool read(VideoFrame &frame);
+
+    // true if luma mode was requested and has not been abandoned
+    bool lumaOnly() const {
+        return luma_only_;
+    }
+
+    // format of the last frame read
+    FrameFormat format() const {
+        return format_;
+    }
+
+private:
+    // Returns false if the format of the raw frame is not recognised
+    bool detectFormat(const cv::Mat &raw, FrameFormat &format) const;
+
+    void disableLuma();
+
+    cv::VideoCapture &capture_;
+    bool luma_only_;
+    int frame_height_;
+    int fourcc_;
+    FrameFormat format_ = FRAME_BGR;
+};
+
+std::string frameFormatToString(FrameFormat format);
+
+#endif //FACE_MANAGER_VIDEO_FRAME_H